@@ -1,112 +1,316 @@
 ﻿#pragma once
 
-#include <list>
-#include <deque>
+#include <atomic>
+#include <cstdint>
 
 #include "multimedia/common/FFmpegUtil.hpp"
+#include "multimedia/common/Futex.hpp"
+#include "multimedia/common/SPSCQueue.hpp"
+#include "multimedia/common/Time.hpp"
 
+/* per-item cost used by the byte/duration limits */
+template <typename T>
+struct AVQueueTraits
+{
+  static int64_t bytes(const T &) { return 0; }
+  static int64_t duration(const T &, AVRational) { return 0; }
+};
+template <>
+struct AVQueueTraits<AVPacketPtr>
+{
+  static int64_t bytes(const AVPacketPtr &pPkt) {
+    return pPkt ? pPkt->size + (int64_t) sizeof(AVPacket) : 0;
+  }
+  /* in AV_TIME_BASE units */
+  static int64_t duration(const AVPacketPtr &pPkt, AVRational tb) {
+    if (!pPkt || pPkt->duration <= 0 || tb.den == 0) return 0;
+    return av_rescale_q(pPkt->duration, tb, AV_TIME_BASE_Q);
+  }
+};
+template <>
+struct AVQueueTraits<AVFramePtr>
+{
+  static int64_t bytes(const AVFramePtr &pFrame) {
+    if (!pFrame) return 0;
+    int64_t n = sizeof(AVFrame);
+    for (auto *pBuf : pFrame->buf) {
+      if (pBuf) n += pBuf->size;
+    }
+    return n;
+  }
+  /* in AV_TIME_BASE units */
+  static int64_t duration(const AVFramePtr &pFrame, AVRational tb) {
+    if (!pFrame) return 0;
+    if (pFrame->nb_samples > 0 && pFrame->sample_rate > 0)
+      return av_rescale(pFrame->nb_samples, AV_TIME_BASE, pFrame->sample_rate);
+    if (pFrame->duration <= 0 || tb.den == 0) return 0;
+    return av_rescale_q(pFrame->duration, tb, AV_TIME_BASE_Q);
+  }
+};
+
+struct AVQueueLimits
+{
+  size_t max_items{1024};
+  /* always accept this many, so a single huge item cannot stall the queue */
+  size_t min_items{1};
+  int64_t max_bytes{0};     // 0 for unlimited
+  int64_t max_duration{0};  // AV_TIME_BASE units, 0 for unlimited
+  /**
+   * Derive the byte limit from the observed bitrate so that it tracks
+   * max_duration, capped by max_bytes. Covers items that carry no duration.
+   * bit_rate seeds the estimate, e.g. from AVCodecParameters::bit_rate.
+   */
+  bool auto_tune{false};
+  int64_t bit_rate{0};
+};
+
+/**
+ * One producer, one consumer. push() blocks while the queue is over its
+ * limits, pop() never blocks and popWait() sleeps until an item arrives.
+ * Built on SPSCQueue, so the hot path takes no lock; the futexes are only
+ * entered when one side actually has to sleep. close() wakes every waiter.
+ *
+ * Limits are expressed in items, bytes and stream-time duration, see
+ * AVQueueLimits.
+ */
 template <typename T>
 class AVQueue
 {
+  using Traits = AVQueueTraits<T>;
+
 public:
-  AVQueue() = default;
+  static constexpr size_t kDefaultCapacity = 1024;
+  static constexpr size_t kMaxCapacity = 1 << 16;
+
+  AVQueue() : data_(kDefaultCapacity) {
+    data_.setDiscardHandler([this](T &x) { release(x); });
+  }
   virtual ~AVQueue() = default;
 
   void open() {
     running_ = true;
-    cond_.notify_all();
+    not_full_.notifyAll();
+    not_empty_.notifyAll();
   }
   void close() {
     running_ = false;
-    cond_.notify_all();
+    not_full_.notifyAll();
+    not_empty_.notifyAll();
   }
 
   bool push(const T& x) {
-    {
-      Mutex::ulock locker(cond_mutex_);
-      cond_.wait(locker, [this] { 
-        return data_.size() <= max_size_ / 5 || !running_; 
-      });
-      if (!running_) return false;
-    }
-    
-    Mutex::lock locker1(mutex_);
-    data_.push_back(x);
-    return true;
+    T y = x;
+    return pushN(&y, 1) == 1;
   }
   bool push(T&& x) {
-    {
-      Mutex::ulock locker(cond_mutex_);
-      cond_.wait(locker, [this] { 
-        return data_.size() <= max_size_ / 5 || !running_; 
-      });
-      if (!running_) return false;
+    return pushN(&x, 1) == 1;
+  }
+  /* blocks until all n items are queued or the queue is closed */
+  size_t pushN(T *items, size_t n) {
+    size_t pushed = 0;
+    while (pushed < n) {
+      if (!running_) break;
+      size_t m = writable(n - pushed);
+      if (m > 0) {
+        int64_t bytes = 0, duration = 0;
+        for (size_t i = pushed; i < pushed + m; ++i) {
+          bytes += Traits::bytes(items[i]);
+          duration += Traits::duration(items[i], time_base_);
+        }
+        bytes_ += bytes;
+        duration_ += duration;
+        data_.tryPushN(items + pushed, m);
+        pushed += m;
+        observe(bytes, duration);
+        not_empty_.notifyOne();
+        continue;
+      }
+
+      auto key = not_full_.prepareWait();
+      if (!running_ || writable(1) > 0) {
+        not_full_.cancelWait();
+        continue;
+      }
+      not_full_.wait(key);
     }
+    return pushed;
+  }
+  /**
+   * Blocks until the queue is back under its limits. This is the
+   * backpressure signal for producers that must stay responsive (seek,
+   * abort) while the consumer is stalled. Returns false on timeout or when
+   * closed.
+   */
+  bool waitWritable(Futex::Timeout timeout = Futex::kInfinite) {
+    const auto deadline = deadlineOf(timeout);
+    while (running_) {
+      if (writable(1) > 0) return true;
 
-    Mutex::lock locker1(mutex_);
-    data_.push_back(x);
-    return true;
+      auto key = not_full_.prepareWait();
+      if (!running_ || writable(1) > 0) {
+        not_full_.cancelWait();
+        continue;
+      }
+      if (!not_full_.wait(key, remainingOf(deadline, timeout))) break;
+    }
+    return running_ && writable(1) > 0;
   }
+
   bool pop(T& x) {
-    if (isEmptyInternal()) {
-      return false;
-    }
-    Mutex::lock locker(mutex_);
-    if (isEmptyInternal()) {
-      return false;
-    }
-    x = data_.front();
-    data_.pop_front();
-    cond_.notify_one();
+    if (!data_.tryPop(x)) return false;
+    release(x);
+    not_full_.notifyOne();
     return true;
   }
-  T peek() const {
-    Mutex::lock locker(mutex_);
-    if (isEmptyInternal()) {
-      return {};
-    }
-    return data_.front();
+  size_t popN(T *out, size_t n) {
+    n = data_.tryPopN(out, n);
+    for (size_t i = 0; i < n; ++i) release(out[i]);
+    if (n > 0) not_full_.notifyOne();
+    return n;
   }
-  T peekLatest() const {
-    Mutex::lock locker(mutex_);
-    if (isEmptyInternal()) {
-      return {};
+  /**
+   * Sleeps until an item is available. Returns false on timeout, or once
+   * the queue is closed and drained.
+   */
+  bool popWait(T& x, Futex::Timeout timeout = Futex::kInfinite) {
+    const auto deadline = deadlineOf(timeout);
+    while (true) {
+      if (pop(x)) return true;
+      if (!running_) return false;
+
+      auto key = not_empty_.prepareWait();
+      if (!running_ || !data_.empty()) {
+        not_empty_.cancelWait();
+        continue;
+      }
+      if (!not_empty_.wait(key, remainingOf(deadline, timeout))) {
+        return pop(x);
+      }
     }
-    return data_.back();
+  }
+  /* consumer side */
+  T peek() {
+    T *x = data_.front();
+    return x ? *x : T{};
+  }
+  T peekLatest() {
+    T *x = data_.back();
+    return x ? *x : T{};
   }
 
+  /* safe from either side, stale items are released by the consumer */
   void clear() {
-    Mutex::lock locker(mutex_);
-    data_.clear();
+    data_.discard();
+    not_full_.notifyAll();
   }
+  /* drops everything now, only while neither side is running */
+  void reset() {
+    data_.reset(data_.capacity());
+    bytes_ = duration_ = 0;
+  }
+
+  bool isEmpty() const { return data_.empty(); }
+  bool isFull() const { return writable(1) == 0; }
+  size_t getSize() const { return data_.size(); }
+  size_t getMaxSize() const { return limits_.max_items; }
+  int64_t getBytes() const { return bytes_; }
+  int64_t getDuration() const { return duration_; }
+  int64_t getByteLimit() const { return byte_limit_; }
+  /* bytes per second seen by the auto-tuner, 0 if unknown */
+  int64_t getByteRate() const { return byte_rate_; }
 
-  bool isEmpty() const {
-    Mutex::lock locker(mutex_);
-    return isEmptyInternal();
+  /* the following resize the ring, only while neither side is running */
+  void setMaxSize(size_t maxSize) {
+    auto limits = limits_;
+    limits.max_items = maxSize;
+    setLimits(limits);
   }
-  bool isFull() const {
-    Mutex::lock locker(mutex_);
-    return isFullInternal();
+  void setLimits(const AVQueueLimits &limits) {
+    limits_ = limits;
+    if (limits_.max_items > kMaxCapacity) limits_.max_items = kMaxCapacity;
+    if (limits_.min_items > limits_.max_items)
+      limits_.min_items = limits_.max_items;
+    data_.reset(limits_.max_items);
+    bytes_ = duration_ = 0;
+    tune_bytes_ = tune_duration_ = 0;
+    byte_rate_ = limits_.bit_rate / 8;
+    byte_limit_ = limits_.max_bytes;
+    retune();
   }
-  size_t getSize() const { return data_.size(); }
-  size_t getMaxSize() const { return max_size_; }
-  void setMaxSize(size_t maxSize) { max_size_ = maxSize; }
+  AVQueueLimits getLimits() const { return limits_; }
+  /* time base of the items' duration field */
+  void setTimeBase(AVRational tb) { time_base_ = tb; }
 
 private:
-  bool isEmptyInternal() const {
-    return data_.empty();
+  /* how many of n items fit under the limits */
+  size_t writable(size_t n) const {
+    const size_t size = data_.size();
+    size_t cap = limits_.max_items;
+    if (cap > data_.capacity()) cap = data_.capacity();
+    if (size >= cap) return 0;
+    if (size >= limits_.min_items) {
+      const int64_t byteLimit = byte_limit_;
+      if (byteLimit > 0 && bytes_ >= byteLimit) return 0;
+      if (limits_.max_duration > 0 && duration_ >= limits_.max_duration)
+        return 0;
+    }
+    return n < cap - size ? n : cap - size;
+  }
+
+  void release(const T &x) {
+    bytes_ -= Traits::bytes(x);
+    duration_ -= Traits::duration(x, time_base_);
+  }
+
+  /* producer side, re-estimates the bitrate once per second of media */
+  void observe(int64_t bytes, int64_t duration) {
+    if (!limits_.auto_tune || limits_.max_duration <= 0) return;
+    tune_bytes_ += bytes;
+    tune_duration_ += duration;
+    if (tune_duration_ < AV_TIME_BASE) return;
+
+    int64_t rate = av_rescale(tune_bytes_, AV_TIME_BASE, tune_duration_);
+    byte_rate_ = byte_rate_ > 0 ? (byte_rate_ * 3 + rate) / 4 : rate;
+    tune_bytes_ = tune_duration_ = 0;
+    retune();
+  }
+  void retune() {
+    if (!limits_.auto_tune || limits_.max_duration <= 0 || byte_rate_ <= 0)
+      return;
+    // 25% headroom so the duration limit stays the one that normally trips
+    int64_t bytes = av_rescale(byte_rate_, limits_.max_duration, AV_TIME_BASE);
+    bytes += bytes / 4;
+    if (limits_.max_bytes > 0 && bytes > limits_.max_bytes)
+      bytes = limits_.max_bytes;
+    byte_limit_ = bytes;
+  }
+
+  static TimeUtil::BaseTimePoint deadlineOf(Futex::Timeout timeout) {
+    if (timeout.count() < 0) return TimeUtil::BaseTimePoint::max();
+    return TimeUtil::now() + timeout;
   }
-  bool isFullInternal() const {
-    return data_.size() >= max_size_;
+  static Futex::Timeout remainingOf(
+    TimeUtil::BaseTimePoint deadline, Futex::Timeout timeout) {
+    if (timeout.count() < 0) return Futex::kInfinite;
+    auto left = TimeUtil::elapse<Futex::Timeout>(TimeUtil::now(), deadline);
+    return left.count() > 0 ? left : Futex::Timeout{0};
   }
+
 private:
-  std::atomic<size_t> max_size_ = INT64_MAX;
-  //std::list<T> data_;
-  std::deque<T> data_;
-  std::condition_variable cond_;
-  mutable Mutex::type cond_mutex_;
-  mutable Mutex::type mutex_;
+  AVQueueLimits limits_;
+  AVRational time_base_{0, 1};
+  SPSCQueue<T> data_;
+  Futex not_full_;
+  Futex not_empty_;
   std::atomic_bool running_{false};
+
+  std::atomic<int64_t> bytes_{0};
+  std::atomic<int64_t> duration_{0};
+  std::atomic<int64_t> byte_limit_{0};
+  std::atomic<int64_t> byte_rate_{0};
+  // producer only
+  int64_t tune_bytes_{0};
+  int64_t tune_duration_{0};
 };
 
 using AVFrameQueue = AVQueue<AVFramePtr>;
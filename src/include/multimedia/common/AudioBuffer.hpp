@@ -1,65 +1,276 @@
 #pragma once
 
+#include <atomic>
 #include <cstdint>
 #include <cstring>
 #include <cassert>
 #include <memory>
 
+#include "multimedia/common/Futex.hpp"
+#include "multimedia/common/SPSCQueue.hpp"
+
+/**
+ * Wraparound PCM ring, one producer (the audio decode thread) and one
+ * consumer (the device callback). Neither side takes a lock or allocates;
+ * the producer may sleep in waitWritable() and is woken by extract(), a
+ * consumer that is not a device callback may sleep in waitReadable() and is
+ * woken by fill() and markEnded().
+ *
+ * Positions are running byte counts, so readable/writable never need a
+ * wrap flag and the producer can stamp the media time of a position with
+ * stamp() for the consumer to derive its clock from.
+ */
 class AudioBuffer
 {
 public:
-  AudioBuffer(uint32_t capacity)
-    : capacity_(capacity) {
-    buf_.reset(new uint8_t[capacity_], std::default_delete<uint8_t[]>());
-    read_offset_ = 0;
-    write_offset_ = 0;
+  AudioBuffer(uint32_t capacity) {
+    uint32_t n = 1;
+    while (n < capacity) n <<= 1;
+    capacity_ = n;
+    mask_ = n - 1;
+    buf_.reset(new uint8_t[capacity_]);
+    memset(buf_.get(), 0, capacity_);
   }
   ~AudioBuffer() = default;
 
-  void fill(const uint8_t *data, uint32_t size) {
+  /* producer side, returns how many bytes were taken */
+  uint32_t fill(const uint8_t *data, uint32_t size) {
     assert(data);
-    uint32_t freeSpace = writableBytes();
+    const uint64_t w = write_pos_.load(std::memory_order_relaxed);
+    const uint64_t r = read_pos_.load(std::memory_order_acquire);
+    uint32_t freeSpace = capacity_ - (uint32_t) (w - r);
     if (size > freeSpace) {
       size = freeSpace;
+      primed_.store(true, std::memory_order_relaxed);
+    }
+    copyIn(w, data, size);
+    write_pos_.store(w + size, std::memory_order_release);
+    if (size > 0) not_empty_.notifyOne();
+    return size;
+  }
+  /**
+   * Producer side: sleeps until `size` bytes (at most the capacity) fit.
+   * Returns false on timeout.
+   */
+  bool waitWritable(uint32_t size, Futex::Timeout timeout) {
+    if (size > capacity_) size = capacity_;
+    // the ring is full, short reads are underruns from here on
+    if (writableBytes() < size) primed_.store(true, std::memory_order_relaxed);
+    while (writableBytes() < size) {
+      auto key = not_full_.prepareWait();
+      if (writableBytes() >= size) {
+        not_full_.cancelWait();
+        break;
+      }
+      if (!not_full_.wait(key, timeout)) return writableBytes() >= size;
     }
-    memcpy(buf_.get() + write_offset_, data, size);
-    write_offset_ += size;
+    return true;
+  }
+  /* producer side: `clock` is the media time right after the last fill() */
+  void stamp(double clock) {
+    // seqlock, the consumer retries if it raced with an update
+    const uint32_t seq = stamp_seq_.load(std::memory_order_relaxed);
+    stamp_seq_.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    stamp_pos_.store(
+      write_pos_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    stamp_clock_.store(clock, std::memory_order_relaxed);
+    stamp_seq_.store(seq + 2, std::memory_order_release);
   }
-  void extract(uint8_t* data, uint32_t size) {
-    uint32_t nReadBytes = readableBytes();
+  /**
+   * Producer side, once the decoder has finished: its final flush is in the
+   * ring and nothing follows until the next discard(), so short reads are
+   * the stream running out rather than underruns.
+   */
+  void markEnded() {
+    ended_.store(true, std::memory_order_release);
+    not_empty_.notifyAll();
+    drained_.notifyAll();
+  }
+  bool isEnded() const { return ended_.load(std::memory_order_acquire); }
+  /**
+   * Safe from either side: everything written so far becomes stale and is
+   * skipped by the consumer's next access. So is the stamp, clock() fails
+   * until the producer stamps new data.
+   */
+  void discard() {
+    primed_.store(false, std::memory_order_relaxed);
+    ended_.store(false, std::memory_order_relaxed);
+    const uint64_t w = write_pos_.load(std::memory_order_acquire);
+    uint64_t mark = discard_.load(std::memory_order_relaxed);
+    while (mark < w
+           && !discard_.compare_exchange_weak(mark, w,
+             std::memory_order_release, std::memory_order_relaxed)) {}
+  }
+
+  /**
+   * Consumer side, copies up to size bytes out (or just skips them when
+   * data is null). A short read counts as an underrun once the ring was
+   * full and until the producer marked the end.
+   */
+  uint32_t extract(uint8_t *data, uint32_t size) {
+    const uint64_t r = skipDiscarded();
+    const uint64_t w = write_pos_.load(std::memory_order_acquire);
+    uint32_t nReadBytes = (uint32_t) (w - r);
     if (size > nReadBytes) {
+      if (primed_.load(std::memory_order_relaxed)
+          && !ended_.load(std::memory_order_relaxed))
+        underruns_.fetch_add(1, std::memory_order_relaxed);
       size = nReadBytes;
     }
-    if (data)
-      memcpy(data, buf_.get() + read_offset_, size);
-    read_offset_ += size;
-    if (read_offset_ >= write_offset_) clear();
+    if (data) copyOut(r, data, size);
+    read_pos_.store(r + size, std::memory_order_release);
+    if (size > 0) {
+      not_full_.notifyOne();
+      if (size == nReadBytes && ended_.load(std::memory_order_relaxed))
+        drained_.notifyAll();
+    }
+    return size;
+  }
+  /**
+   * Consumer side: sleeps until `size` bytes (at most the capacity) are
+   * readable, or fewer once the producer marked the end and some are left.
+   * Returns false on timeout.
+   */
+  bool waitReadable(uint32_t size, Futex::Timeout timeout) {
+    if (size > capacity_) size = capacity_;
+    while (!isReadable(size)) {
+      auto key = not_empty_.prepareWait();
+      if (isReadable(size)) {
+        not_empty_.cancelWait();
+        break;
+      }
+      if (!not_empty_.wait(key, timeout)) return isReadable(size);
+    }
+    return true;
   }
+  /**
+   * Any thread: sleeps until the producer marked the end and the consumer
+   * read everything before it. Returns false on timeout.
+   */
+  bool waitDrained(Futex::Timeout timeout) {
+    while (!isDrained()) {
+      auto key = drained_.prepareWait();
+      if (isDrained()) {
+        drained_.cancelWait();
+        break;
+      }
+      if (!drained_.wait(key, timeout)) return isDrained();
+    }
+    return true;
+  }
+  /**
+   * Consumer side: media time of the next byte to be read, derived from the
+   * latest stamp. Returns false until the producer stamped something, and
+   * after a discard() until it stamped again.
+   */
+  bool clock(double bytesPerSec, double &clock) const {
+    uint32_t seq;
+    uint64_t pos;
+    double stamped;
+    while (true) {
+      seq = stamp_seq_.load(std::memory_order_acquire);
+      pos = stamp_pos_.load(std::memory_order_relaxed);
+      stamped = stamp_clock_.load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (!(seq & 1) && seq == stamp_seq_.load(std::memory_order_relaxed))
+        break;
+    }
+    if (seq == 0 || bytesPerSec <= 0) return false;
+    // stamped at or before the discard mark, it describes dropped data
+    if (pos <= discard_.load(std::memory_order_acquire)) return false;
 
-  uint8_t *peek() const {
-    return buf_.get() + read_offset_;
+    const uint64_t r = read_pos_.load(std::memory_order_relaxed);
+    const int64_t queued = (int64_t) (pos - r);
+    clock = stamped - queued / bytesPerSec;
+    return true;
   }
-  uint8_t *data(uint32_t offset = 0) {
-    return buf_.get() + offset;
+
+  /* whether clock() has something to go by, see there */
+  bool hasClock() const {
+    return stamp_seq_.load(std::memory_order_acquire) != 0
+           && stamp_pos_.load(std::memory_order_relaxed)
+                > discard_.load(std::memory_order_acquire);
   }
+
+  /* only while neither side is running */
   void clear() {
-    read_offset_ = 0;
-    write_offset_ = 0;
-  }
-  void reset() {
-    read_offset_ = 0;
-    write_offset_ = 0;
-    buf_.reset(new uint8_t[capacity_], std::default_delete<uint8_t[]>());
+    read_pos_ = write_pos_ = discard_ = 0;
+    stamp_seq_ = 0;
+    underruns_ = 0;
+    primed_ = ended_ = false;
   }
 
-  uint32_t readableBytes() const { return write_offset_ - read_offset_; }
-  uint32_t writableBytes() const { return capacity_ - write_offset_; }
-  uint32_t size() const { return write_offset_ - read_offset_; }
+  uint32_t readableBytes() const {
+    uint64_t r = read_pos_.load(std::memory_order_acquire);
+    const uint64_t mark = discard_.load(std::memory_order_acquire);
+    if (r < mark) r = mark;
+    const uint64_t w = write_pos_.load(std::memory_order_acquire);
+    return w > r ? (uint32_t) (w - r) : 0;
+  }
+  uint32_t writableBytes() const {
+    const uint64_t w = write_pos_.load(std::memory_order_acquire);
+    const uint64_t r = read_pos_.load(std::memory_order_acquire);
+    return capacity_ - (uint32_t) (w - r);
+  }
+  uint32_t size() const { return readableBytes(); }
   uint32_t capacity() const { return capacity_; }
+  /* readable share of the ring, 0..1 */
+  double fillLevel() const { return (double) readableBytes() / capacity_; }
+  /* seconds of audio waiting in the ring */
+  double queuedLatency(double bytesPerSec) const {
+    return bytesPerSec > 0 ? readableBytes() / bytesPerSec : 0.0;
+  }
+  uint64_t underruns() const { return underruns_; }
 
 private:
-  std::shared_ptr<uint8_t> buf_;
-  uint32_t read_offset_;
-  uint32_t write_offset_;
+  bool isReadable(uint32_t size) const {
+    const uint32_t n = readableBytes();
+    return n >= size || (n > 0 && isEnded());
+  }
+  bool isDrained() const { return isEnded() && readableBytes() == 0; }
+  uint64_t skipDiscarded() {
+    const uint64_t r = read_pos_.load(std::memory_order_relaxed);
+    const uint64_t mark = discard_.load(std::memory_order_acquire);
+    if (r >= mark) return r;
+    read_pos_.store(mark, std::memory_order_release);
+    not_full_.notifyOne();
+    return mark;
+  }
+  void copyIn(uint64_t pos, const uint8_t *data, uint32_t size) {
+    const uint32_t offset = pos & mask_;
+    uint32_t first = capacity_ - offset;
+    if (first > size) first = size;
+    memcpy(buf_.get() + offset, data, first);
+    memcpy(buf_.get(), data + first, size - first);
+  }
+  void copyOut(uint64_t pos, uint8_t *data, uint32_t size) const {
+    const uint32_t offset = pos & mask_;
+    uint32_t first = capacity_ - offset;
+    if (first > size) first = size;
+    memcpy(data, buf_.get() + offset, first);
+    memcpy(data + first, buf_.get(), size - first);
+  }
+
+private:
+  std::unique_ptr<uint8_t[]> buf_;
   uint32_t capacity_;
+  uint32_t mask_;
+
+  // consumer
+  alignas(kCacheLineSize) std::atomic<uint64_t> read_pos_{0};
+  std::atomic<uint64_t> underruns_{0};
+  // producer
+  alignas(kCacheLineSize) std::atomic<uint64_t> write_pos_{0};
+  std::atomic<uint32_t> stamp_seq_{0};
+  std::atomic<uint64_t> stamp_pos_{0};
+  std::atomic<double> stamp_clock_{0.0};
+  // underruns only count in between
+  std::atomic<bool> primed_{false};
+  std::atomic<bool> ended_{false};
+  // shared
+  alignas(kCacheLineSize) std::atomic<uint64_t> discard_{0};
+  Futex not_full_;
+  Futex not_empty_;
+  Futex drained_;
 };
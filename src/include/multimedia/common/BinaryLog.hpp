@@ -0,0 +1,260 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "multimedia/common/Logger.hpp"
+
+/**
+ * Deferred-format logging.
+ *
+ * Every call site registers its level, location and format string once;
+ * after that a statement only copies a small header and its raw arguments
+ * into a per-thread buffer. Buffers reach the file in chunks and
+ * `mmlogdecode` expands the file into text with the usual patterns.
+ *
+ * Until BinaryLog::open() is called the ILOG_*_BIN macros format and log
+ * like their _FMT counterparts, so call sites can switch unconditionally.
+ * Arguments are limited to arithmetic types, enums, pointers and strings.
+ *
+ * While the FlightRecorder is on, the same statements are also captured
+ * below the logger's level (down to MM_LOG_RECORD_MIN_LEVEL).
+ */
+#ifndef MM_LOG_RECORD_MIN_LEVEL
+# define MM_LOG_RECORD_MIN_LEVEL 1  // LogLevel::LTRACE
+#endif
+
+#define __LOG_RECORDING(level) \
+  ((level) >= MM_LOG_RECORD_MIN_LEVEL && FlightRecorder::isEnabled())
+
+#define __LOG_BIN(pLogger, level, fmt, ...)                        \
+  (!(__LOG_ENABLED(pLogger, level) || __LOG_RECORDING(level))      \
+      ? (void) 0                                                   \
+      : BinaryLog::write(                                          \
+          [](const char *function) {                               \
+            static const uint32_t site = BinaryLog::registerSite(  \
+              level, __LOG_FILE, __LINE__, function, fmt);         \
+            return site;                                           \
+          }(__FUNCTION__),                                         \
+          pLogger, __LOG_ENABLED(pLogger, level), ##__VA_ARGS__))
+
+#define ILOG_TRACE_BIN(pLogger, fmt, ...) \
+  __LOG_BIN(pLogger, LogLevel::LTRACE, fmt, ##__VA_ARGS__)
+#define ILOG_DEBUG_BIN(pLogger, fmt, ...) \
+  __LOG_BIN(pLogger, LogLevel::LDEBUG, fmt, ##__VA_ARGS__)
+#define ILOG_INFO_BIN(pLogger, fmt, ...) \
+  __LOG_BIN(pLogger, LogLevel::LINFO, fmt, ##__VA_ARGS__)
+#define ILOG_WARN_BIN(pLogger, fmt, ...) \
+  __LOG_BIN(pLogger, LogLevel::LWARN, fmt, ##__VA_ARGS__)
+#define ILOG_ERROR_BIN(pLogger, fmt, ...) \
+  __LOG_BIN(pLogger, LogLevel::LERROR, fmt, ##__VA_ARGS__)
+
+class BinaryLog
+{
+public:
+  // file layout: kMagic, then records that start with one of these
+  static constexpr char kMagic[8] = {'M', 'M', 'B', 'L', 'O', 'G', '1', '\0'};
+  enum Record : uint8_t
+  {
+    SITE = 1,    // u32 id, u8 level, u32 line, str file, str function, str fmt
+    LOGGER = 2,  // u32 id, str name
+    THREAD = 3,  // u32 id, str name, str id
+    EVENT = 4,   // EventHeader, payload
+  };
+  enum Arg : uint8_t
+  {
+    I64 = 1,
+    U64 = 2,
+    F64 = 3,
+    BOOL = 4,
+    CHAR = 5,
+    STR = 6,  // u32 size, bytes
+    PTR = 7,
+  };
+  struct EventHeader
+  {
+    uint32_t site;
+    uint32_t logger;
+    uint32_t thread;
+    uint32_t size;  // payload bytes
+    int64_t timestamp;
+  };
+  struct Site
+  {
+    LogLevel level;
+    uint32_t line;
+    const char *file;
+    const char *function;
+    const char *fmt;
+  };
+
+  /* starts writing to filename (truncated), false if it cannot be created */
+  static bool open(const std::string &filename);
+  static void close();
+  static bool isOpen() { return s_open.load(std::memory_order_acquire); }
+  /* pushes every thread's buffered records to the file */
+  static void flush();
+
+  static uint32_t registerSite(LogLevel::Level level, const char *file,
+    int line, const char *function, const char *fmt);
+  static const Site *site(uint32_t id);
+
+  /* enabled: the logger takes the event, otherwise it is only recorded */
+  template <typename... Args>
+  static void write(uint32_t site, const Logger::ptr &pLogger, bool enabled,
+    const Args &...args);
+
+  /* arguments in payload as a message, per the site's format string */
+  static std::string formatPayload(
+    const char *fmt, const char *payload, size_t size);
+
+  template <typename T>
+  static void encode(std::vector<char> &buffer, const T &value) {
+    using U = std::decay_t<T>;
+    if constexpr (std::is_same_v<U, bool>) {
+      put(buffer, BOOL, static_cast<uint8_t>(value));
+    }
+    else if constexpr (std::is_same_v<U, char>) {
+      put(buffer, CHAR, value);
+    }
+    else if constexpr (std::is_enum_v<U>) {
+      encode(buffer, static_cast<std::underlying_type_t<U>>(value));
+    }
+    else if constexpr (std::is_integral_v<U> && std::is_signed_v<U>) {
+      put(buffer, I64, static_cast<int64_t>(value));
+    }
+    else if constexpr (std::is_integral_v<U>) {
+      put(buffer, U64, static_cast<uint64_t>(value));
+    }
+    else if constexpr (std::is_floating_point_v<U>) {
+      put(buffer, F64, static_cast<double>(value));
+    }
+    else if constexpr (std::is_convertible_v<const U &, std::string_view>) {
+      std::string_view str("(null)");
+      if constexpr (std::is_pointer_v<U>) {
+        if (value) str = value;
+      }
+      else {
+        str = value;
+      }
+      const uint32_t size = static_cast<uint32_t>(str.size());
+      put(buffer, STR, size);
+      buffer.insert(buffer.end(), str.data(), str.data() + size);
+    }
+    else if constexpr (std::is_pointer_v<U>) {
+      const auto address = reinterpret_cast<uintptr_t>(value);
+      put(buffer, PTR, static_cast<uint64_t>(address));
+    }
+    else {
+      static_assert(sizeof(U) == 0, "unsupported binary log argument type");
+    }
+  }
+
+private:
+  template <typename T>
+  static void put(std::vector<char> &buffer, Arg tag, T value) {
+    const size_t pos = buffer.size();
+    buffer.resize(pos + 1 + sizeof(T));
+    buffer[pos] = static_cast<char>(tag);
+    std::memcpy(buffer.data() + pos + 1, &value, sizeof(T));
+  }
+
+  /**
+   * Locks the calling thread's buffer and appends an event header; nullptr
+   * once the thread is tearing down.
+   */
+  static std::vector<char> *beginEvent(uint32_t site, const Logger &logger);
+  /* patches the payload size in and unlocks the buffer */
+  static void endEvent(uint32_t site);
+
+  template <typename... Args>
+  static void writeText(
+    uint32_t site, const Logger::ptr &pLogger, const Args &...args) {
+    const Site *pSite = BinaryLog::site(site);
+    auto pEvent = std::make_shared<LogEvent>(pSite->level,
+      std::this_thread::get_id(), pSite->file, pSite->line, pSite->function,
+      std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch())
+        .count());
+    pEvent->format(pSite->fmt, args...);
+    pLogger->log(pEvent);
+  }
+
+private:
+  friend class FlightRecorder;
+
+  static inline std::atomic<bool> s_open{false};
+};
+
+struct FlightRecorderOptions
+{
+  size_t events_per_thread{1024};
+  std::string directory{kLogBasePath};  // where unnamed dumps go
+  bool dump_on_error{true};             // ERROR and up, FATAL synchronously
+  int64_t min_dump_interval_ms{5000};   // between error-triggered dumps
+  bool dump_on_signal{true};            // SIGUSR1, where it exists
+};
+
+/**
+ * Keeps the last events_per_thread ILOG_*_BIN events of every thread in
+ * memory, at any level and unformatted, and writes them out as a binary
+ * log (see mmlogdecode) when something goes wrong. Recording costs one
+ * uncontended lock and a copy of the raw arguments.
+ */
+class FlightRecorder
+{
+public:
+  static void enable(FlightRecorderOptions options = {});
+  static void disable();
+  static bool isEnabled() { return s_enabled.load(std::memory_order_relaxed); }
+
+  /**
+   * Writes every thread's ring (including the last few threads that
+   * exited) to filename or to a fresh file in the dump directory. Returns
+   * the file written, "" on failure.
+   */
+  static std::string dump(const std::string &filename = "");
+  /* a dump on the recorder thread, without blocking the caller */
+  static void requestDump();
+  /* called for every logged event at ERROR and up */
+  static void onError(LogLevel level);
+
+  template <typename... Args>
+  static void record(uint32_t site, const Logger &logger, const Args &...args) {
+    auto *pScratch = beginRecord();
+    if (!pScratch) return;
+    (BinaryLog::encode(*pScratch, args), ...);
+    endRecord(site, logger);
+  }
+
+private:
+  /* the calling thread's cleared scratch buffer, nullptr at thread exit */
+  static std::vector<char> *beginRecord();
+  /* moves the scratch buffer into the thread's ring */
+  static void endRecord(uint32_t site, const Logger &logger);
+
+  static inline std::atomic<bool> s_enabled{false};
+};
+
+template <typename... Args>
+void BinaryLog::write(uint32_t site, const Logger::ptr &pLogger, bool enabled,
+  const Args &...args) {
+  if (FlightRecorder::isEnabled()) {
+    FlightRecorder::record(site, *pLogger, args...);
+  }
+  if (!enabled) return;
+
+  if (!isOpen()) {
+    writeText(site, pLogger, args...);
+    return;
+  }
+  auto *pBuffer = beginEvent(site, *pLogger);
+  if (!pBuffer) return;
+  (encode(*pBuffer, args), ...);
+  endEvent(site);
+}
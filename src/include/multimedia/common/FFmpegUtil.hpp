@@ -18,6 +18,7 @@ extern "C"
 }
 
 #include <multimedia/common/Logger.hpp>
+#include <multimedia/common/ObjectPool.hpp>
 
 static void version() {
   // print ffmpeg version
@@ -43,15 +44,64 @@ static void ffinit() {
 using AVFramePtr = std::shared_ptr<AVFrame>;
 using AVPacketPtr = std::shared_ptr<AVPacket>;
 
+struct AVFramePoolPolicy
+{
+  static AVFrame *create() { return av_frame_alloc(); }
+  static void recycle(AVFrame *p) { av_frame_unref(p); }
+  static void destroy(AVFrame *p) { av_frame_free(&p); }
+};
+struct AVPacketPoolPolicy
+{
+  static AVPacket *create() { return av_packet_alloc(); }
+  static void recycle(AVPacket *p) { av_packet_unref(p); }
+  static void destroy(AVPacket *p) { av_packet_free(&p); }
+};
+/* shells are unreferenced on release, their data goes back to its owner */
+using AVFramePool = ObjectPool<AVFrame, AVFramePoolPolicy>;
+using AVPacketPool = ObjectPool<AVPacket, AVPacketPoolPolicy>;
+
+struct AVFrameRecycler
+{
+  void operator()(AVFrame *p) const { AVFramePool::instance()->release(p); }
+};
+struct AVPacketRecycler
+{
+  void operator()(AVPacket *p) const { AVPacketPool::instance()->release(p); }
+};
+
+/* both the shell and the shared_ptr control block come from a pool */
 static AVFramePtr makeAVFrame() {
-  return AVFramePtr(av_frame_alloc(), [](AVFrame *p) {
-    // if (p->extended_data) av_freep(p->extended_data);
-    // if (p->data) av_freep(p->data);
-    av_frame_free(&p);
-  });
+  AVFrame *p = AVFramePool::instance()->acquire();
+  if (!p) return nullptr;
+  return AVFramePtr(p, AVFrameRecycler(), PoolAllocator<AVFrame>());
 }
 static AVPacketPtr makeAVPacket() {
-  return AVPacketPtr(av_packet_alloc(), [](AVPacket *p){
-    av_packet_free(&p);
-  });
+  AVPacket *p = AVPacketPool::instance()->acquire();
+  if (!p) return nullptr;
+  return AVPacketPtr(p, AVPacketRecycler(), PoolAllocator<AVPacket>());
+}
+
+/* steady state should show acquired growing while allocated stays flat */
+static void dumpAVPoolStats() {
+  auto f = AVFramePool::instance()->stats();
+  auto p = AVPacketPool::instance()->stats();
+  ILOG_DEBUG_FMT(GET_LOGGER3("ffmpeg"),
+    "AVFrame pool: {} acquired, {} allocated, {} freed, {} idle | "
+    "AVPacket pool: {} acquired, {} allocated, {} freed, {} idle",
+    f.acquired, f.created, f.destroyed, f.shared, p.acquired, p.created,
+    p.destroyed, p.shared);
+}
+
+/* seek generation of a queued packet/frame, kept in the user-owned opaque */
+static int getSerial(const AVPacket *pPkt) {
+  return (int) (intptr_t) pPkt->opaque;
+}
+static void setSerial(AVPacket *pPkt, int serial) {
+  pPkt->opaque = (void *) (intptr_t) serial;
+}
+static int getSerial(const AVFrame *pFrame) {
+  return (int) (intptr_t) pFrame->opaque;
+}
+static void setSerial(AVFrame *pFrame, int serial) {
+  pFrame->opaque = (void *) (intptr_t) serial;
 }
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+
+#include "multimedia/common/Platform.hpp"
+#include "multimedia/common/noncopyable.hpp"
+
+#if defined(__LINUX__)
+# include <linux/futex.h>
+# include <sys/syscall.h>
+# include <time.h>
+# include <unistd.h>
+#elif defined(__WIN__)
+# pragma comment(lib, "Synchronization.lib")
+#endif
+
+/**
+ * Event count over a 32-bit futex word.
+ *
+ * The waiter registers itself, rechecks its predicate and only then sleeps:
+ *
+ *   auto key = futex.prepareWait();
+ *   if (ready()) { futex.cancelWait(); return; }
+ *   futex.wait(key);
+ *
+ * notifyOne()/notifyAll() bump the epoch and enter the kernel only when
+ * someone is actually sleeping, so the uncontended path never takes a lock.
+ */
+class Futex : public noncopyable
+{
+public:
+  using Timeout = std::chrono::microseconds;
+  static constexpr Timeout kInfinite{-1};
+
+  Futex() = default;
+  ~Futex() = default;
+
+  uint32_t prepareWait() {
+    waiters_.fetch_add(1, std::memory_order_seq_cst);
+    return epoch_.load(std::memory_order_seq_cst);
+  }
+  void cancelWait() { waiters_.fetch_sub(1, std::memory_order_seq_cst); }
+
+  /* returns false if the timeout expired before a notification */
+  bool wait(uint32_t key, Timeout timeout = kInfinite) {
+    bool notified = true;
+    if (epoch_.load(std::memory_order_seq_cst) == key) {
+      notified = sleep(key, timeout)
+                 || epoch_.load(std::memory_order_seq_cst) != key;
+    }
+    waiters_.fetch_sub(1, std::memory_order_seq_cst);
+    return notified;
+  }
+
+  void notifyOne() {
+    epoch_.fetch_add(1, std::memory_order_seq_cst);
+    if (waiters_.load(std::memory_order_seq_cst) > 0) wake(1);
+  }
+  void notifyAll() {
+    epoch_.fetch_add(1, std::memory_order_seq_cst);
+    if (waiters_.load(std::memory_order_seq_cst) > 0) wake(INT_MAX);
+  }
+
+private:
+  bool sleep(uint32_t key, Timeout timeout) {
+#if defined(__LINUX__)
+    struct timespec ts, *pts = nullptr;
+    if (timeout.count() >= 0) {
+      ts.tv_sec = timeout.count() / 1000000;
+      ts.tv_nsec = (timeout.count() % 1000000) * 1000;
+      pts = &ts;
+    }
+    long r = ::syscall(SYS_futex, reinterpret_cast<uint32_t *>(&epoch_),
+      FUTEX_WAIT_PRIVATE, key, pts, nullptr, 0);
+    return !(r < 0 && errno == ETIMEDOUT);
+#elif defined(__WIN__)
+    DWORD ms = timeout.count() < 0
+                 ? INFINITE
+                 : static_cast<DWORD>((timeout.count() + 999) / 1000);
+    return ::WaitOnAddress(&epoch_, &key, sizeof(key), ms) == TRUE;
+#endif
+  }
+  void wake(int n) {
+#if defined(__LINUX__)
+    ::syscall(SYS_futex, reinterpret_cast<uint32_t *>(&epoch_),
+      FUTEX_WAKE_PRIVATE, n, nullptr, nullptr, 0);
+#elif defined(__WIN__)
+    if (n == 1)
+      ::WakeByAddressSingle(&epoch_);
+    else
+      ::WakeByAddressAll(&epoch_);
+#endif
+  }
+
+private:
+  static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t),
+    "futex word must be a plain 32-bit integer");
+
+  std::atomic<uint32_t> epoch_{0};
+  std::atomic<uint32_t> waiters_{0};
+};
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * Self-contained gzip (RFC 1952) writer for archiving logs.
+ *
+ * Deflate is LZ77 over a 32 KiB window (hash chains, greedy matching)
+ * coded with the fixed Huffman tables of RFC 1951. It compresses less than
+ * zlib's dynamic trees, but repetitive log text still shrinks several
+ * times, and the output is readable by gzip/zcat.
+ */
+namespace gzip_util
+{
+uint32_t crc32(uint32_t crc, const void *data, size_t size);
+
+/**
+ * Writes src compressed to dst, streaming with bounded memory. On failure
+ * dst is removed and src is left alone.
+ */
+bool compress_file(const std::string &src, const std::string &dst);
+}  // namespace gzip_util
@@ -1,7 +1,9 @@
 ﻿#pragma once
 
+#include <atomic>
 #include <cstdarg>
 #include <cstdint>
+#include <cstdio>
 #include <functional>
 #include <chrono>
 #include <future>
@@ -11,21 +13,37 @@
 #include <sstream>
 #include <string>
 #include <thread>
+#include <type_traits>
 #include <unordered_map>
 #include <vector>
 
+#include "multimedia/common/Futex.hpp"
+#include "multimedia/common/MPSCQueue.hpp"
 #include "multimedia/common/Mutex.hpp"
 #include "multimedia/common/Thread.hpp"
+#include "multimedia/common/noncopyable.hpp"
 
-#include <fmt/core.h>
+#include <fmt/format.h>
 #include <yaml-cpp/yaml.h>
 
+/* offset of the basename in a path literal, folded per call site */
+constexpr size_t logBasenameOffset(const char *path) {
+  size_t offset = 0;
+  for (size_t i = 0; path[i] != '\0'; ++i) {
+    if (path[i] == '/' || path[i] == '\\') offset = i + 1;
+  }
+  return offset;
+}
+#define __LOG_FILE \
+  (__FILE__      \
+   + std::integral_constant<size_t, logBasenameOffset(__FILE__)>::value)
+
 #define __LogEventGen(level, timestamp) \
   std::make_shared<LogEvent>(     \
-    level, std::this_thread::get_id(), __FILE__, __LINE__, __FUNCTION__, timestamp)
+    level, std::this_thread::get_id(), __LOG_FILE, __LINE__, __FUNCTION__, timestamp)
 
 #define __LogEventGen2(level)                                          \
-  std::make_shared<LogEvent>(level, std::this_thread::get_id(), __FILE__, __LINE__, __FUNCTION__, \
+  std::make_shared<LogEvent>(level, std::this_thread::get_id(), __LOG_FILE, __LINE__, __FUNCTION__, \
     std::chrono::duration_cast<std::chrono::milliseconds>(             \
       std::chrono::system_clock::now() \
       .time_since_epoch())             \
@@ -38,40 +56,103 @@
 #define __LogEventWrapperGen2(pLogger, level) \
   std::make_shared<LogEventWrapper>(__LogEventGen2(level), pLogger)
 
-#define __LOG_STREAM(pLogger, level) \
-  __LogEventWrapperGen2(pLogger, level)->getSS()
+/**
+ * Statements below this level are compiled out: their condition folds to
+ * false and the arguments are never evaluated. Release builds keep INFO and
+ * up unless told otherwise, e.g. -DMM_LOG_MIN_LEVEL=1 keeps everything.
+ */
+#ifndef MM_LOG_MIN_LEVEL
+# ifdef NDEBUG
+#  define MM_LOG_MIN_LEVEL 3  // LogLevel::LINFO
+# else
+#  define MM_LOG_MIN_LEVEL 1  // LogLevel::LTRACE
+# endif
+#endif
+
+/**
+ * The logger's level is checked before any event is built or any argument
+ * evaluated. Both forms stay single expressions, so they need no braces
+ * after an unbraced if.
+ */
+#define __LOG_ENABLED(pLogger, level) \
+  ((level) >= MM_LOG_MIN_LEVEL && (pLogger)->isEnabled(level))
+
+#define __LOG_STREAM(pLogger, level)               \
+  !__LOG_ENABLED(pLogger, level)                   \
+    ? (void) 0                                     \
+    : LogStreamVoidify()                           \
+        & __LogEventWrapperGen2(pLogger, level)->getSS()
+
+#define __LOG_FMT(pLogger, level, fmt, ...)                \
+  (!__LOG_ENABLED(pLogger, level)                          \
+      ? (void) 0                                           \
+      : __LogEventWrapperGen2(pLogger, level)              \
+          ->getEvent()                                     \
+          ->format(fmt, ##__VA_ARGS__))
+
+/**
+ * Sampled forms for statements inside per-packet/per-frame loops, each call
+ * site keeps its own LogSite. _EVERY_N logs the 1st, (n+1)th, ... call;
+ * _EVERY_MS logs at most once per period and tells how many calls it
+ * skipped since the last line it let through.
+ */
+#define __LOG_SITE() \
+  ([]() -> LogSite & { static LogSite site; return site; }())
+
+#define __LOG_EVERY_N(pLogger, level, n, fmt, ...)             \
+  (!__LOG_ENABLED(pLogger, level) || !__LOG_SITE().everyN(n)   \
+      ? (void) 0                                               \
+      : __LogEventWrapperGen2(pLogger, level)                  \
+          ->getEvent()                                         \
+          ->format(fmt, ##__VA_ARGS__))
+
+#define __LOG_EVERY_MS(pLogger, level, ms, fmt, ...)           \
+  (!__LOG_ENABLED(pLogger, level) || !__LOG_SITE().everyMs(ms) \
+      ? (void) 0                                               \
+      : __LogEventWrapperGen2(pLogger, level)                  \
+          ->setSuppressed(LogSite::lastSkipped())              \
+          .getEvent()                                          \
+          ->format(fmt, ##__VA_ARGS__))
 
 #define LOG_ROOT()       LogManager::instance()->getRoot()
 #define GET_LOGGER(name) LogManager::instance()->getLogger(name)
 
-#define ILOG_TRACE_FMT(pLogger, fmt, ...)                \
-  __LogEventWrapperGen2(pLogger, LogLevel::LTRACE) \
-    ->getEvent()                                         \
-    ->format(fmt, ##__VA_ARGS__)
-#define ILOG_DEBUG_FMT(pLogger, fmt, ...)                \
-  __LogEventWrapperGen2(pLogger, LogLevel::LDEBUG) \
-    ->getEvent()                                         \
-    ->format(fmt, ##__VA_ARGS__)
-#define ILOG_INFO_FMT(pLogger, fmt, ...)                \
-  __LogEventWrapperGen2(pLogger, LogLevel::LINFO) \
-    ->getEvent()                                        \
-    ->format(fmt, ##__VA_ARGS__)
-#define ILOG_CRITICAL_FMT(pLogger, fmt, ...)                \
-  __LogEventWrapperGen2(pLogger, LogLevel::LCRITICAL) \
-    ->getEvent()                                            \
-    ->format(fmt, ##__VA_ARGS__)
-#define ILOG_WARN_FMT(pLogger, fmt, ...)                \
-  __LogEventWrapperGen2(pLogger, LogLevel::LWARN) \
-    ->getEvent()                                        \
-    ->format(fmt, ##__VA_ARGS__)
-#define ILOG_ERROR_FMT(pLogger, fmt, ...)                \
-  __LogEventWrapperGen2(pLogger, LogLevel::LERROR) \
-    ->getEvent()                                         \
-    ->format(fmt, ##__VA_ARGS__)
-#define ILOG_FATAL_FMT(pLogger, fmt, ...)                \
-  __LogEventWrapperGen2(pLogger, LogLevel::LFATAL) \
-    ->getEvent()                                         \
-    ->format(fmt, ##__VA_ARGS__)
+#define ILOG_TRACE_FMT(pLogger, fmt, ...) \
+  __LOG_FMT(pLogger, LogLevel::LTRACE, fmt, ##__VA_ARGS__)
+#define ILOG_DEBUG_FMT(pLogger, fmt, ...) \
+  __LOG_FMT(pLogger, LogLevel::LDEBUG, fmt, ##__VA_ARGS__)
+#define ILOG_INFO_FMT(pLogger, fmt, ...) \
+  __LOG_FMT(pLogger, LogLevel::LINFO, fmt, ##__VA_ARGS__)
+#define ILOG_CRITICAL_FMT(pLogger, fmt, ...) \
+  __LOG_FMT(pLogger, LogLevel::LCRITICAL, fmt, ##__VA_ARGS__)
+#define ILOG_WARN_FMT(pLogger, fmt, ...) \
+  __LOG_FMT(pLogger, LogLevel::LWARN, fmt, ##__VA_ARGS__)
+#define ILOG_ERROR_FMT(pLogger, fmt, ...) \
+  __LOG_FMT(pLogger, LogLevel::LERROR, fmt, ##__VA_ARGS__)
+#define ILOG_FATAL_FMT(pLogger, fmt, ...) \
+  __LOG_FMT(pLogger, LogLevel::LFATAL, fmt, ##__VA_ARGS__)
+
+// sampled fmt-style
+#define ILOG_TRACE_EVERY_N(pLogger, n, fmt, ...) \
+  __LOG_EVERY_N(pLogger, LogLevel::LTRACE, n, fmt, ##__VA_ARGS__)
+#define ILOG_DEBUG_EVERY_N(pLogger, n, fmt, ...) \
+  __LOG_EVERY_N(pLogger, LogLevel::LDEBUG, n, fmt, ##__VA_ARGS__)
+#define ILOG_INFO_EVERY_N(pLogger, n, fmt, ...) \
+  __LOG_EVERY_N(pLogger, LogLevel::LINFO, n, fmt, ##__VA_ARGS__)
+#define ILOG_WARN_EVERY_N(pLogger, n, fmt, ...) \
+  __LOG_EVERY_N(pLogger, LogLevel::LWARN, n, fmt, ##__VA_ARGS__)
+#define ILOG_ERROR_EVERY_N(pLogger, n, fmt, ...) \
+  __LOG_EVERY_N(pLogger, LogLevel::LERROR, n, fmt, ##__VA_ARGS__)
+#define ILOG_TRACE_EVERY_MS(pLogger, ms, fmt, ...) \
+  __LOG_EVERY_MS(pLogger, LogLevel::LTRACE, ms, fmt, ##__VA_ARGS__)
+#define ILOG_DEBUG_EVERY_MS(pLogger, ms, fmt, ...) \
+  __LOG_EVERY_MS(pLogger, LogLevel::LDEBUG, ms, fmt, ##__VA_ARGS__)
+#define ILOG_INFO_EVERY_MS(pLogger, ms, fmt, ...) \
+  __LOG_EVERY_MS(pLogger, LogLevel::LINFO, ms, fmt, ##__VA_ARGS__)
+#define ILOG_WARN_EVERY_MS(pLogger, ms, fmt, ...) \
+  __LOG_EVERY_MS(pLogger, LogLevel::LWARN, ms, fmt, ##__VA_ARGS__)
+#define ILOG_ERROR_EVERY_MS(pLogger, ms, fmt, ...) \
+  __LOG_EVERY_MS(pLogger, LogLevel::LERROR, ms, fmt, ##__VA_ARGS__)
 
 
 #define ILOG_TRACE(pLogger)    __LOG_STREAM(pLogger, LogLevel::LTRACE)
@@ -83,34 +164,20 @@
 #define ILOG_FATAL(pLogger)    __LOG_STREAM(pLogger, LogLevel::LFATAL)
 
 
-#define LOG_TRACE_FMT(fmt, ...)                             \
-  __LogEventWrapperGen2(LOG_ROOT(), LogLevel::LTRACE) \
-    ->getEvent()                                            \
-    ->format(fmt, ##__VA_ARGS__)
-#define LOG_DEBUG_FMT(fmt, ...)                             \
-  __LogEventWrapperGen2(LOG_ROOT(), LogLevel::LDEBUG) \
-    ->getEvent()                                            \
-    ->format(fmt, ##__VA_ARGS__)
-#define LOG_INFO_FMT(fmt, ...)                             \
-  __LogEventWrapperGen2(LOG_ROOT(), LogLevel::LINFO) \
-    ->getEvent()                                           \
-    ->format(fmt, ##__VA_ARGS__)
-#define LOG_CRITICAL_FMT(fmt, ...)                             \
-  __LogEventWrapperGen2(LOG_ROOT(), LogLevel::LCRITICAL) \
-    ->getEvent()                                               \
-    ->format(fmt, ##__VA_ARGS__)
-#define LOG_WARN_FMT(fmt, ...)                             \
-  __LogEventWrapperGen2(LOG_ROOT(), LogLevel::LWARN) \
-    ->getEvent()                                           \
-    ->format(fmt, ##__VA_ARGS__)
-#define LOG_ERROR_FMT(fmt, ...)                             \
-  __LogEventWrapperGen2(LOG_ROOT(), LogLevel::LERROR) \
-    ->getEvent()                                            \
-    ->format(fmt, ##__VA_ARGS__)
-#define LOG_FATAL_FMT(fmt, ...)                             \
-  __LogEventWrapperGen2(LOG_ROOT(), LogLevel::LFATAL) \
-    ->getEvent()                                            \
-    ->format(fmt, ##__VA_ARGS__)
+#define LOG_TRACE_FMT(fmt, ...) \
+  __LOG_FMT(LOG_ROOT(), LogLevel::LTRACE, fmt, ##__VA_ARGS__)
+#define LOG_DEBUG_FMT(fmt, ...) \
+  __LOG_FMT(LOG_ROOT(), LogLevel::LDEBUG, fmt, ##__VA_ARGS__)
+#define LOG_INFO_FMT(fmt, ...) \
+  __LOG_FMT(LOG_ROOT(), LogLevel::LINFO, fmt, ##__VA_ARGS__)
+#define LOG_CRITICAL_FMT(fmt, ...) \
+  __LOG_FMT(LOG_ROOT(), LogLevel::LCRITICAL, fmt, ##__VA_ARGS__)
+#define LOG_WARN_FMT(fmt, ...) \
+  __LOG_FMT(LOG_ROOT(), LogLevel::LWARN, fmt, ##__VA_ARGS__)
+#define LOG_ERROR_FMT(fmt, ...) \
+  __LOG_FMT(LOG_ROOT(), LogLevel::LERROR, fmt, ##__VA_ARGS__)
+#define LOG_FATAL_FMT(fmt, ...) \
+  __LOG_FMT(LOG_ROOT(), LogLevel::LFATAL, fmt, ##__VA_ARGS__)
 
 
 #define LOG_TRACE()    __LOG_STREAM(LOG_ROOT(), LogLevel::LTRACE)
@@ -268,29 +335,47 @@ class LogEvent
 public:
   using ptr = std::shared_ptr<LogEvent>;
 
-  LogEvent(LogLevel level, std::thread::id tid, const std::string &filename, int32_t line,
-    const std::string &functionName, int64_t timestamp,
+  /* filename and functionName must outlive the event, e.g. literals */
+  LogEvent(LogLevel level, std::thread::id tid, const char *filename,
+    int32_t line, const char *functionName, int64_t timestamp,
     LogColorConfig config = LogColorConfig());
 
-  std::string getFilename() const { return filename_; }
-  std::string getFunctionName() const { return function_name_; }
+  /* basename of the source file */
+  const char *getFilename() const { return filename_; }
+  const char *getFunctionName() const { return function_name_; }
   int32_t getLine() const { return line_; }
   int64_t getTimestamp() const { return timestamp_; }
-  std::string getContent() const { return ss_.str(); }
+  std::string getContent() const;
+  /* appends the message without building an intermediate string */
+  void appendContent(fmt::memory_buffer &out) const;
   // TODO: add thread id and process id
   std::thread::id getThreadId() const { return tid_; }
-  std::string getThreadName() const { return Thread::name(tid_); }
+  std::string getThreadName() const {
+    return thread_name_.empty() ? Thread::name(tid_) : thread_name_;
+  }
+  /* events replayed from a binary log carry their thread as text */
+  void setThread(std::string name, std::string id) {
+    thread_name_ = std::move(name);
+    thread_id_ = std::move(id);
+  }
+  bool isReplayed() const { return !thread_id_.empty(); }
+  const std::string &getThreadIdText() const { return thread_id_; }
   // int getProcessId() const {}
 
   LogLevel getLevel() const { return level_; }
   LogColorConfig getColorConfig() const { return color_config_; }
-  std::stringstream &getSS() { return ss_; }
+  /* created on first use, fmt-style statements never need it */
+  std::stringstream &getSS() {
+    if (!ss_) ss_ = std::make_unique<std::stringstream>();
+    return *ss_;
+  }
 
 #ifdef FMT_VERSION
   // fmt-style
   template <typename... Args>
   void format(::fmt::string_view fmt, Args &&...args) {
-    ss_ << ::fmt::format(fmt, std::forward<Args>(args)...);
+    ::fmt::vformat_to(std::back_inserter(content_), fmt,
+      ::fmt::make_format_args(args...));
   }
 #else
   // c-style
@@ -298,31 +383,29 @@ public:
   void format(::std::string_view fmt, Args &&...args) {
     char buf[256];
     snprintf(buf, 256, fmt.data(), std::forward<Args>(args)...);
-    ss_ << std::string(buf);
+    content_.append(buf);
   }
 #endif
 private:
   std::thread::id tid_;
-  std::string filename_;
-  std::string function_name_;
+  const char *filename_;
+  const char *function_name_;
   int32_t line_ = 0;
   int64_t timestamp_ = 0;
-  std::stringstream ss_;
+  std::string content_;
+  std::unique_ptr<std::stringstream> ss_;
+  std::string thread_name_;
+  std::string thread_id_;
   LogLevel level_;
   LogColorConfig color_config_;
 };
 
-struct LogFormatterItem
-{
-  using ptr = std::shared_ptr<LogFormatterItem>;
-
-  LogFormatterItem() = default;
-  virtual ~LogFormatterItem() = default;
-
-  virtual void format(std::ostream &os, LogEvent::ptr pLogEvent,
-    std::shared_ptr<Logger> pLogger) = 0;
-};
-
+/**
+ * The pattern is compiled once into a flat list of instructions; format()
+ * walks it and appends straight into a fmt::memory_buffer. Dates are
+ * rendered at most once per second and thread, thread ids and names once
+ * per thread.
+ */
 class LogFormatter
 {
 protected:
@@ -347,6 +430,12 @@ public:
   std::string format(LogEvent::ptr pLogEvent, std::shared_ptr<Logger> pLogger);
   std::ostream &format(
     std::ostream &os, LogEvent::ptr pLogEvent, std::shared_ptr<Logger> pLogger);
+  /* appends the rendered record to out */
+  void format(
+    fmt::memory_buffer &out, const LogEvent &event, const Logger &logger);
+
+  /* per-thread scratch buffer for callers of the overload above */
+  static fmt::memory_buffer &threadBuffer();
 
   bool hasError() const { return has_error_; }
   std::string lastError() const { return error_; }
@@ -355,13 +444,35 @@ public:
   YAML::Node toYaml() const;
 
 private:
+  enum class Op : uint8_t
+  {
+    TEXT,
+    MESSAGE,
+    LOG_LEVEL,
+    LOG_NAME,
+    DATETIME,
+    FILENAME,
+    LINE,
+    FUNCTION_NAME,
+    THREAD_NAME,
+    THREAD_ID,
+  };
+  struct Instr
+  {
+    Op op;
+    std::string arg;  // TEXT: the text, DATETIME: the strftime format
+  };
+
   PatArgsWrapper parsePatToken(const std::string &patToken);
+  void appendDateTime(
+    fmt::memory_buffer &out, size_t index, int64_t timestamp) const;
 
   void init();
 
 private:
   std::string pattern_;
-  std::vector<LogFormatterItem::ptr> items_;
+  std::vector<Instr> instrs_;
+  uint32_t id_;  // tells the per-thread date caches of formatters apart
   std::string error_;
   bool has_error_{false};
 };
@@ -374,7 +485,12 @@ public:
   LogAppender() = default;
   virtual ~LogAppender() = default;
 
-  virtual void log(LogEvent::ptr pEvent, std::shared_ptr<Logger> pLogger) = 0;
+  virtual void log(const LogEvent::ptr &pEvent,
+    const std::shared_ptr<Logger> &pLogger) = 0;
+  /* pushes out whatever the appender still buffers */
+  virtual void flush() {}
+  /* flush() on every buffering appender, also runs at exit */
+  static void flushAll();
 
   void setFormatter(LogFormatter::ptr pFormatter);
   LogFormatter::ptr getFormatter() const;
@@ -384,6 +500,11 @@ public:
 
   virtual YAML::Node toYaml() const = 0;
 
+protected:
+  /* buffering appenders join flushAll() for their lifetime */
+  void registerFlush();
+  void unregisterFlush();
+
 protected:
   LogLevel level_{LogLevel::LTRACE};
   LogFormatter::ptr formatter_;
@@ -391,56 +512,144 @@ protected:
   mutable Mutex::type mutex_;
 };
 
-class FileLogAppender : public LogAppender
+struct LogFileOptions
+{
+  uint64_t max_bytes{64 << 20};       // switch files beyond this size
+  size_t buffer_bytes{256 << 10};     // userspace buffer in front of write
+  int64_t flush_interval_ms{1000};    // oldest buffered record waits at most
+  bool compress{false};               // gzip files once they are rotated out
+  uint64_t max_total_bytes{0};        // rotated files kept at most, 0: all
+  int64_t max_age_days{0};            // rotated files older are removed, 0: all
+};
+
+/**
+ * Append-only log file behind a userspace buffer. One descriptor stays open;
+ * the buffer is written out when it fills up, when its oldest record is
+ * older than the flush interval or on request.
+ *
+ * Files are named basename + "_" + YYYY-MM-DD + "_" + NN + ".log", a new one
+ * is started when the day of the record changes or the current one reached
+ * max_bytes. Both checks are integer compares, the calendar is consulted
+ * only when switching. Not thread-safe, the owner serializes access.
+ *
+ * With compress or a retention limit set, every switch hands the files left
+ * behind to a low-priority background thread, which gzips them to .log.gz
+ * and deletes the oldest ones beyond max_total_bytes or max_age_days.
+ */
+class LogFileSink : public noncopyable
 {
 public:
-  using ptr = std::shared_ptr<FileLogAppender>;
+  LogFileSink(const std::string &basename, LogFileOptions options = {});
+  ~LogFileSink();
 
-  FileLogAppender(const std::string &filename);
-  virtual ~FileLogAppender() override = default;
+  /* timestamp (ms) of the record, decides the day of the file */
+  void append(const char *data, size_t size, int64_t timestamp);
+  void flushIfDue(int64_t now);
+  void flush();
 
-  virtual void log(
-    LogEvent::ptr pLogEvent, std::shared_ptr<Logger> pLogger) override;
-  bool reopen();
-  YAML::Node toYaml() const override;
+  bool isBuffered() const { return !buffer_.empty(); }
+  const LogFileOptions &getOptions() const { return options_; }
+  const std::string &getBasename() const { return basename_; }
+  const std::string &getFilename() const { return filename_; }
 
 private:
-  std::string getWholeFilename();
+  void rotate(int64_t timestamp);
+  void write(const char *data, size_t size);
+  std::string getWholeFilename(int index) const;
 
 private:
-  /* real filename: filename_ + "_" + current_day + "_" + cnt{02d} + ".log" */
+  std::string basename_;
+  LogFileOptions options_;
+
   std::string filename_;
-  std::ofstream file_stream_;
-  uint64_t last_access_time_{0};
-  uint64_t lines_{0};
-  uint8_t cnt_{0};  // cnt_ incr when lines_ encounters max lines
-  int today_;
+  std::FILE *file_{nullptr};
+  uint64_t file_bytes_{0};  // written and buffered
+  std::string buffer_;
+  int64_t first_buffered_{0};
+
+  char day_[16]{};
+  int64_t day_end_{0};  // first timestamp (ms) of the next day
+  int index_{0};
+  bool has_error_{false};
 };
+
+class FileLogAppender : public LogAppender
+{
+public:
+  using ptr = std::shared_ptr<FileLogAppender>;
+
+  FileLogAppender(const std::string &filename, LogFileOptions options = {});
+  virtual ~FileLogAppender() override;
+
+  virtual void log(const LogEvent::ptr &pLogEvent,
+    const std::shared_ptr<Logger> &pLogger) override;
+  void flush() override;
+  YAML::Node toYaml() const override;
+
+private:
+  LogFileSink sink_;
+};
+/* what AsyncFileLogAppender::log does when its ring is full */
+enum class LogOverflowPolicy : uint8_t
+{
+  BLOCK,             // wait for the writer thread
+  DROP,              // drop the record
+  DROP_BELOW_LEVEL,  // drop it unless it reaches the keep level, else block
+};
+
+/**
+ * Producers format the event and copy it into a preallocated ring slot, a
+ * single writer thread drains the ring and writes whole batches. Records
+ * still queued are written before a FATAL event returns and at exit.
+ */
 class AsyncFileLogAppender : public LogAppender
 {
 public:
   using ptr = std::shared_ptr<AsyncFileLogAppender>;
+  static constexpr size_t kDefaultCapacity = 8192;
+
+  AsyncFileLogAppender(const std::string &filename,
+    size_t capacity = kDefaultCapacity, LogFileOptions options = {});
+  virtual ~AsyncFileLogAppender() override;
 
-  AsyncFileLogAppender(const std::string &filename);
-  virtual ~AsyncFileLogAppender() override = default;
+  virtual void log(const LogEvent::ptr &pLogEvent,
+    const std::shared_ptr<Logger> &pLogger) override;
 
-  virtual void log(
-    LogEvent::ptr pLogEvent, std::shared_ptr<Logger> pLogger) override;
+  /* returns once every record queued before the call is on disk */
+  void flush() override;
+
+  void setOverflowPolicy(
+    LogOverflowPolicy policy, LogLevel keepLevel = LogLevel::LWARN);
+  LogOverflowPolicy getOverflowPolicy() const { return policy_; }
+  uint64_t getDropped() const { return dropped_; }
 
   YAML::Node toYaml() const override;
 
 private:
-  bool reopen(struct tm *tm);
-  std::string getWholeFilename(struct tm *tm) const;
-  void reopenNewFileIfShould(int64_t timestamp);
+  struct Record
+  {
+    int64_t timestamp{0};
+    std::string text;
+  };
+
+  void onWrite();
 
 private:
-  /* real filename: filename_ + "_" + current_day + "_" + cnt{02d} + ".log" */
-  std::string filename_;
-  std::ofstream file_stream_;
-  uint64_t lines_{0};
-  uint8_t cnt_{0};  // cnt_ incr when lines_ encounters max lines
-  int today_{0};
+  // owned by the writer thread
+  LogFileSink sink_;
+  uint64_t reported_dropped_{0};
+
+  MPSCQueue<Record> ring_;
+  std::atomic<LogOverflowPolicy> policy_{LogOverflowPolicy::BLOCK};
+  std::atomic<LogLevel::Level> keep_level_{LogLevel::LWARN};
+  std::atomic<uint64_t> dropped_{0};
+  std::atomic<size_t> written_{0};  // records handed to the file
+  std::atomic<bool> flush_requested_{false};
+  std::atomic<bool> stop_{false};
+  Futex not_empty_;
+  Futex not_full_;
+  Futex flushed_;
+  std::thread writer_;
 };
 class StdoutLogAppender : public LogAppender
 {
@@ -450,8 +659,8 @@ public:
   StdoutLogAppender() = default;
   virtual ~StdoutLogAppender() override = default;
 
-  virtual void log(
-    LogEvent::ptr pLogEvent, std::shared_ptr<Logger> pLogger) override;
+  virtual void log(const LogEvent::ptr &pLogEvent,
+    const std::shared_ptr<Logger> &pLogger) override;
   YAML::Node toYaml() const override;
 };
 
@@ -459,37 +668,86 @@ class Logger : public std::enable_shared_from_this<Logger>
 {
 public:
   using ptr = std::shared_ptr<Logger>;
+  using AppenderList = std::vector<LogAppender::ptr>;
 
   Logger(const std::string &name = "root");
   Logger(const std::string &name, LogLevel level, const std::string &pattern = kDefaultFormatPattern, uint8_t flags = LogIniterFlag::CONSOLE, const std::string &filename = "undefined");
-  ~Logger() = default;
+  /* writes a pending repeat summary */
+  ~Logger();
 
+  /* takes no lock unless repeat collapsing is on */
   void log(LogEvent::ptr pLogEvent);
 
+  /**
+   * Writers copy the list and publish the copy; log() iterates whichever
+   * snapshot it loaded, so a slow appender never blocks the others.
+   */
   void addAppender(LogAppender::ptr pAppender);
   void removeAppender(LogAppender::ptr pAppender);
   void clearAppenders();
+  std::shared_ptr<const AppenderList> getAppenders() const;
 
   YAML::Node toYaml() const;
 
 
-  LogLevel getLevel() const { return level_; }
-  void setLevel(LogLevel level) { level_ = level; }
+  LogLevel getLevel() const {
+    return level_.load(std::memory_order_relaxed);
+  }
+  void setLevel(LogLevel level) {
+    level_.store(level.level(), std::memory_order_relaxed);
+  }
+  /* the check the log macros make before building an event */
+  bool isEnabled(LogLevel::Level level) const {
+    return level >= level_.load(std::memory_order_relaxed);
+  }
   const std::string &getName() const { return name_; }
+  /**
+   * Identical consecutive events (same site, same text) within windowMs of
+   * the first one are counted instead of written, then reported as one
+   * "last message repeated N times" line. 0 turns it off.
+   */
+  void setRepeatCollapse(uint32_t windowMs);
+  uint32_t getRepeatCollapse() const {
+    return collapse_ms_.load(std::memory_order_relaxed);
+  }
+  /**
+   * Writes the pending "repeated" line once its window is over, or right
+   * away if force. Runs on a background thread and at exit, so a count is
+   * not lost when the flood stops and nothing else is logged.
+   */
+  void flushRepeats(bool force = false);
 
   void setFormatter(LogFormatter::ptr pFormatter);
   void setFormatter(const std::string &pattern);
   LogFormatter::ptr getFormatter() const;
 
-  Logger::ptr getParent() { return parent_; }
-  void setParent(Logger::ptr pLogger) { parent_ = pLogger; }
+  Logger::ptr getParent() const;
+  void setParent(Logger::ptr pLogger);
 
 private:
+  friend class BinaryLog;
+  friend class FlightRecorder;
+
+  void dispatch(const LogEvent::ptr &pLogEvent, const Logger::ptr &self);
+  static bool isRepeatOf(const LogEvent &event, const LogEvent &last);
+  /* mutex_ held */
+  void writeRepeats(const Logger::ptr &self);
+  void write(const LogEvent::ptr &pLogEvent, const Logger::ptr &self);
+
   std::string name_;
-  LogLevel level_{LogLevel::Level::LDEBUG};
-  std::list<LogAppender::ptr> appenders_;
+  std::atomic<LogLevel::Level> level_{LogLevel::Level::LDEBUG};
+  // immutable snapshots, swapped with std::atomic_store under mutex_
+  std::shared_ptr<const AppenderList> appenders_;
   LogFormatter::ptr formatter_;
-  Logger::ptr parent_;
+  Logger::ptr parent_;  // std::atomic_load/store
+  // assigned by BinaryLog on first use
+  mutable std::atomic<uint32_t> binary_id_{0};
+
+  // repeat collapsing, guarded by mutex_
+  std::atomic<uint32_t> collapse_ms_{0};
+  LogEvent::ptr last_event_;
+  uint64_t repeats_{0};
+  int64_t repeats_deadline_{0};  // ms, like LogEvent timestamps
 
   mutable Mutex::type mutex_;
 };
@@ -501,15 +759,45 @@ public:
   using ptr = std::shared_ptr<LogEventWrapper>;
 
   LogEventWrapper(LogEvent::ptr pEvent, Logger::ptr pLogger);
-  ~LogEventWrapper() { logger_->log(event_); }
+  ~LogEventWrapper();
 
-  LogEvent::ptr getEvent() const { return event_; }
-  Logger::ptr getLogger() const { return logger_; }
+  const LogEvent::ptr &getEvent() const { return event_; }
+  const Logger::ptr &getLogger() const { return logger_; }
   std::stringstream &getSS() { return event_->getSS(); }
+  /* noted after the message, for sampled statements */
+  LogEventWrapper &setSuppressed(uint64_t count) {
+    suppressed_ = count;
+    return *this;
+  }
 
 private:
   LogEvent::ptr event_;
   Logger::ptr logger_;
+  uint64_t suppressed_{0};
+};
+
+/* per call site state of the sampled log macros */
+class LogSite
+{
+public:
+  bool everyN(uint64_t n) {
+    return n <= 1 || count_.fetch_add(1, std::memory_order_relaxed) % n == 0;
+  }
+  /* on true, lastSkipped() is the number of calls dropped before this one */
+  bool everyMs(int64_t periodMs);
+  static uint64_t lastSkipped() { return s_last_skipped; }
+
+private:
+  std::atomic<uint64_t> count_{0};
+  std::atomic<int64_t> next_ms_{0};
+  std::atomic<uint64_t> skipped_{0};
+  static inline thread_local uint64_t s_last_skipped = 0;
+};
+
+/* turns `stream << a << b` into void for the ?: in __LOG_STREAM */
+struct LogStreamVoidify
+{
+  void operator&(std::ostream &) {}
 };
 
 class LogManager
@@ -523,7 +811,9 @@ public:
   }
   ~LogManager() = default;
 
+  /* creates the logger if it is missing */
   Logger::ptr getLogger(const std::string &name);
+  /* nullptr if it is missing, never blocks */
   Logger::ptr getLogger2(const std::string &name);
   bool putLogger(Logger::ptr pLogger);
   void insert(Logger::ptr pLogger);
@@ -533,12 +823,19 @@ public:
   Logger::ptr getRoot() const { return root_; }
   std::string toYamlString() const;
   void toYamlFile(std::string_view filename) const;
+  /* the flight recorder's rings, see FlightRecorder::dump() */
+  std::string dumpFlightRecorder(const std::string &filename = "");
 
 private:
+  using LoggerMap = std::map<std::string, Logger::ptr>;
+
   LogManager();
+  /* mutex_ held, publishes a copy of the map with name -> pLogger */
+  void publish(const std::string &name, Logger::ptr pLogger);
 
+  // lookups load a snapshot and take no lock, writers serialize on mutex_
   Mutex::type mutex_;
-  std::map<std::string, Logger::ptr> loggers_;
+  std::shared_ptr<const LoggerMap> loggers_;
   Logger::ptr root_;
 };
 
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "multimedia/common/SPSCQueue.hpp"
+#include "multimedia/common/noncopyable.hpp"
+
+/**
+ * Bounded multi-producer/single-consumer ring (per-slot sequence numbers,
+ * after D. Vyukov's bounded queue).
+ *
+ * Slots are preallocated and filled/consumed in place through callbacks, so
+ * a T holding reusable storage (a std::string, a buffer) keeps its capacity
+ * from one round to the next. Producers contend on the tail counter only;
+ * the consumer alone stores the head index and releases slots through their
+ * sequence numbers. Producers read both: the sequence to find a free slot,
+ * the head through approxSize(), so the head sits on its own cache line.
+ */
+template <typename T>
+class MPSCQueue : public noncopyable
+{
+  struct Slot
+  {
+    std::atomic<size_t> seq;
+    T value;
+  };
+
+public:
+  explicit MPSCQueue(size_t capacity = 1024) {
+    size_t n = 2;
+    while (n < capacity) n <<= 1;
+    capacity_ = n;
+    mask_ = n - 1;
+    slots_.reset(new Slot[n]);
+    for (size_t i = 0; i < n; ++i) {
+      slots_[i].seq.store(i, std::memory_order_relaxed);
+    }
+  }
+  ~MPSCQueue() = default;
+
+  /* any thread, fill(T &) runs on the claimed slot; false when full */
+  template <typename Fn>
+  bool tryEmplace(Fn &&fill) {
+    size_t pos = tail_.load(std::memory_order_relaxed);
+    Slot *slot;
+    while (true) {
+      slot = &slots_[pos & mask_];
+      const size_t seq = slot->seq.load(std::memory_order_acquire);
+      const intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+      if (diff == 0) {
+        if (tail_.compare_exchange_weak(
+              pos, pos + 1, std::memory_order_relaxed))
+          break;
+      }
+      else if (diff < 0) {
+        return false;
+      }
+      else {
+        pos = tail_.load(std::memory_order_relaxed);
+      }
+    }
+    fill(slot->value);
+    slot->seq.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  /* consumer only, fn(T &) runs on the oldest slot; false when empty */
+  template <typename Fn>
+  bool tryConsume(Fn &&fn) {
+    const size_t head = head_.load(std::memory_order_relaxed);
+    Slot &slot = slots_[head & mask_];
+    if (slot.seq.load(std::memory_order_acquire) != head + 1) return false;
+    fn(slot.value);
+    slot.seq.store(head + capacity_, std::memory_order_release);
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  /* slots claimed so far, including ones still being filled */
+  size_t claimed() const { return tail_.load(std::memory_order_acquire); }
+  size_t consumed() const { return head_.load(std::memory_order_acquire); }
+  /* any thread, a snapshot that may be stale by the time it returns */
+  size_t approxSize() const {
+    const size_t head = head_.load(std::memory_order_acquire);
+    const size_t tail = tail_.load(std::memory_order_acquire);
+    return tail > head ? tail - head : 0;
+  }
+  /* consumer only */
+  bool empty() const {
+    const size_t head = head_.load(std::memory_order_relaxed);
+    return slots_[head & mask_].seq.load(std::memory_order_acquire)
+           != head + 1;
+  }
+  size_t capacity() const { return capacity_; }
+
+private:
+  alignas(kCacheLineSize) std::atomic<size_t> tail_{0};
+  alignas(kCacheLineSize) std::atomic<size_t> head_{0};
+  size_t capacity_{0};
+  size_t mask_{0};
+  std::unique_ptr<Slot[]> slots_;
+};
@@ -48,12 +48,12 @@ static bool touch(
   const std::string &filename, int oflag = 0644) {
   int fd{-1};
 #if defined(__LINUX__)
-  if ((fd = ::open(filename.c_str(), O_CREAT | O_WRONLY, oflag)) == 0) {
+  if ((fd = ::open(filename.c_str(), O_CREAT | O_WRONLY, oflag)) >= 0) {
     ::close(fd);
     return true;
   }
 #elif defined(__WIN__)
-  if ((fd = ::_open(filename.c_str(), O_CREAT | O_WRONLY, oflag)) == 0) {
+  if ((fd = ::_open(filename.c_str(), O_CREAT | O_WRONLY, oflag)) >= 0) {
     ::_close(fd);
     return true;
   }
@@ -173,7 +173,7 @@ static bool touch(const std::string &filename, int oflag = 0644) {
     ::free(path);
     return false;
   }
-  else if (detail::touch(filename, oflag)) {
+  else if (!detail::touch(filename, oflag)) {
     ::free(path);
     return false;
   }
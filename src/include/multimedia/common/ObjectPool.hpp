@@ -0,0 +1,212 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <vector>
+
+#include "multimedia/common/Mutex.hpp"
+#include "multimedia/common/noncopyable.hpp"
+
+/**
+ * Recycling pool for objects that are expensive to allocate.
+ *
+ * Each thread keeps a small cache in front of a shared free list and trades
+ * with it kBatch objects at a time, so the lock is taken once per batch and
+ * objects may be released on a different thread than the one that acquired
+ * them. Policy supplies:
+ *
+ *   static T *create();        // fresh object
+ *   static void recycle(T *);  // back to a reusable state
+ *   static void destroy(T *);  // free it for good
+ *
+ * Instances are leaked on purpose, objects may still come back from other
+ * threads during static destruction.
+ */
+template <typename T, typename Policy>
+class ObjectPool : public noncopyable
+{
+public:
+  static constexpr size_t kBatch = 32;
+  static constexpr size_t kMaxShared = 4096;
+
+  struct Stats
+  {
+    uint64_t created;   // real allocations
+    uint64_t destroyed; // real frees, shared list overflow
+    uint64_t acquired;
+    uint64_t released;
+    size_t shared;      // idle objects on the shared list
+  };
+
+  static ObjectPool *instance() {
+    static ObjectPool *pool = new ObjectPool();
+    return pool;
+  }
+
+  T *acquire() {
+    T *p = nullptr;
+    auto *pCache = local();
+    if (pCache) {
+      if (pCache->items.empty()) take(pCache->items, kBatch);
+      if (!pCache->items.empty()) {
+        p = pCache->items.back();
+        pCache->items.pop_back();
+      }
+    }
+    else {
+      take1(p);
+    }
+    if (!p) {
+      p = Policy::create();
+      if (!p) return nullptr;
+      created_.fetch_add(1, std::memory_order_relaxed);
+    }
+    acquired_.fetch_add(1, std::memory_order_relaxed);
+    return p;
+  }
+  void release(T *p) {
+    if (!p) return;
+    Policy::recycle(p);
+    released_.fetch_add(1, std::memory_order_relaxed);
+    auto *pCache = local();
+    if (!pCache) {
+      give(&p, 1);
+      return;
+    }
+    pCache->items.push_back(p);
+    if (pCache->items.size() >= 2 * kBatch) {
+      give(pCache->items.data() + kBatch, pCache->items.size() - kBatch);
+      pCache->items.resize(kBatch);
+    }
+  }
+
+  Stats stats() const {
+    Stats s;
+    s.created = created_.load(std::memory_order_relaxed);
+    s.destroyed = destroyed_.load(std::memory_order_relaxed);
+    s.acquired = acquired_.load(std::memory_order_relaxed);
+    s.released = released_.load(std::memory_order_relaxed);
+    Mutex::lock lock(mutex_);
+    s.shared = free_.size();
+    return s;
+  }
+
+private:
+  ObjectPool() { free_.reserve(kMaxShared); }
+
+  struct LocalCache
+  {
+    std::vector<T *> items;
+    LocalCache() { items.reserve(2 * kBatch); }
+    ~LocalCache() {
+      exited() = true;
+      instance()->give(items.data(), items.size());
+    }
+  };
+  /* trivially destructible, so it is still usable after the cache is gone */
+  static bool &exited() {
+    thread_local bool flag = false;
+    return flag;
+  }
+  /* nullptr once the calling thread has started tearing down */
+  static LocalCache *local() {
+    if (exited()) return nullptr;
+    thread_local LocalCache cache;
+    return &cache;
+  }
+
+  void take(std::vector<T *> &out, size_t n) {
+    Mutex::lock lock(mutex_);
+    while (n-- > 0 && !free_.empty()) {
+      out.push_back(free_.back());
+      free_.pop_back();
+    }
+  }
+  void take1(T *&p) {
+    Mutex::lock lock(mutex_);
+    if (free_.empty()) return;
+    p = free_.back();
+    free_.pop_back();
+  }
+  void give(T **items, size_t n) {
+    size_t i = 0;
+    {
+      Mutex::lock lock(mutex_);
+      for (; i < n && free_.size() < kMaxShared; ++i)
+        free_.push_back(items[i]);
+    }
+    for (; i < n; ++i) {
+      Policy::destroy(items[i]);
+      destroyed_.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+private:
+  mutable Mutex::type mutex_;
+  std::vector<T *> free_;
+
+  std::atomic<uint64_t> created_{0};
+  std::atomic<uint64_t> destroyed_{0};
+  std::atomic<uint64_t> acquired_{0};
+  std::atomic<uint64_t> released_{0};
+};
+
+/* raw storage for one object of the given size/alignment */
+template <size_t Size, size_t Align>
+struct PoolBlock
+{
+  alignas(Align) unsigned char bytes[Size];
+};
+template <size_t Size, size_t Align>
+struct PoolBlockPolicy
+{
+  using Block = PoolBlock<Size, Align>;
+  static Block *create() { return new (std::nothrow) Block; }
+  static void recycle(Block *) {}
+  static void destroy(Block *p) { delete p; }
+};
+template <size_t Size, size_t Align>
+using BlockPool =
+  ObjectPool<PoolBlock<Size, Align>, PoolBlockPolicy<Size, Align>>;
+
+/**
+ * Allocator backed by BlockPool, meant for std::allocate_shared and the
+ * shared_ptr(p, deleter, alloc) constructor so that the control block is
+ * recycled along with the object.
+ */
+template <typename U>
+class PoolAllocator
+{
+public:
+  using value_type = U;
+
+  PoolAllocator() = default;
+  template <typename V>
+  PoolAllocator(const PoolAllocator<V> &) {}
+
+  U *allocate(size_t n) {
+    if (n != 1) return std::allocator<U>().allocate(n);
+    auto *p = Pool::instance()->acquire();
+    if (!p) throw std::bad_alloc();
+    return reinterpret_cast<U *>(p);
+  }
+  void deallocate(U *p, size_t n) {
+    if (n != 1) {
+      std::allocator<U>().deallocate(p, n);
+      return;
+    }
+    Pool::instance()->release(reinterpret_cast<Block *>(p));
+  }
+
+  template <typename V>
+  bool operator==(const PoolAllocator<V> &) const { return true; }
+  template <typename V>
+  bool operator!=(const PoolAllocator<V> &) const { return false; }
+
+private:
+  using Block = PoolBlock<sizeof(U), alignof(U)>;
+  using Pool = BlockPool<sizeof(U), alignof(U)>;
+};
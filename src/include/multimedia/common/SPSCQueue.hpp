@@ -0,0 +1,172 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <utility>
+
+#include "multimedia/common/noncopyable.hpp"
+
+inline constexpr size_t kCacheLineSize = 64;
+
+/**
+ * Bounded single-producer/single-consumer ring.
+ *
+ * Capacity is rounded up to a power of two. The producer owns tail_, the
+ * consumer owns head_; each side keeps a private copy of the other index and
+ * only re-reads the shared one when its copy says the ring is full/empty.
+ * try* never block, see AVQueue for the blocking wrapper.
+ */
+template <typename T>
+class SPSCQueue : public noncopyable
+{
+public:
+  explicit SPSCQueue(size_t capacity = 1024) { reset(capacity); }
+  ~SPSCQueue() = default;
+
+  /* not thread-safe, only while neither side is running */
+  void reset(size_t capacity) {
+    size_t n = 2;
+    while (n < capacity) n <<= 1;
+    capacity_ = n;
+    mask_ = n - 1;
+    slots_.reset(new T[n]);
+    head_.store(0, std::memory_order_relaxed);
+    tail_.store(0, std::memory_order_relaxed);
+    discard_.store(0, std::memory_order_relaxed);
+    tail_cache_ = head_cache_ = 0;
+  }
+
+  /* producer side */
+  template <typename U>
+  bool tryPush(U &&x) {
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - head_cache_ >= capacity_) {
+      head_cache_ = head_.load(std::memory_order_acquire);
+      if (tail - head_cache_ >= capacity_) return false;
+    }
+    slots_[tail & mask_] = std::forward<U>(x);
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+  /* moves up to n items out of `items`, returns how many were taken */
+  size_t tryPushN(T *items, size_t n) {
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+    size_t space = capacity_ - (tail - head_cache_);
+    if (space < n) {
+      head_cache_ = head_.load(std::memory_order_acquire);
+      space = capacity_ - (tail - head_cache_);
+    }
+    if (n > space) n = space;
+    for (size_t i = 0; i < n; ++i) {
+      slots_[(tail + i) & mask_] = std::move(items[i]);
+    }
+    if (n > 0) tail_.store(tail + n, std::memory_order_release);
+    return n;
+  }
+
+  /* consumer side */
+  bool tryPop(T &x) {
+    const size_t head = skipDiscarded();
+    if (head == tail_cache_) {
+      tail_cache_ = tail_.load(std::memory_order_acquire);
+      if (head == tail_cache_) return false;
+    }
+    x = std::move(slots_[head & mask_]);
+    slots_[head & mask_] = T{};
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+  }
+  size_t tryPopN(T *out, size_t n) {
+    const size_t head = skipDiscarded();
+    size_t avail = tail_cache_ - head;
+    if (avail < n) {
+      tail_cache_ = tail_.load(std::memory_order_acquire);
+      avail = tail_cache_ - head;
+    }
+    if (n > avail) n = avail;
+    for (size_t i = 0; i < n; ++i) {
+      out[i] = std::move(slots_[(head + i) & mask_]);
+      slots_[(head + i) & mask_] = T{};
+    }
+    if (n > 0) head_.store(head + n, std::memory_order_release);
+    return n;
+  }
+  /* oldest/newest published item, nullptr if empty */
+  T *front() {
+    const size_t head = skipDiscarded();
+    if (head == tail_.load(std::memory_order_acquire)) return nullptr;
+    return &slots_[head & mask_];
+  }
+  T *back() {
+    skipDiscarded();
+    const size_t head = head_.load(std::memory_order_relaxed);
+    const size_t tail = tail_.load(std::memory_order_acquire);
+    if (head == tail) return nullptr;
+    return &slots_[(tail - 1) & mask_];
+  }
+  /* consumer side, releases everything right away */
+  void clear() {
+    T x;
+    while (tryPop(x)) {}
+  }
+
+  /**
+   * Marks every item published so far as stale. Safe from either side: the
+   * consumer drops them on its next access, passing each one to the discard
+   * handler first.
+   */
+  void discard() {
+    const size_t tail = tail_.load(std::memory_order_acquire);
+    size_t mark = discard_.load(std::memory_order_relaxed);
+    while (mark < tail
+           && !discard_.compare_exchange_weak(mark, tail,
+             std::memory_order_release, std::memory_order_relaxed)) {}
+  }
+
+  /* set before either side starts */
+  void setDiscardHandler(std::function<void(T &)> fn) {
+    on_discard_ = std::move(fn);
+  }
+
+  /* approximate when called concurrently */
+  size_t size() const {
+    const size_t tail = tail_.load(std::memory_order_acquire);
+    const size_t head = head_.load(std::memory_order_acquire);
+    return tail >= head ? tail - head : 0;
+  }
+  bool empty() const { return size() == 0; }
+  bool full() const { return size() >= capacity_; }
+  size_t capacity() const { return capacity_; }
+
+private:
+  size_t skipDiscarded() {
+    size_t head = head_.load(std::memory_order_relaxed);
+    const size_t mark = discard_.load(std::memory_order_acquire);
+    if (head >= mark) return head;
+
+    for (; head < mark; ++head) {
+      if (on_discard_) on_discard_(slots_[head & mask_]);
+      slots_[head & mask_] = T{};
+    }
+    // everything below the mark was published before discard() read tail_
+    if (tail_cache_ < head) tail_cache_ = head;
+    head_.store(head, std::memory_order_release);
+    return head;
+  }
+
+private:
+  // consumer
+  alignas(kCacheLineSize) std::atomic<size_t> head_{0};
+  size_t tail_cache_{0};
+  // producer
+  alignas(kCacheLineSize) std::atomic<size_t> tail_{0};
+  size_t head_cache_{0};
+  // shared, read-mostly
+  alignas(kCacheLineSize) std::atomic<size_t> discard_{0};
+  size_t capacity_{0};
+  size_t mask_{0};
+  std::unique_ptr<T[]> slots_;
+  std::function<void(T &)> on_discard_;
+};
@@ -1,10 +1,21 @@
 #pragma once
 
 #include <atomic>
+#include <cstdint>
 #include <future>
+#include <memory>
+#include <string>
+#include <string_view>
 #include <thread>
 #include <unordered_map>
 
+#if defined(_WIN32)
+# include <Windows.h>
+#else
+# include <pthread.h>
+# include <time.h>
+#endif
+
 #include "noncopyable.hpp"
 
 struct ThreadContext
@@ -45,7 +56,8 @@ public:
   }
   Thread(Thread &&th) noexcept
     : context_(std::move(th.context_))
-    , thread_(std::move(th.thread_)) {}
+    , thread_(std::move(th.thread_))
+    , cpu_time_us_(std::move(th.cpu_time_us_)) {}
   virtual ~Thread() { this->stop(); }
 
   template <typename Fn, typename... Args>
@@ -60,8 +72,14 @@ public:
     auto res = task->get_future();
 
     running_ = true;
-    thread_ =
-      std::thread([task, &args...] { (*task)(std::forward<Args>(args)...); });
+    cpu_time_us_ = std::make_shared<std::atomic<int64_t>>(-1);
+    thread_ = std::thread(
+      [task, name = context_.name, cpuTime = cpu_time_us_, &args...] {
+        setCurrentName(name);
+        (*task)(std::forward<Args>(args)...);
+        // the kernel forgets the thread's clock once it exits
+        cpuTime->store(currentCpuTime(), std::memory_order_relaxed);
+      });
     context_.reset(thread_.get_id());
 
     s_thread_mapping[thread_.get_id()] = context_;
@@ -77,6 +95,46 @@ public:
 
   ThreadContext context() const;
 
+  /**
+   * CPU time the last dispatched task used so far, in microseconds. Works
+   * while it runs and after it returned, until the next dispatch().
+   */
+  int64_t cpuTime() {
+    if (!cpu_time_us_) return 0;
+    int64_t us = cpu_time_us_->load(std::memory_order_relaxed);
+    if (us >= 0) return us;
+#if !defined(_WIN32)
+    clockid_t cid;
+    timespec ts;
+    if (thread_.joinable()
+        && pthread_getcpuclockid(thread_.native_handle(), &cid) == 0
+        && clock_gettime(cid, &ts) == 0) {
+      return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    }
+#endif
+    // it may have exited in between
+    us = cpu_time_us_->load(std::memory_order_relaxed);
+    return us >= 0 ? us : 0;
+  }
+  /* CPU time of the calling thread, in microseconds */
+  static int64_t currentCpuTime() {
+#if defined(_WIN32)
+    FILETIME creation, exit, kernel, user;
+    if (!GetThreadTimes(
+          GetCurrentThread(), &creation, &exit, &kernel, &user)) {
+      return 0;
+    }
+    auto ticks = [](const FILETIME &t) {
+      return ((int64_t) t.dwHighDateTime << 32) | t.dwLowDateTime;
+    };
+    return (ticks(kernel) + ticks(user)) / 10;  // 100ns ticks
+#else
+    timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0) return 0;
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+  }
+
   static ThreadContext context(std::thread::id tid) {
     auto it = s_thread_mapping.find(tid);
     if (it != s_thread_mapping.end()) return it->second;
@@ -84,13 +142,27 @@ public:
     return {};
   }
   static std::string name(std::thread::id tid) { return context(tid).name; }
+  /**
+   * Name of the calling thread, empty unless it was started by dispatch() or
+   * named itself. Unlike name() it needs no lookup in the shared mapping.
+   */
+  static const std::string &currentName() { return currentNameRef(); }
+  static void setCurrentName(std::string_view name) { currentNameRef() = name; }
   static bool include(std::thread::id tid) {
     return s_thread_mapping.find(tid) != s_thread_mapping.end();
   }
 
+private:
+  static std::string &currentNameRef() {
+    thread_local std::string name;
+    return name;
+  }
+
 private:
   std::thread thread_;
   std::atomic_bool running_{false};
+  // -1 while the task runs, shared with it to outlive a move of this
+  std::shared_ptr<std::atomic<int64_t>> cpu_time_us_;
 
   ThreadContext context_;
 
@@ -1,6 +1,8 @@
 #pragma once
 
+#include <atomic>
 #include <chrono>
+#include <memory>
 #include <thread>
 #include <string>
 #include <sstream>
@@ -59,4 +61,51 @@ public:
 
 private:
   static inline TimeUtil::BaseTimePoint last_tp_;
+};
+
+/**
+ * Time source a player paces itself by, in microseconds from an arbitrary
+ * epoch. Unlike Clock it is an object, so every player can have its own.
+ */
+class PlaybackClock
+{
+public:
+  using ptr = std::shared_ptr<PlaybackClock>;
+
+  virtual ~PlaybackClock() = default;
+
+  virtual int64_t now() const = 0;
+  virtual void sleep(int64_t us) = 0;
+  /* sleep() returns at once, nothing should wait on wall time either */
+  virtual bool isFreerun() const { return false; }
+};
+
+class WallClock : public PlaybackClock
+{
+public:
+  int64_t now() const override {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+      TimeUtil::now().time_since_epoch())
+      .count();
+  }
+  void sleep(int64_t us) override {
+    if (us > 0) std::this_thread::sleep_for(std::chrono::microseconds(us));
+  }
+};
+
+/**
+ * Virtual time that only moves by what is slept: deadlines derived from
+ * stream timestamps still line up, but nobody waits for them.
+ */
+class FreerunClock : public PlaybackClock
+{
+public:
+  int64_t now() const override { return now_.load(std::memory_order_relaxed); }
+  void sleep(int64_t us) override {
+    if (us > 0) now_.fetch_add(us, std::memory_order_relaxed);
+  }
+  bool isFreerun() const override { return true; }
+
+private:
+  std::atomic<int64_t> now_{0};
 };
\ No newline at end of file
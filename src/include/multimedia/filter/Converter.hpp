@@ -3,6 +3,12 @@
 #include <memory>
 #include "multimedia/filter/Filter.hpp"
 
+/**
+ * Scales/converts video frames with swscale. Output planes come from an
+ * AVBufferPool sized for the current output geometry, so the frames handed
+ * back by run() are refcounted and can be shared or queued freely; the
+ * buffer returns to the pool once the last reference is dropped.
+ */
 class Converter : public Filter
 {
 public:
@@ -12,6 +18,8 @@ public:
     int height;
     AVPixelFormat format;
   };
+  /* row and plane alignment of the output, enough for AVX-512 */
+  static constexpr int kAlign = 64;
 
   Converter();
   ~Converter();
@@ -20,11 +28,21 @@ public:
 
   bool init(Info in, Info out);
   int run(AVFramePtr pInFrame, AVFramePtr pOutFrame);
+  /* writes straight into caller-owned planes, e.g. a locked texture */
+  int run(AVFramePtr pInFrame, uint8_t *const dst[4], const int dstStride[4]);
 
 private:
-  bool isDirty(Info &out) const;
+  bool isDirty(const Info &in, const Info &out) const;
+  bool initPool(const Info &out);
+  int getBuffer(AVFrame *pFrame);
 
 private:
-  Info last_;
+  Info last_in_{0, 0, AV_PIX_FMT_NONE};
+  Info last_out_{0, 0, AV_PIX_FMT_NONE};
   SwsContext *sws_context_{nullptr};
+
+  AVBufferPool *pool_{nullptr};
+  int pool_linesize_[4]{0};
+  size_t pool_plane_size_[4]{0};
+  size_t pool_size_{0};
 };
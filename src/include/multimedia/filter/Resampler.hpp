@@ -3,14 +3,21 @@
 #include <memory>
 #include "multimedia/filter/Filter.hpp"
 
+/**
+ * Converts audio frames with swresample, or passes them through untouched
+ * when input and output already match. Output samples come from a
+ * grow-only AVBufferPool, so once the largest frame has been seen run()
+ * does not allocate and the frames it returns are refcounted.
+ */
 class Resampler : public Filter {
 public:
   using ptr = std::shared_ptr<Resampler>;
   struct Info{
     int sample_rate;
-//    AVChannelLayout ch_layout;
     int channels;
     AVSampleFormat format;
+    // native-order channel mask, 0 for the default layout of `channels`
+    uint64_t channel_mask{0};
   };
   Resampler();
   ~Resampler();
@@ -18,11 +25,25 @@ public:
   static Resampler::ptr create();
 
   bool init(Info in, Info out);
+  /* returns the output size in bytes, pOutFrame->nb_samples holds the count */
   int run(AVFramePtr pInFrame, AVFramePtr pOutFrame);
+  /* drops the samples buffered inside swr, e.g. after a seek */
+  void reset();
+
+  bool isPassthrough() const { return passthrough_; }
 
 private:
-  bool isDirty(Info &out) const;
+  bool isDirty(const Info &in, const Info &out) const;
+  bool getBuffer(AVFrame *pFrame, int nbSamples);
+  static bool fillLayout(AVChannelLayout &layout, const Info &info);
+
 private:
-  Info last_;
+  Info last_in_{0, 0, AV_SAMPLE_FMT_NONE};
+  Info last_out_{0, 0, AV_SAMPLE_FMT_NONE};
+  AVChannelLayout out_layout_{};
   SwrContext *swr_context_{nullptr};
+  bool passthrough_{false};
+
+  AVBufferPool *pool_{nullptr};
+  size_t pool_size_{0};
 };
@@ -1,14 +1,19 @@
 ﻿#pragma once
 
+#include <atomic>
 #include <cstdint>
+#include <cstdio>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "multimedia/common/ConditionVariable.hpp"
 #include "multimedia/common/AVClock.hpp"
 #include "multimedia/common/AVQueue.hpp"
 #include "multimedia/common/AVThread.hpp"
 #include "multimedia/common/AudioBuffer.hpp"
+#include "multimedia/common/Time.hpp"
+#include "multimedia/player/FrameTap.hpp"
 #include "multimedia/player/Player.hpp"
 #include "multimedia/MediaList.hpp"
 #include "multimedia/filter/Resampler.hpp"
@@ -20,6 +25,7 @@
 enum class AudioDevice
 {
   SDL,
+  NULL_SINK,  // no device, paced in real time, see PlayerConfig::audio
 };
 enum class VideoDevice
 {
@@ -27,6 +33,8 @@ enum class VideoDevice
   D3D9EX,
   OPENGL,
   X11,
+  NULL_SINK,  // decoded frames are dropped as they come due
+  OFFSCREEN,  // converted like for a window, but never presented
 };
 
 class FFmpegPlayer : public Player
@@ -40,7 +48,9 @@ public:
   bool pause() override;
   void seek(double pos) override;
   double getTotalTime() const override { return (double)format_context_->duration / AV_TIME_BASE; }
-  double getCurrentTime() const override { return audio_clock_.get(); }
+  double getCurrentTime() const override {
+    return isEnableAudio() ? audio_clock_.get() : video_clock_.get();
+  }
   bool isAborted() const { return is_aborted_; }
 
   void play(const MediaList &list); 
@@ -53,6 +63,61 @@ public:
   MediaSource getCurrentMediaSource() const {return list_.current(); }
   MediaList getMediaList() const { return list_; }
 
+  /**
+   * The video tap gets every frame as it is presented, the audio tap every
+   * decoded frame. Set them while nothing plays, nullptr removes a tap.
+   */
+  void setVideoTap(FrameTap::ptr pTap) { video_tap_ = std::move(pTap); }
+  void setAudioTap(FrameTap::ptr pTap) { audio_tap_ = std::move(pTap); }
+
+  /**
+   * Paces video and the headless audio device, a WallClock by default.
+   * PlayerConfig::common::freerun installs a FreerunClock on init().
+   */
+  void setClock(PlaybackClock::ptr pClock) { clock_ = std::move(pClock); }
+  /* media seconds played per wall second, live while playing */
+  double getAchievedSpeed() const;
+
+  struct Stats
+  {
+    uint64_t video_frames_decoded{0};
+    uint64_t video_frames_presented{0};
+    // decoded but never presented: stale after a seek, conversion failed
+    // or skipped to catch up with a live stream
+    uint64_t video_frames_dropped{0};
+    uint64_t audio_frames_decoded{0};
+    uint64_t audio_underruns{0};
+    // CPU time per stage in microseconds; SDL's audio thread is not ours
+    int64_t demux_cpu_us{0};
+    int64_t video_decode_cpu_us{0};
+    int64_t audio_decode_cpu_us{0};
+    int64_t audio_output_cpu_us{0};
+    int64_t present_cpu_us{0};
+  };
+  /* of the current media, reset by play() */
+  Stats getStats();
+
+  /**
+   * Startup and seek latency in microseconds of wall time, -1 until it
+   * happened. A video frame counts as presented once the display loop let
+   * it out, audio-only media once its PCM is in the device ring.
+   */
+  struct Timings
+  {
+    int64_t open_input_us{-1};    // avformat_open_input
+    int64_t stream_info_us{-1};   // avformat_find_stream_info
+    int64_t codec_init_us{-1};    // finding and opening both decoders
+    int64_t audio_device_us{-1};  // openAudio(), SDL enumerates devices
+    // since open() was called
+    int64_t first_decoded_us{-1};
+    int64_t first_presented_us{-1};
+    // since the last seek() call, to the keyframe the seek landed on
+    int64_t seek_decoded_us{-1};
+    int64_t seek_presented_us{-1};
+  };
+  /* of the current media, reset by open() and, the seek ones, by seek() */
+  Timings getTimings() const;
+
 protected:
   bool open(
     const std::string &url, const std::string &shortName = "") override;
@@ -65,6 +130,7 @@ protected:
 private:
   void destroy() override;
   bool check(PlayerConfig &config) const;
+  AVQueueLimits packetQueueLimits(AVStream *pStream) const;
 
   void onSetupRecord();
   void onSetdownRecord();
@@ -74,8 +140,12 @@ private:
   void onAudioDecode();
   void onVideoDecode();
 
-  int decodeAudioFrame(AVFramePtr &pOutFrame);
-  bool decodeVideoFrame(AVFramePtr &pOutFrame);
+  void finishPlayback();
+  bool writeAudioFrame(const AVFramePtr &pFrame, int serial);
+  /* pFrame as decoded, pOutFrame as the video device wants it */
+  bool decodeVideoFrame(AVFramePtr &pFrame, AVFramePtr &pOutFrame);
+  /* times the first frame after play() or the last seek, by its serial */
+  void markFirstFrame(int serial, bool isPresented);
 
   bool openVideo();
   bool openAudio();
@@ -84,11 +154,21 @@ private:
 
   bool openSDL(bool isAudio);
   bool closeSDL(bool isAudio);
+  bool openNullAudio();
+  bool closeNullAudio();
+  bool setupAudioParams(int freq, int channels, int bufSize);
+  void pauseAudioDevice(bool pause);
+  void onNullAudio();
   void setWindowSize(int w, int h);
+  bool isDirectRender(const AVFramePtr &pFrame) const;
+  SDL_Texture *getTexture(Uint32 format, int w, int h);
+  void destroyTexture();
+  bool renderSDL(const AVFramePtr &pFrame);
   void setWidthAndHeight();
 
   static void sdlAudioCallback(void *ptr, Uint8 *stream, int len);
-  void sdlAudioHandle(Uint8 *stream, int len);
+  /* one device period of PCM out of the ring, on the device's thread */
+  void onAudioPull(Uint8 *stream, int len);
 
   static SDL_PixelFormatEnum cvtFFPixFmtToSDLPixFmt(AVPixelFormat format);
   static int cvtFFSampleFmtToSDLSampleFmt(AVSampleFormat format);
@@ -108,19 +188,44 @@ private:
   // subtitle
 
   AVFrameQueue video_frame_queue_;
-  AVFrameQueue audio_frame_queue_;
   AVPacketQueue video_packet_queue_;
   AVPacketQueue audio_packet_queue_;
 
   int64_t seek_pos_;
+  // bumped by every seek, queued packets/frames of older serials are stale
+  std::atomic<int> serial_{0};
   double last_paused_time_{-1.0f};
   ConditionVariable continue_read_cond_;
+  ConditionVariable pause_cond_;
 
   int64_t last_vframe_pts_{0};
   int64_t last_video_duration_pts_{0};
   AVClock video_clock_;
   AVClock audio_clock_;
 
+  PlaybackClock::ptr clock_{std::make_shared<WallClock>()};
+  int64_t next_frame_due_{-1};  // clock_ time, video without audio only
+  TimeUtil::BaseTimePoint play_started_;
+  double play_started_pos_{0.0};
+  double achieved_speed_{0.0};
+
+  std::atomic<uint64_t> video_frames_decoded_{0};
+  std::atomic<uint64_t> video_frames_presented_{0};
+  std::atomic<uint64_t> video_frames_dropped_{0};
+  std::atomic<uint64_t> audio_frames_decoded_{0};
+  std::atomic<int64_t> present_cpu_us_{0};
+
+  // see Timings, the frame ones are written by whichever thread gets there
+  Timings timings_;
+  int64_t open_started_us_{0};
+  int play_serial_{0};
+  std::atomic<int> seek_serial_{-1};
+  std::atomic<int64_t> seek_requested_us_{0};
+  std::atomic<int64_t> first_decoded_us_{-1};
+  std::atomic<int64_t> first_presented_us_{-1};
+  std::atomic<int64_t> seek_decoded_us_{-1};
+  std::atomic<int64_t> seek_presented_us_{-1};
+
   Bit need_move_to_prev_;
   Bit need_move_to_next_;
   Bit need2pause_{false};
@@ -137,15 +242,28 @@ private:
 
   std::unique_ptr<Resampler> resampler_;
   std::unique_ptr<Converter> converter_;
+  std::unique_ptr<Converter> texture_converter_;
 
   AudioDevice audio_device_;
   VideoDevice video_device_;
   DeviceConfig device_config_;
 
-  // for SDL
-  SDL_Window *window_;
-  SDL_Renderer *renderer_;
-  SDL_AudioDeviceID device_id_;
+  // for SDL, only initialized for the subsystems that are used
+  Uint32 sdl_subsystems_{0};
+  SDL_Window *window_{nullptr};
+  SDL_Renderer *renderer_{nullptr};
+  // reused while the picture size/format stays the same
+  SDL_Texture *texture_{nullptr};
+  Uint32 texture_format_{SDL_PIXELFORMAT_UNKNOWN};
+  int texture_width_{0};
+  int texture_height_{0};
+  SDL_AudioDeviceID device_id_{0};
+  // for AudioDevice::NULL_SINK
+  AVThread null_audio_thread_{"NullAudioThread"};
+  std::atomic<bool> null_audio_paused_{true};
+  std::atomic<bool> null_audio_stop_{false};
+  std::FILE *wav_file_{nullptr};
+  uint32_t wav_bytes_{0};
   struct AudioParams
   {
     AVSampleFormat fmt;
@@ -157,6 +275,11 @@ private:
     int buf_size;
   } audio_hw_params;
 
+  // PCM ring between AudioDecodeThread and the device callback
   std::unique_ptr<AudioBuffer> audio_buffer_;
+  std::vector<uint8_t> audio_mix_buffer_;
+
+  FrameTap::ptr video_tap_;
+  FrameTap::ptr audio_tap_;
 };
 
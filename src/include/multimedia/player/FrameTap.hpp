@@ -0,0 +1,125 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+#include "multimedia/common/AVQueue.hpp"
+#include "multimedia/common/noncopyable.hpp"
+#include "multimedia/filter/Converter.hpp"
+#include "multimedia/filter/Resampler.hpp"
+
+/* what a tap delivers, the *_NONE/0 fields keep what the decoder produced */
+struct FrameTapOptions
+{
+  // video
+  AVPixelFormat pixel_format{AV_PIX_FMT_NONE};
+  int width{0};
+  int height{0};
+  // audio
+  AVSampleFormat sample_format{AV_SAMPLE_FMT_NONE};
+  int sample_rate{0};
+  int channels{0};
+
+  size_t queue_size{8};  // pull mode only
+  bool block{false};     // wait for a full queue instead of dropping
+};
+
+/**
+ * Hands the player's frames to an embedder, either through a callback run
+ * on the player's thread or through a queue the embedder pulls from.
+ *
+ * Frames are refcounted and shared with the pipeline, treat them as
+ * read-only. Without a format change nothing is copied; otherwise the tap
+ * converts into its own buffer pool. getSerial() of a frame changes with
+ * every seek.
+ */
+class FrameTap : public noncopyable
+{
+public:
+  using ptr = std::shared_ptr<FrameTap>;
+  /* returns false if the frame could not be taken, counted as dropped */
+  using Callback = std::function<bool(const AVFramePtr &pFrame)>;
+
+  struct Stats
+  {
+    uint64_t delivered{0};
+    uint64_t dropped{0};  // queue full (or callback refused) and not waited
+    uint64_t blocked{0};  // deliveries that had to wait for the consumer
+  };
+
+  explicit FrameTap(Callback callback, FrameTapOptions options = {});
+  explicit FrameTap(FrameTapOptions options = {});
+
+  /**
+   * Pull mode: sleeps until a frame arrives. Returns false on timeout, or
+   * once the player stopped and the queue is drained.
+   */
+  bool pop(AVFramePtr &pFrame, Futex::Timeout timeout = Futex::kInfinite);
+  Stats getStats() const;
+  const FrameTapOptions &getOptions() const { return options_; }
+
+  /* player side */
+  void open();
+  void close();
+  /**
+   * Converts and delivers pFrame, waiting in steps of `step` while
+   * blocking until isCancelled() holds. Returns whether it was taken.
+   */
+  template <typename Fn>
+  bool deliver(const AVFramePtr &pFrame, Futex::Timeout step, Fn &&isCancelled);
+
+private:
+  AVFramePtr convert(const AVFramePtr &pFrame);
+
+private:
+  FrameTapOptions options_;
+  Callback callback_;
+  AVFrameQueue queue_;
+
+  // player side
+  std::unique_ptr<Converter> converter_;
+  std::unique_ptr<Resampler> resampler_;
+  int serial_{-1};
+
+  std::atomic<uint64_t> delivered_{0};
+  std::atomic<uint64_t> dropped_{0};
+  std::atomic<uint64_t> blocked_{0};
+};
+
+template <typename Fn>
+bool FrameTap::deliver(
+  const AVFramePtr &pFrame, Futex::Timeout step, Fn &&isCancelled) {
+  auto pOutFrame = convert(pFrame);
+  if (!pOutFrame) {
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  if (callback_) {
+    const bool taken = callback_(pOutFrame);
+    (taken ? delivered_ : dropped_).fetch_add(1, std::memory_order_relaxed);
+    return taken;
+  }
+
+  if (queue_.isFull()) {
+    if (!options_.block) {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    blocked_.fetch_add(1, std::memory_order_relaxed);
+    while (!queue_.waitWritable(step)) {
+      if (isCancelled()) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+    }
+  }
+  if (!queue_.push(std::move(pOutFrame))) {
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  delivered_.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
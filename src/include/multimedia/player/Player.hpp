@@ -74,6 +74,8 @@ struct PlayerConfig
 
     float volume{1.0f};
     bool is_muted{false};
+    // AudioDevice::NULL_SINK writes what it plays here as WAV if not empty
+    std::string wav_file;
 
     YAML::Node dump2Yaml() const {
       YAML::Node audio;
@@ -81,6 +83,7 @@ struct PlayerConfig
       audio["channels"] = channels;
       audio["volume"] = volume;
       audio["is_muted"] = is_muted;
+      audio["wav_file"] = wav_file;
       return audio;
     }
   }audio;
@@ -95,6 +98,8 @@ struct PlayerConfig
     bool force_idr{false};
 
     float speed{1.0f};
+    // no pacing, as fast as the pipeline goes; needs headless audio
+    bool freerun{false};
     Bit auto_read_next_media{true};
     Bit save_while_playing{false};  // 播放设备流网络流时有效
     Bit track_mode{false};  // 播放设备流网络流时有效
@@ -108,6 +113,7 @@ struct PlayerConfig
       common["seek_step"] = seek_step;
       common["force_idr"] = force_idr;
       common["speed"] = speed;
+      common["freerun"] = freerun;
       common["auto_read_next_media"] = auto_read_next_media.get();
       common["save_while_playing"] = save_while_playing.get();
       return common;
@@ -28,6 +28,7 @@ private:
   
   bool openInputStream(const std::string &url, const std::string&shortName);
   bool openOutputStream(const std::string &url);
+  AVQueueLimits packetQueueLimits(AVStream *pStream) const;
 
 private:
   struct AVGroup {
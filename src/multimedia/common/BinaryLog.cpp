@@ -0,0 +1,608 @@
+#include <algorithm>
+#include <csignal>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+
+#include <fmt/args.h>
+
+#include <multimedia/common/BinaryLog.hpp>
+#include <multimedia/common/OSUtil.hpp>
+#include <multimedia/common/Time.hpp>
+
+#define BINARY_LOG_MAX_SITES  16384
+#define BINARY_LOG_CHUNK_SIZE (32 * 1024)
+// arguments of a recorded event beyond this are dropped
+#define FLIGHT_RECORDER_SLOT_PAYLOAD 120
+// exited threads whose last events are still dumped
+#define FLIGHT_RECORDER_RETIRED_RINGS 16
+// how soon the recorder thread notices a stop or a signal
+#define FLIGHT_RECORDER_POLL_US      100000
+
+namespace
+{
+struct RecordSlot
+{
+  BinaryLog::EventHeader header;
+  char payload[FLIGHT_RECORDER_SLOT_PAYLOAD];
+};
+
+/**
+ * A thread's pending records, written to the file in chunks, and its
+ * flight recorder ring.
+ */
+struct ThreadBuffer
+{
+  Mutex::type mutex;
+  std::vector<char> data;
+  size_t event_start{0};
+  uint32_t id{0};
+
+  std::vector<char> scratch;  // owner thread only
+  std::vector<RecordSlot> ring;
+  uint64_t recorded{0};
+
+  ThreadBuffer();
+  ~ThreadBuffer();
+};
+
+// lock order: threads_mutex -> ThreadBuffer::mutex -> mutex
+struct BinaryLogState
+{
+  Mutex::type mutex;  // file, sites, loggers, threads
+  std::FILE *file{nullptr};
+
+  std::atomic<const BinaryLog::Site *> sites[BINARY_LOG_MAX_SITES]{};
+  std::atomic<uint32_t> site_count{0};
+  std::vector<std::string> loggers;
+  std::vector<std::pair<std::string, std::string>> threads;
+
+  Mutex::type threads_mutex;
+  std::vector<ThreadBuffer *> buffers;
+  // rings of exited threads, oldest event first, guarded by threads_mutex
+  std::deque<std::vector<RecordSlot>> retired;
+
+  // flight recorder, lock order: recorder_mutex -> dump_mutex -> the above
+  Mutex::type recorder_mutex;  // enable/disable, the recorder thread
+  Mutex::type dump_mutex;      // recorder_options, dumps
+  FlightRecorderOptions recorder_options;
+  std::atomic<size_t> recorder_events{0};
+  std::atomic<bool> dump_on_error{false};
+  std::atomic<int64_t> min_dump_interval_ms{0};
+  std::atomic<int64_t> last_error_dump_ms{INT64_MIN / 2};
+  std::atomic<bool> dump_requested{false};
+  std::atomic<bool> recorder_stop{false};
+  Futex recorder_wake;
+  std::thread recorder;
+  uint32_t dumps{0};
+};
+BinaryLogState &state() {
+  // leaked, threads may still log during static destruction
+  static auto *s = new BinaryLogState();
+  return *s;
+}
+
+void putBytes(std::string &out, const void *data, size_t size) {
+  out.append(static_cast<const char *>(data), size);
+}
+template <typename T>
+void putValue(std::string &out, T value) {
+  putBytes(out, &value, sizeof(T));
+}
+void putString(std::string &out, std::string_view str) {
+  putValue(out, static_cast<uint32_t>(str.size()));
+  putBytes(out, str.data(), str.size());
+}
+
+/* state().mutex held */
+void writeRecord(std::FILE *file, const std::string &record) {
+  if (file) std::fwrite(record.data(), 1, record.size(), file);
+}
+void writeSite(std::FILE *file, uint32_t id, const BinaryLog::Site &site) {
+  std::string record;
+  putValue(record, static_cast<uint8_t>(BinaryLog::SITE));
+  putValue(record, id);
+  putValue(record, static_cast<uint8_t>(site.level.level()));
+  putValue(record, site.line);
+  putString(record, site.file);
+  putString(record, site.function);
+  putString(record, site.fmt);
+  writeRecord(file, record);
+}
+void writeLogger(std::FILE *file, uint32_t id, const std::string &name) {
+  std::string record;
+  putValue(record, static_cast<uint8_t>(BinaryLog::LOGGER));
+  putValue(record, id);
+  putString(record, name);
+  writeRecord(file, record);
+}
+void writeThread(std::FILE *file, uint32_t id, const std::string &name,
+  const std::string &tid) {
+  std::string record;
+  putValue(record, static_cast<uint8_t>(BinaryLog::THREAD));
+  putValue(record, id);
+  putString(record, name);
+  putString(record, tid);
+  writeRecord(file, record);
+}
+/* every site, logger and thread known so far */
+void writeDefinitions(std::FILE *file) {
+  auto &s = state();
+  const uint32_t sites = s.site_count.load(std::memory_order_acquire);
+  for (uint32_t id = 1; id <= sites; ++id) {
+    writeSite(file, id, *s.sites[id - 1].load(std::memory_order_acquire));
+  }
+  for (size_t i = 0; i < s.loggers.size(); ++i) {
+    writeLogger(file, static_cast<uint32_t>(i + 1), s.loggers[i]);
+  }
+  for (size_t i = 0; i < s.threads.size(); ++i) {
+    writeThread(file, static_cast<uint32_t>(i + 1), s.threads[i].first,
+      s.threads[i].second);
+  }
+}
+
+/* ThreadBuffer::mutex held */
+void flushBuffer(ThreadBuffer &buffer) {
+  if (buffer.data.empty()) return;
+  auto &s = state();
+  {
+    Mutex::lock locker(s.mutex);
+    if (s.file) std::fwrite(buffer.data.data(), 1, buffer.data.size(), s.file);
+  }
+  buffer.data.clear();
+}
+
+ThreadBuffer::ThreadBuffer() {
+  data.reserve(BINARY_LOG_CHUNK_SIZE + 1024);
+  auto name = Thread::currentName().empty()
+                ? Thread::name(std::this_thread::get_id())
+                : Thread::currentName();
+  auto tid = (std::ostringstream{} << std::this_thread::get_id()).str();
+
+  auto &s = state();
+  {
+    Mutex::lock locker(s.threads_mutex);
+    s.buffers.push_back(this);
+  }
+  Mutex::lock locker(s.mutex);
+  s.threads.emplace_back(name, tid);
+  id = static_cast<uint32_t>(s.threads.size());
+  writeThread(s.file, id, name, tid);
+}
+
+/* ThreadBuffer::mutex held */
+void appendRing(const ThreadBuffer &buffer, std::vector<RecordSlot> &out) {
+  const uint64_t capacity = buffer.ring.size();
+  const uint64_t end = buffer.recorded;
+  for (uint64_t i = end - std::min(end, capacity); i < end; ++i) {
+    out.push_back(buffer.ring[i % capacity]);
+  }
+}
+
+ThreadBuffer::~ThreadBuffer() {
+  auto &s = state();
+  Mutex::lock threadsLocker(s.threads_mutex);
+  {
+    Mutex::lock locker(mutex);
+    flushBuffer(*this);
+    // a worker that died just before the failure is often the interesting one
+    if (recorded && FlightRecorder::isEnabled()) {
+      std::vector<RecordSlot> events;
+      appendRing(*this, events);
+      s.retired.push_back(std::move(events));
+      if (s.retired.size() > FLIGHT_RECORDER_RETIRED_RINGS) {
+        s.retired.pop_front();
+      }
+    }
+  }
+  s.buffers.erase(std::remove(s.buffers.begin(), s.buffers.end(), this),
+    s.buffers.end());
+}
+
+/* trivially destructible, so it is still usable after the buffer is gone */
+bool &threadExited() {
+  thread_local bool exited = false;
+  return exited;
+}
+ThreadBuffer *threadBuffer() {
+  if (threadExited()) return nullptr;
+  struct Holder
+  {
+    ThreadBuffer buffer;
+    ~Holder() { threadExited() = true; }
+  };
+  thread_local Holder holder;
+  return &holder.buffer;
+}
+
+BinaryLog::EventHeader makeHeader(
+  uint32_t site, uint32_t logger, uint32_t thread, uint32_t size) {
+  BinaryLog::EventHeader header;
+  header.site = site;
+  header.logger = logger;
+  header.thread = thread;
+  header.size = size;
+  header.timestamp =
+    std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::system_clock::now().time_since_epoch())
+      .count();
+  return header;
+}
+
+uint32_t loggerId(std::atomic<uint32_t> &cached, const Logger &logger) {
+  uint32_t id = cached.load(std::memory_order_acquire);
+  if (id) return id;
+
+  auto &s = state();
+  Mutex::lock locker(s.mutex);
+  auto it = std::find(s.loggers.begin(), s.loggers.end(), logger.getName());
+  if (it != s.loggers.end()) {
+    id = static_cast<uint32_t>(it - s.loggers.begin() + 1);
+  }
+  else {
+    s.loggers.push_back(logger.getName());
+    id = static_cast<uint32_t>(s.loggers.size());
+    writeLogger(s.file, id, logger.getName());
+  }
+  cached.store(id, std::memory_order_release);
+  return id;
+}
+}  // namespace
+
+bool BinaryLog::open(const std::string &filename) {
+  close();
+
+  auto &s = state();
+  {
+    Mutex::lock locker(s.mutex);
+    s.file = std::fopen(filename.c_str(), "wb");
+    if (!s.file) {
+      std::cerr << "error in BinaryLog::open, " << filename
+                << " cannot be created" << std::endl;
+      return false;
+    }
+    std::fwrite(kMagic, 1, sizeof(kMagic), s.file);
+    // whatever was registered before the file existed
+    writeDefinitions(s.file);
+  }
+
+  static std::once_flag s_exit_hook;
+  std::call_once(s_exit_hook, [] { std::atexit(&BinaryLog::close); });
+
+  s_open.store(true, std::memory_order_release);
+  return true;
+}
+
+void BinaryLog::close() {
+  if (!s_open.exchange(false, std::memory_order_acq_rel)) return;
+  flush();
+
+  auto &s = state();
+  Mutex::lock locker(s.mutex);
+  if (s.file) {
+    std::fclose(s.file);
+    s.file = nullptr;
+  }
+}
+
+void BinaryLog::flush() {
+  auto &s = state();
+  Mutex::lock threadsLocker(s.threads_mutex);
+  for (auto *pBuffer : s.buffers) {
+    Mutex::lock locker(pBuffer->mutex);
+    flushBuffer(*pBuffer);
+  }
+  Mutex::lock locker(s.mutex);
+  if (s.file) std::fflush(s.file);
+}
+
+uint32_t BinaryLog::registerSite(LogLevel::Level level, const char *file,
+  int line, const char *function, const char *fmt) {
+  auto &s = state();
+  Mutex::lock locker(s.mutex);
+  const uint32_t count = s.site_count.load(std::memory_order_relaxed);
+  if (count >= BINARY_LOG_MAX_SITES) {
+    std::cerr << "error in BinaryLog::registerSite, too many log sites, "
+              << file << ":" << line << " reuses the last one" << std::endl;
+    return count;
+  }
+
+  const uint32_t id = count + 1;
+  auto *pSite =
+    new Site{level, static_cast<uint32_t>(line), file, function, fmt};
+  s.sites[id - 1].store(pSite, std::memory_order_release);
+  s.site_count.store(id, std::memory_order_release);
+  writeSite(s.file, id, *pSite);
+  return id;
+}
+
+const BinaryLog::Site *BinaryLog::site(uint32_t id) {
+  return state().sites[id - 1].load(std::memory_order_acquire);
+}
+
+std::vector<char> *BinaryLog::beginEvent(uint32_t site, const Logger &logger) {
+  const uint32_t logger_id = loggerId(logger.binary_id_, logger);
+
+  auto *pBuffer = threadBuffer();
+  if (!pBuffer) return nullptr;
+  pBuffer->mutex.lock();
+
+  const EventHeader header = makeHeader(site, logger_id, pBuffer->id, 0);
+  auto &data = pBuffer->data;
+  pBuffer->event_start = data.size();
+  data.resize(data.size() + 1 + sizeof(header));
+  data[pBuffer->event_start] = static_cast<char>(EVENT);
+  std::memcpy(data.data() + pBuffer->event_start + 1, &header, sizeof(header));
+  return &data;
+}
+
+void BinaryLog::endEvent(uint32_t site) {
+  auto *pBuffer = threadBuffer();
+  auto &data = pBuffer->data;
+  const size_t payload = pBuffer->event_start + 1 + sizeof(EventHeader);
+  const uint32_t size = static_cast<uint32_t>(data.size() - payload);
+  std::memcpy(data.data() + pBuffer->event_start + 1
+                + offsetof(EventHeader, size),
+    &size, sizeof(size));
+
+  if (data.size() >= BINARY_LOG_CHUNK_SIZE
+      || BinaryLog::site(site)->level >= LogLevel::LERROR) {
+    flushBuffer(*pBuffer);
+  }
+  pBuffer->mutex.unlock();
+}
+
+std::string BinaryLog::formatPayload(
+  const char *fmt, const char *payload, size_t size) {
+  fmt::dynamic_format_arg_store<fmt::format_context> store;
+  const char *p = payload;
+  const char *end = payload + size;
+  auto take = [&](auto &value) {
+    if (end - p < (ptrdiff_t) sizeof(value)) return false;
+    std::memcpy(&value, p, sizeof(value));
+    p += sizeof(value);
+    return true;
+  };
+
+  while (p < end) {
+    const auto tag = static_cast<Arg>(*p++);
+    bool ok = false;
+    switch (tag) {
+    case I64: {
+      int64_t v;
+      if ((ok = take(v))) store.push_back(v);
+      break;
+    }
+    case U64: {
+      uint64_t v;
+      if ((ok = take(v))) store.push_back(v);
+      break;
+    }
+    case F64: {
+      double v;
+      if ((ok = take(v))) store.push_back(v);
+      break;
+    }
+    case BOOL: {
+      uint8_t v;
+      if ((ok = take(v))) store.push_back(v != 0);
+      break;
+    }
+    case CHAR: {
+      char v;
+      if ((ok = take(v))) store.push_back(v);
+      break;
+    }
+    case STR: {
+      uint32_t n;
+      if ((ok = take(n) && end - p >= (ptrdiff_t) n)) {
+        store.push_back(std::string(p, n));
+        p += n;
+      }
+      break;
+    }
+    case PTR: {
+      uint64_t v;
+      if ((ok = take(v)))
+        store.push_back(reinterpret_cast<const void *>((uintptr_t) v));
+      break;
+    }
+    }
+    if (!ok) return std::string("<<corrupt log record>> ") + fmt;
+  }
+
+  try {
+    return fmt::vformat(fmt, store);
+  } catch (const fmt::format_error &e) {
+    return std::string("<<format error: ") + e.what() + ">> " + fmt;
+  }
+}
+
+/***************************************** FlightRecorder
+ * *****************************************/
+namespace
+{
+void onDumpSignal(int) {
+  state().dump_requested.store(true, std::memory_order_relaxed);
+}
+
+void recorderLoop() {
+  Thread::setCurrentName("FlightRecorder");
+  auto &s = state();
+  while (!s.recorder_stop.load(std::memory_order_acquire)) {
+    const uint32_t key = s.recorder_wake.prepareWait();
+    if (s.dump_requested.load(std::memory_order_acquire)
+        || s.recorder_stop.load(std::memory_order_acquire)) {
+      s.recorder_wake.cancelWait();
+    }
+    else {
+      // a signal handler only sets the flag, hence the timeout
+      s.recorder_wake.wait(key, Futex::Timeout(FLIGHT_RECORDER_POLL_US));
+    }
+    if (s.dump_requested.exchange(false, std::memory_order_acq_rel)) {
+      FlightRecorder::dump();
+    }
+  }
+}
+
+int64_t steadyMs() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+    std::chrono::steady_clock::now().time_since_epoch())
+    .count();
+}
+}  // namespace
+
+void FlightRecorder::enable(FlightRecorderOptions options) {
+  auto &s = state();
+  Mutex::lock locker(s.recorder_mutex);
+  if (!options.directory.empty() && options.directory.back() != '/') {
+    options.directory += '/';
+  }
+  s.recorder_events.store(options.events_per_thread, std::memory_order_relaxed);
+  s.dump_on_error.store(options.dump_on_error, std::memory_order_relaxed);
+  s.min_dump_interval_ms.store(
+    options.min_dump_interval_ms, std::memory_order_relaxed);
+#ifdef SIGUSR1
+  std::signal(SIGUSR1, options.dump_on_signal ? &onDumpSignal : SIG_DFL);
+#endif
+  {
+    Mutex::lock dumpLocker(s.dump_mutex);
+    s.recorder_options = std::move(options);
+  }
+
+  if (!s.recorder.joinable()) {
+    s.recorder_stop.store(false, std::memory_order_release);
+    s.recorder = std::thread(&recorderLoop);
+  }
+  s_enabled.store(true, std::memory_order_release);
+}
+
+void FlightRecorder::disable() {
+  auto &s = state();
+  Mutex::lock locker(s.recorder_mutex);
+  s_enabled.store(false, std::memory_order_release);
+#ifdef SIGUSR1
+  std::signal(SIGUSR1, SIG_DFL);
+#endif
+  if (s.recorder.joinable()) {
+    s.recorder_stop.store(true, std::memory_order_release);
+    s.recorder_wake.notifyOne();
+    s.recorder.join();
+  }
+  // rings are dropped lazily, on each thread's next record
+  s.recorder_events.store(0, std::memory_order_relaxed);
+  Mutex::lock threadsLocker(s.threads_mutex);
+  s.retired.clear();
+}
+
+std::string FlightRecorder::dump(const std::string &filename) {
+  auto &s = state();
+  Mutex::lock dumpLocker(s.dump_mutex);
+  std::string path = filename;
+  if (path.empty()) {
+    path = s.recorder_options.directory + "flight_"
+           + TimeUtil::toFormatString("%Y-%m-%d_%H-%M-%S") + "_"
+           + std::to_string(++s.dumps) + ".mmblog";
+  }
+  std::FILE *file = std::fopen(path.c_str(), "wb");
+  if (!file && os_api::mkdir(os_api::dirname(path))) {
+    file = std::fopen(path.c_str(), "wb");
+  }
+  if (!file) {
+    std::cerr << "error in FlightRecorder::dump, " << path
+              << " cannot be created" << std::endl;
+    return "";
+  }
+
+  // copy the rings out first, so the definitions cover every id they use
+  std::vector<RecordSlot> events;
+  {
+    Mutex::lock threadsLocker(s.threads_mutex);
+    for (const auto &ring : s.retired) {
+      events.insert(events.end(), ring.begin(), ring.end());
+    }
+    for (auto *pBuffer : s.buffers) {
+      Mutex::lock locker(pBuffer->mutex);
+      appendRing(*pBuffer, events);
+    }
+  }
+
+  std::fwrite(BinaryLog::kMagic, 1, sizeof(BinaryLog::kMagic), file);
+  {
+    Mutex::lock locker(s.mutex);
+    writeDefinitions(file);
+  }
+  for (const auto &event : events) {
+    std::fputc(BinaryLog::EVENT, file);
+    std::fwrite(&event.header, 1, sizeof(event.header), file);
+    std::fwrite(event.payload, 1, event.header.size, file);
+  }
+  std::fclose(file);
+  return path;
+}
+
+void FlightRecorder::requestDump() {
+  auto &s = state();
+  s.dump_requested.store(true, std::memory_order_release);
+  s.recorder_wake.notifyOne();
+}
+
+void FlightRecorder::onError(LogLevel level) {
+  auto &s = state();
+  if (!isEnabled() || !s.dump_on_error.load(std::memory_order_relaxed)) return;
+  if (level >= LogLevel::LFATAL) {
+    // the process may not outlive this event
+    dump();
+    return;
+  }
+
+  const int64_t now = steadyMs();
+  int64_t last = s.last_error_dump_ms.load(std::memory_order_relaxed);
+  if (now - last < s.min_dump_interval_ms.load(std::memory_order_relaxed)
+      || !s.last_error_dump_ms.compare_exchange_strong(
+        last, now, std::memory_order_relaxed)) {
+    return;
+  }
+  requestDump();
+}
+
+std::vector<char> *FlightRecorder::beginRecord() {
+  auto *pBuffer = threadBuffer();
+  if (!pBuffer) return nullptr;
+  pBuffer->scratch.clear();
+  return &pBuffer->scratch;
+}
+
+void FlightRecorder::endRecord(uint32_t site, const Logger &logger) {
+  auto &s = state();
+  auto *pBuffer = threadBuffer();
+  const uint32_t logger_id = loggerId(logger.binary_id_, logger);
+  const auto &payload = pBuffer->scratch;
+  // too many arguments to keep, the decoder shows the bare format string
+  const uint32_t size = payload.size() <= FLIGHT_RECORDER_SLOT_PAYLOAD
+                          ? static_cast<uint32_t>(payload.size())
+                          : 0;
+  const BinaryLog::EventHeader header =
+    makeHeader(site, logger_id, pBuffer->id, size);
+
+  const size_t capacity = s.recorder_events.load(std::memory_order_relaxed);
+  {
+    Mutex::lock locker(pBuffer->mutex);
+    if (pBuffer->ring.size() != capacity) {
+      pBuffer->ring.assign(capacity, RecordSlot{});
+      pBuffer->recorded = 0;
+    }
+    if (capacity) {
+      auto &slot = pBuffer->ring[pBuffer->recorded++ % capacity];
+      slot.header = header;
+      std::memcpy(slot.payload, payload.data(), size);
+    }
+  }
+
+  const LogLevel level = BinaryLog::site(site)->level;
+  if (level >= LogLevel::LERROR) onError(level);
+}
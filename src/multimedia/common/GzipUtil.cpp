@@ -0,0 +1,279 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <vector>
+
+#include <multimedia/common/GzipUtil.hpp>
+
+#define DEFLATE_WINDOW_SIZE  32768
+#define DEFLATE_WINDOW_MASK  (DEFLATE_WINDOW_SIZE - 1)
+#define DEFLATE_HASH_BITS    15
+#define DEFLATE_HASH_SIZE    (1 << DEFLATE_HASH_BITS)
+#define DEFLATE_MIN_MATCH    3
+#define DEFLATE_MAX_MATCH    258
+#define DEFLATE_MAX_CHAIN    32
+// input read per round, the window before it is kept for matches
+#define DEFLATE_SEGMENT_SIZE (1 << 20)
+#define DEFLATE_OUTPUT_SIZE  (64 << 10)
+
+namespace
+{
+const uint16_t kLengthBase[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19,
+  23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+const uint8_t kLengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+  2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+const uint16_t kDistBase[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65,
+  97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193,
+  12289, 16385, 24577};
+const uint8_t kDistExtra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6,
+  6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+uint32_t reverseBits(uint32_t code, int bits) {
+  uint32_t r = 0;
+  for (int i = 0; i < bits; ++i) {
+    r = (r << 1) | (code & 1);
+    code >>= 1;
+  }
+  return r;
+}
+
+class BitWriter
+{
+public:
+  explicit BitWriter(std::FILE *file) : file_(file) {
+    out_.reserve(DEFLATE_OUTPUT_SIZE + 16);
+  }
+
+  /* LSB first, as deflate packs everything but Huffman codes */
+  void put(uint32_t value, int bits) {
+    bits_ |= static_cast<uint64_t>(value) << count_;
+    count_ += bits;
+    while (count_ >= 8) {
+      out_.push_back(static_cast<uint8_t>(bits_));
+      bits_ >>= 8;
+      count_ -= 8;
+    }
+    if (out_.size() >= DEFLATE_OUTPUT_SIZE) drain();
+  }
+  void putBytes(const void *data, size_t size) {
+    alignToByte();
+    const auto *p = static_cast<const uint8_t *>(data);
+    out_.insert(out_.end(), p, p + size);
+  }
+  void alignToByte() {
+    if (count_ > 0) put(0, 8 - count_);
+  }
+  bool drain() {
+    if (!out_.empty()
+        && std::fwrite(out_.data(), 1, out_.size(), file_) != out_.size()) {
+      ok_ = false;
+    }
+    out_.clear();
+    return ok_;
+  }
+  bool ok() const { return ok_; }
+
+private:
+  std::FILE *file_;
+  std::vector<uint8_t> out_;
+  uint64_t bits_{0};
+  int count_{0};
+  bool ok_{true};
+};
+
+/* fixed Huffman literal/length code, RFC 1951 3.2.6 */
+void putSymbol(BitWriter &writer, int symbol) {
+  if (symbol < 144)
+    writer.put(reverseBits(0x30 + symbol, 8), 8);
+  else if (symbol < 256)
+    writer.put(reverseBits(0x190 + symbol - 144, 9), 9);
+  else if (symbol < 280)
+    writer.put(reverseBits(symbol - 256, 7), 7);
+  else
+    writer.put(reverseBits(0xc0 + symbol - 280, 8), 8);
+}
+
+void putMatch(BitWriter &writer, int length, int distance) {
+  int code = 28;
+  while (kLengthBase[code] > length) --code;
+  putSymbol(writer, 257 + code);
+  writer.put(length - kLengthBase[code], kLengthExtra[code]);
+
+  code = 29;
+  while (kDistBase[code] > distance) --code;
+  writer.put(reverseBits(code, 5), 5);
+  writer.put(distance - kDistBase[code], kDistExtra[code]);
+}
+
+class Deflater
+{
+public:
+  explicit Deflater(BitWriter &writer)
+    : writer_(writer)
+    , head_(new int64_t[DEFLATE_HASH_SIZE])
+    , prev_(new int64_t[DEFLATE_WINDOW_SIZE]) {
+    std::fill(head_.get(), head_.get() + DEFLATE_HASH_SIZE, -1);
+    std::fill(prev_.get(), prev_.get() + DEFLATE_WINDOW_SIZE, -1);
+  }
+
+  /**
+   * data holds [window | new input]; base is the stream offset of data[0]
+   * and pos the offset to resume at. Stops DEFLATE_MAX_MATCH short of the
+   * end unless final, returns where it stopped.
+   */
+  int64_t run(const uint8_t *data, size_t size, int64_t base, int64_t pos,
+    bool final) {
+    const int64_t end = base + static_cast<int64_t>(size);
+    const int64_t limit = final ? end : end - DEFLATE_MAX_MATCH;
+
+    // one fixed-Huffman block per round
+    writer_.put(final ? 1 : 0, 1);
+    writer_.put(1, 2);
+    while (pos < limit) {
+      int best_length = 0;
+      int64_t best_pos = 0;
+      if (end - pos >= DEFLATE_MIN_MATCH) {
+        const uint32_t h = hash(data + (pos - base));
+        int64_t candidate = head_[h];
+        const int max_length =
+          static_cast<int>(std::min<int64_t>(DEFLATE_MAX_MATCH, end - pos));
+        for (int chain = 0; candidate >= base && chain < DEFLATE_MAX_CHAIN
+                            && pos - candidate <= DEFLATE_WINDOW_SIZE;
+             ++chain) {
+          const int length = matchLength(
+            data + (candidate - base), data + (pos - base), max_length);
+          if (length > best_length) {
+            best_length = length;
+            best_pos = candidate;
+            if (length == max_length) break;
+          }
+          candidate = prev_[candidate & DEFLATE_WINDOW_MASK];
+        }
+        insert(data, base, pos);
+      }
+
+      if (best_length >= DEFLATE_MIN_MATCH) {
+        putMatch(writer_, best_length, static_cast<int>(pos - best_pos));
+        for (int64_t i = pos + 1; i < pos + best_length; ++i) {
+          if (end - i >= DEFLATE_MIN_MATCH) insert(data, base, i);
+        }
+        pos += best_length;
+      }
+      else {
+        putSymbol(writer_, data[pos - base]);
+        ++pos;
+      }
+    }
+    putSymbol(writer_, 256);  // end of block
+    return pos;
+  }
+
+private:
+  static uint32_t hash(const uint8_t *p) {
+    const uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16);
+    return (v * 2654435761u) >> (32 - DEFLATE_HASH_BITS);
+  }
+  static int matchLength(const uint8_t *a, const uint8_t *b, int max) {
+    int n = 0;
+    while (n < max && a[n] == b[n]) ++n;
+    return n;
+  }
+  void insert(const uint8_t *data, int64_t base, int64_t pos) {
+    const uint32_t h = hash(data + (pos - base));
+    prev_[pos & DEFLATE_WINDOW_MASK] = head_[h];
+    head_[h] = pos;
+  }
+
+  BitWriter &writer_;
+  std::unique_ptr<int64_t[]> head_;
+  std::unique_ptr<int64_t[]> prev_;
+};
+}  // namespace
+
+namespace gzip_util
+{
+uint32_t crc32(uint32_t crc, const void *data, size_t size) {
+  // leaked, the log archiver thread may still be running at exit
+  static const auto *table = [] {
+    auto *t = new uint32_t[256];
+    for (uint32_t i = 0; i < 256; ++i) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; ++k) {
+        c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+      }
+      t[i] = c;
+    }
+    return t;
+  }();
+
+  const auto *p = static_cast<const uint8_t *>(data);
+  crc = ~crc;
+  for (size_t i = 0; i < size; ++i) {
+    crc = table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+bool compress_file(const std::string &src, const std::string &dst) {
+  std::FILE *in = std::fopen(src.c_str(), "rb");
+  if (!in) return false;
+  std::FILE *out = std::fopen(dst.c_str(), "wb");
+  if (!out) {
+    std::fclose(in);
+    return false;
+  }
+
+  BitWriter writer(out);
+  const uint32_t mtime = static_cast<uint32_t>(std::time(nullptr));
+  const uint8_t header[10] = {0x1f, 0x8b, 8, 0,
+    static_cast<uint8_t>(mtime), static_cast<uint8_t>(mtime >> 8),
+    static_cast<uint8_t>(mtime >> 16), static_cast<uint8_t>(mtime >> 24), 0,
+    0xff};
+  writer.putBytes(header, sizeof(header));
+
+  Deflater deflater(writer);
+  std::vector<uint8_t> data;
+  data.reserve(DEFLATE_WINDOW_SIZE + DEFLATE_SEGMENT_SIZE);
+  int64_t base = 0;  // stream offset of data[0]
+  int64_t pos = 0;   // next byte to code
+  uint32_t crc = 0;
+  uint64_t total = 0;
+  bool eof = false;
+  bool ok = true;
+  while (ok && !eof) {
+    const size_t old_size = data.size();
+    data.resize(old_size + DEFLATE_SEGMENT_SIZE);
+    const size_t n = std::fread(data.data() + old_size, 1,
+      DEFLATE_SEGMENT_SIZE, in);
+    data.resize(old_size + n);
+    eof = n < DEFLATE_SEGMENT_SIZE;
+    if (eof && std::ferror(in)) ok = false;
+    crc = crc32(crc, data.data() + old_size, n);
+    total += n;
+
+    pos = deflater.run(data.data(), data.size(), base, pos, eof);
+    ok = ok && writer.ok();
+
+    // keep the window behind pos (and whatever was not coded yet)
+    const int64_t keep_from = std::max(base, pos - DEFLATE_WINDOW_SIZE);
+    data.erase(data.begin(), data.begin() + (keep_from - base));
+    base = keep_from;
+  }
+
+  writer.alignToByte();
+  const uint8_t trailer[8] = {static_cast<uint8_t>(crc),
+    static_cast<uint8_t>(crc >> 8), static_cast<uint8_t>(crc >> 16),
+    static_cast<uint8_t>(crc >> 24), static_cast<uint8_t>(total),
+    static_cast<uint8_t>(total >> 8), static_cast<uint8_t>(total >> 16),
+    static_cast<uint8_t>(total >> 24)};
+  writer.putBytes(trailer, sizeof(trailer));
+  ok = writer.drain() && ok;
+
+  std::fclose(in);
+  ok = std::fclose(out) == 0 && ok;
+  if (!ok) std::remove(dst.c_str());
+  return ok;
+}
+}  // namespace gzip_util
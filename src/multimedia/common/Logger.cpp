@@ -1,16 +1,35 @@
-﻿#include <iostream>
+﻿#include <algorithm>
+#include <cctype>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <iostream>
+#include <mutex>
 #include <string>
+#include <tuple>
 
+#include <multimedia/common/BinaryLog.hpp>
+#include <multimedia/common/GzipUtil.hpp>
 #include <multimedia/common/OSUtil.hpp>
 #include <multimedia/common/Logger.hpp>
 
-static auto g_max_file_line = 50000;
+#if defined(__LINUX__)
+# include <sys/resource.h>
+# include <sys/syscall.h>
+#endif
+
+// AsyncFileLogAppender
+static size_t g_async_batch_records = 256;
+static auto g_async_idle_wait_us = 100 * 1000;
+static auto g_async_block_wait_us = 1000;
+// LogArchiver
+static auto g_archiver_nice = 10;
 
 /********************************************* LogEvent
  * **********************************************/
-LogEvent::LogEvent(LogLevel level, std::thread::id tid,
-  const std::string &filename, int32_t line, const std::string &function_name,
-  int64_t timestamp, LogColorConfig config)
+LogEvent::LogEvent(LogLevel level, std::thread::id tid, const char *filename,
+  int32_t line, const char *function_name, int64_t timestamp,
+  LogColorConfig config)
   : tid_(tid)
   , filename_(filename)
   , function_name_(function_name)
@@ -18,180 +37,145 @@ LogEvent::LogEvent(LogLevel level, std::thread::id tid,
   , timestamp_(timestamp)
   , level_(level) {}
 
-/***************************************** LogFormatterItem
- * ******************************************/
-class MessageFormatterItem final : public LogFormatterItem
-{
-public:
-  MessageFormatterItem(const std::string &str = "") {}
-  void format(std::ostream &os, LogEvent::ptr pLogEvent,
-    std::shared_ptr<Logger> pLogger) override {
-    os << pLogEvent->getContent();
-  }
-};
-class LogLevelFormatterItem final : public LogFormatterItem
-{
-public:
-  LogLevelFormatterItem(const std::string &str = "") {}
-  void format(std::ostream &os, LogEvent::ptr pLogEvent,
-    std::shared_ptr<Logger> pLogger) override {
-    os << pLogEvent->getLevel().toString();
-  }
-};
-class LogNameFormatterItem final : public LogFormatterItem
-{
-public:
-  LogNameFormatterItem(const std::string &str = "") {}
-  void format(std::ostream &os, LogEvent::ptr pLogEvent,
-    std::shared_ptr<Logger> pLogger) override {
-    os << pLogger->getName();
-  }
-};
-class DateTimeFormatterItem final : public LogFormatterItem
-{
-public:
-  DateTimeFormatterItem(const std::string &format = "%Y-%m-%d %H:%M:%S")
-    : timefmt_(format) {
-    if (timefmt_.empty()) {
-      timefmt_ = "%Y-%m-%d %H:%M:%S";
-    }
-  }
-  void format(std::ostream &os, LogEvent::ptr pLogEvent,
-    std::shared_ptr<Logger> pLogger) override {
-    const auto timestamp = pLogEvent->getTimestamp();
-    const auto tp = std::chrono::time_point<std::chrono::system_clock>(
-      std::chrono::milliseconds(timestamp));
-    time_t t = std::chrono::system_clock::to_time_t(tp);
-#ifdef __WIN__
-    struct tm tm;
-    localtime_s(&tm, &t);
-#elif defined(__LINUX__)
-    struct tm tm;
-    localtime_r(&t, &tm);
-#else
-    struct tm tm = *localtime(&t);
-#endif
-    char buf[64];
-    std::strftime(buf, sizeof(buf), timefmt_.c_str(), &tm);
-    os << buf;
-  }
+std::string LogEvent::getContent() const {
+  if (!ss_) return content_;
+  return content_ + ss_->str();
+}
 
-private:
-  std::string timefmt_;
-};
-class FilenameFormatterItem final : public LogFormatterItem
-{
-public:
-  FilenameFormatterItem(const std::string &str = "") {}
-  void format(std::ostream &os, LogEvent::ptr pLogEvent,
-    std::shared_ptr<Logger> pLogger) override {
-    auto name = pLogEvent->getFilename();
-    std::string basename;
-    auto p = name.rfind('/');
-    if (p != std::string::npos) {
-      basename = name.substr(p + 1);
-    }
-    else {
-      basename = name;
-    }
-    os << basename;
-  }
-};
-class LineFormatterItem final : public LogFormatterItem
-{
-public:
-  LineFormatterItem(const std::string &str = "") {}
-  void format(std::ostream &os, LogEvent::ptr pLogEvent,
-    std::shared_ptr<Logger> pLogger) override {
-    os << pLogEvent->getLine();
-  }
-};
-class StringFormatterItem final : public LogFormatterItem
-{
-public:
-  StringFormatterItem(const std::string &str) : str_(str) {}
-  void format(std::ostream &os, LogEvent::ptr pLogEvent,
-    std::shared_ptr<Logger> pLogger) override {
-    os << str_;
+void LogEvent::appendContent(fmt::memory_buffer &out) const {
+  out.append(content_.data(), content_.data() + content_.size());
+  if (ss_) {
+    const std::string str = ss_->str();
+    out.append(str.data(), str.data() + str.size());
   }
+}
 
-private:
-  std::string str_;
-};
-class CharFormatterItem final : public LogFormatterItem
-{
-public:
-  CharFormatterItem(const std::string &str = "") : str_(str) {}
-  void format(std::ostream &os, LogEvent::ptr pLogEvent,
-    std::shared_ptr<Logger> pLogger) override {
-    os << str_;
-  }
+/******************************************* LogFormatter
+ * *******************************************/
+static void appendString(fmt::memory_buffer &out, std::string_view str) {
+  out.append(str.data(), str.data() + str.size());
+}
 
-private:
-  std::string str_;
-};
-class FunctionNameFormatterItem final : public LogFormatterItem
+/* rendered thread id/name of the calling thread */
+struct LogThreadCache
 {
-public:
-  FunctionNameFormatterItem(const std::string &str) : str_(str) {}
-  void format(std::ostream &os, LogEvent::ptr pLogEvent,
-    std::shared_ptr<Logger> pLogger) override {
-    os << pLogEvent->getFunctionName();
-  }
-
-private:
-  std::string str_;
+  std::string id;
+  std::string name;
 };
-class ThreadNameFormatterItem : public LogFormatterItem
-{
-public:
-  ThreadNameFormatterItem(const std::string &str) : str_(str) {}
-  void format(std::ostream &os, LogEvent::ptr pLogEvent,
-    std::shared_ptr<Logger> pLogger) override {
-    os << pLogEvent->getThreadName();
-  }
+static LogThreadCache &logThreadCache() {
+  thread_local LogThreadCache cache;
+  return cache;
+}
 
-private:
-  std::string str_;
-};
-class ThreadIdFormatterItem : public LogFormatterItem
+/* date strings of the current second, per formatter instruction */
+struct LogDateCache
 {
-public:
-  ThreadIdFormatterItem(const std::string &str) : str_(str) {}
-  void format(std::ostream &os, LogEvent::ptr pLogEvent,
-    std::shared_ptr<Logger> pLogger) override {
-    os << pLogEvent->getThreadId();
-  }
-
-private:
-  std::string str_;
+  uint64_t key{0};
+  int64_t second{-1};
+  size_t len{0};
+  char text[64];
 };
 
-
-/******************************************* LogFormatter
- * *******************************************/
 LogFormatter::LogFormatter(const std::string &pattern) : pattern_(pattern) {
+  static std::atomic<uint32_t> s_next_id{1};
+  id_ = s_next_id.fetch_add(1, std::memory_order_relaxed);
   init();
 }
 
+fmt::memory_buffer &LogFormatter::threadBuffer() {
+  thread_local fmt::memory_buffer buffer;
+  return buffer;
+}
+
 std::string LogFormatter::format(
   LogEvent::ptr pLogEvent, std::shared_ptr<Logger> pLogger) {
-  std::stringstream ss;
-  for (auto &item : items_) {
-    item->format(ss, pLogEvent, pLogger);
-  }
-  return ss.str();
+  auto &buffer = threadBuffer();
+  buffer.clear();
+  format(buffer, *pLogEvent, *pLogger);
+  return fmt::to_string(buffer);
 }
 
 std::ostream &LogFormatter::format(
   std::ostream &os, LogEvent::ptr pLogEvent, std::shared_ptr<Logger> pLogger) {
-  std::stringstream ss;
-  for (auto &item : items_) {
-    item->format(ss, pLogEvent, pLogger);
+  auto &buffer = threadBuffer();
+  buffer.clear();
+  format(buffer, *pLogEvent, *pLogger);
+  return os.write(buffer.data(), buffer.size());
+}
+
+void LogFormatter::format(
+  fmt::memory_buffer &out, const LogEvent &event, const Logger &logger) {
+  for (size_t i = 0; i < instrs_.size(); ++i) {
+    const Instr &instr = instrs_[i];
+    switch (instr.op) {
+    case Op::TEXT: appendString(out, instr.arg); break;
+    case Op::MESSAGE: event.appendContent(out); break;
+    case Op::LOG_LEVEL: appendString(out, event.getLevel().toString()); break;
+    case Op::LOG_NAME: appendString(out, logger.getName()); break;
+    case Op::DATETIME: appendDateTime(out, i, event.getTimestamp()); break;
+    case Op::FILENAME: appendString(out, event.getFilename()); break;
+    case Op::LINE:
+      fmt::format_to(std::back_inserter(out), "{}", event.getLine());
+      break;
+    case Op::FUNCTION_NAME: appendString(out, event.getFunctionName()); break;
+    case Op::THREAD_NAME: {
+      if (event.isReplayed()
+          || event.getThreadId() != std::this_thread::get_id()) {
+        appendString(out, event.getThreadName());
+        break;
+      }
+      if (!Thread::currentName().empty()) {
+        appendString(out, Thread::currentName());
+        break;
+      }
+      auto &cache = logThreadCache();
+      if (cache.name.empty()) cache.name = event.getThreadName();
+      appendString(out, cache.name);
+      break;
+    }
+    case Op::THREAD_ID: {
+      if (event.isReplayed()) {
+        appendString(out, event.getThreadIdText());
+        break;
+      }
+      if (event.getThreadId() != std::this_thread::get_id()) {
+        appendString(out, (std::ostringstream{} << event.getThreadId()).str());
+        break;
+      }
+      auto &cache = logThreadCache();
+      if (cache.id.empty()) {
+        cache.id = (std::ostringstream{} << event.getThreadId()).str();
+      }
+      appendString(out, cache.id);
+      break;
+    }
+    }
+  }
+}
+
+void LogFormatter::appendDateTime(
+  fmt::memory_buffer &out, size_t index, int64_t timestamp) const {
+  thread_local LogDateCache s_caches[4];
+  const uint64_t key = (static_cast<uint64_t>(id_) << 32) | (index + 1);
+  auto &cache = s_caches[(id_ + index) & 3];
+  const int64_t second = timestamp / 1000;
+  if (cache.key != key || cache.second != second) {
+    time_t t = static_cast<time_t>(second);
+#ifdef __WIN__
+    struct tm tm;
+    localtime_s(&tm, &t);
+#elif defined(__LINUX__)
+    struct tm tm;
+    localtime_r(&t, &tm);
+#else
+    struct tm tm = *localtime(&t);
+#endif
+    cache.key = key;
+    cache.second = second;
+    cache.len = std::strftime(
+      cache.text, sizeof(cache.text), instrs_[index].arg.c_str(), &tm);
   }
-  os << ss.str();
-  os.flush();
-  return os;
+  out.append(cache.text, cache.text + cache.len);
 }
 
 LogFormatter::PatArgsWrapper LogFormatter::parsePatToken(
@@ -251,47 +235,47 @@ void LogFormatter::init() {
     vec.push_back(std::make_tuple("", "", PARSE_ERROR));
   }
 
-  static std::unordered_map<std::string,
-    std::function<LogFormatterItem::ptr(const std::string &str)>>
-    s_format_items = {
-#define XX(STR, ID)                                            \
-  {                                                            \
-    STR, [](const std::string &str) -> LogFormatterItem::ptr { \
-      return std::make_shared<ID>(str);                        \
-    }                                                          \
-  }
-      XX("LOG_LEVEL", LogLevelFormatterItem),
-      XX("MESSAGE", MessageFormatterItem),
-      XX("LOG_NAME", LogNameFormatterItem),
-      XX("DATETIME", DateTimeFormatterItem),
-      XX("FILENAME", FilenameFormatterItem),
-      XX("LINE", LineFormatterItem),
-      XX("CHAR", CharFormatterItem),
-      XX("FUNCTION_NAME", FunctionNameFormatterItem),
-      XX("THREAD_NAME", ThreadNameFormatterItem),
-      XX("THREAD_ID", ThreadIdFormatterItem),
-#undef XX
-    };
+  static const std::unordered_map<std::string, Op> s_ops = {
+    {"LOG_LEVEL", Op::LOG_LEVEL},
+    {"MESSAGE", Op::MESSAGE},
+    {"LOG_NAME", Op::LOG_NAME},
+    {"DATETIME", Op::DATETIME},
+    {"FILENAME", Op::FILENAME},
+    {"LINE", Op::LINE},
+    {"CHAR", Op::TEXT},
+    {"FUNCTION_NAME", Op::FUNCTION_NAME},
+    {"THREAD_NAME", Op::THREAD_NAME},
+    {"THREAD_ID", Op::THREAD_ID},
+  };
+
+  // adjacent text is merged into one instruction
+  auto emit = [this](Op op, const std::string &arg) {
+    if (op == Op::TEXT && !instrs_.empty() && instrs_.back().op == Op::TEXT) {
+      instrs_.back().arg.append(arg);
+      return;
+    }
+    instrs_.push_back({op, arg});
+  };
 
   has_error_ = false;
   for (const auto &wrapper : vec) {
     const auto &[id, arg, status] = wrapper;
     if (status != PARSE_OK) {
-      items_.push_back(std::make_shared<StringFormatterItem>(id));
+      emit(Op::TEXT, id);
       continue;
     }
 
-    auto it = s_format_items.find(id);
-    if (it == s_format_items.end()) {
+    auto it = s_ops.find(id);
+    if (it == s_ops.end()) {
       has_error_ = true;
       error_.clear();
       error_.append("<<PATTERN ERROR: UNSUPPORTED FORMAT $");
       error_.append(id);
       error_.append(">>");
-      items_.push_back(std::make_shared<StringFormatterItem>(error_));
+      emit(Op::TEXT, error_);
     }
     else {
-      items_.push_back(it->second(arg));
+      emit(it->second, arg);
     }
   }
 }
@@ -305,6 +289,16 @@ YAML::Node LogFormatter::toYaml() const {
 
 /******************************************* LogAppender
  * *********************************************/
+static Mutex::type &flushAppendersMutex() {
+  static auto *mutex = new Mutex::type();
+  return *mutex;
+}
+/* live buffering appenders, visited by flushAll() */
+static std::vector<LogAppender *> &flushAppenders() {
+  static auto *appenders = new std::vector<LogAppender *>();
+  return *appenders;
+}
+
 void LogAppender::setFormatter(LogFormatter::ptr pFormatter) {
   Mutex::lock locker(mutex_);
   formatter_ = pFormatter;
@@ -315,131 +309,422 @@ LogFormatter::ptr LogAppender::getFormatter() const {
   return formatter_;
 }
 
-/***************************************** FileLogAppender
- * *******************************************/
-FileLogAppender::FileLogAppender(const std::string &filename)
-  : filename_(kLogBasePath + filename) {
-  reopen();
+static void flushPendingRepeats();
+
+/**
+ * LogManager leaks its loggers, so buffered records and pending repeat
+ * summaries are only safe if somebody flushes them on the way out.
+ */
+static void installExitFlush() {
+  static std::once_flag s_exit_hook;
+  std::call_once(s_exit_hook, [] { std::atexit(&LogAppender::flushAll); });
 }
 
-void FileLogAppender::log(
-  LogEvent::ptr pLogEvent, std::shared_ptr<Logger> pLogger) {
-  if (pLogEvent->getLevel() >= level_) {
-    uint64_t now = pLogEvent->getTimestamp();
-    if (now >= (last_access_time_ + 3)) {
-      reopen();
-      last_access_time_ = now;
+void LogAppender::flushAll() {
+  // repeat summaries first, they have to go through the appenders too
+  flushPendingRepeats();
+  Mutex::lock locker(flushAppendersMutex());
+  for (auto *pAppender : flushAppenders()) {
+    pAppender->flush();
+  }
+}
+
+void LogAppender::registerFlush() {
+  installExitFlush();
+
+  Mutex::lock locker(flushAppendersMutex());
+  flushAppenders().push_back(this);
+}
+
+void LogAppender::unregisterFlush() {
+  Mutex::lock locker(flushAppendersMutex());
+  auto &appenders = flushAppenders();
+  appenders.erase(std::remove(appenders.begin(), appenders.end(), this),
+    appenders.end());
+}
+
+/******************************************* LogFileSink
+ * *********************************************/
+static int64_t nowMs() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+    std::chrono::system_clock::now().time_since_epoch())
+    .count();
+}
+
+static uint64_t fileSize(const std::string &filename) {
+  struct stat st;
+  if (::stat(filename.c_str(), &st) != 0) return 0;
+  return static_cast<uint64_t>(st.st_size);
+}
+
+/****************************************** LogArchiver
+ * *********************************************/
+namespace
+{
+struct ArchiveJob
+{
+  std::string basename;
+  std::string active;  // being written, neither it nor newer files are touched
+  LogFileOptions options;
+};
+
+struct ArchiveEntry
+{
+  std::string filename;
+  std::string day;
+  int index{0};
+  int64_t mtime{0};  // of the text file, compressing must not renew it
+};
+
+/* basename_YYYY-MM-DD_NN.log, optionally .gz */
+bool parseArchiveName(const std::string &filename,
+  const std::string &basename, ArchiveEntry &entry) {
+  if (!string_util::start_with(filename, basename + "_")) return false;
+  std::string rest = filename.substr(basename.size() + 1);
+  if (string_util::end_with(rest, ".log.gz"))
+    rest.resize(rest.size() - 7);
+  else if (string_util::end_with(rest, ".log"))
+    rest.resize(rest.size() - 4);
+  else
+    return false;
+
+  if (rest.size() < 12 || rest[4] != '-' || rest[7] != '-' || rest[10] != '_')
+    return false;
+  for (size_t i = 0; i < rest.size(); ++i) {
+    if (i != 4 && i != 7 && i != 10 && !std::isdigit((unsigned char) rest[i]))
+      return false;
+  }
+  entry.filename = filename;
+  entry.day = rest.substr(0, 10);
+  entry.index = std::atoi(rest.c_str() + 11);
+  return true;
+}
+
+void lowerArchiverPriority() {
+#if defined(__LINUX__)
+  // both apply to the calling thread only on Linux
+  ::setpriority(PRIO_PROCESS, 0, g_archiver_nice);
+# ifdef SYS_ioprio_set
+  const int who_process = 1, class_idle = 3, class_shift = 13;
+  ::syscall(SYS_ioprio_set, who_process, 0, class_idle << class_shift);
+# endif
+#elif defined(__WIN__)
+  // lowers the I/O priority as well
+  ::SetThreadPriority(::GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+#endif
+}
+
+/* filename.gz replaces filename, which is updated on success */
+bool compressRotated(std::string &filename) {
+  // renamed when complete, an exit halfway leaves the .log as it was
+  const std::string archived = filename + ".gz";
+  const std::string partial = archived + ".part";
+  if (!gzip_util::compress_file(filename, partial)
+      || !os_api::move(partial, archived)) {
+    std::cerr << "error in LogArchiver, " << filename
+              << " cannot be compressed" << std::endl;
+    return false;
+  }
+  os_api::unlink(filename);
+  filename = archived;
+  return true;
+}
+
+void archive(const ArchiveJob &job) {
+  ArchiveEntry active;
+  if (!parseArchiveName(job.active, job.basename, active)) return;
+
+  std::vector<ArchiveEntry> entries;
+  for (const auto &filename :
+    os_api::list_all_file(os_api::dirname(job.basename), "")) {
+    ArchiveEntry entry;
+    struct stat st;
+    if (!parseArchiveName(filename, job.basename, entry)
+        || std::tie(entry.day, entry.index)
+             >= std::tie(active.day, active.index)
+        || ::stat(filename.c_str(), &st) != 0) {
+      continue;
+    }
+    if (!string_util::end_with(filename, ".gz")
+        && os_api::exist_file(filename + ".gz")) {
+      // compressed, but the exit came before the unlink
+      os_api::unlink(filename);
+      continue;
     }
+    entry.mtime = static_cast<int64_t>(st.st_mtime);
+    entries.push_back(std::move(entry));
+  }
+  std::sort(entries.begin(), entries.end(),
+    [](const ArchiveEntry &lhs, const ArchiveEntry &rhs) {
+      return std::tie(lhs.day, lhs.index) < std::tie(rhs.day, rhs.index);
+    });
 
-    Mutex::lock locker(mutex_);
-    if (!formatter_->format(file_stream_, pLogEvent, pLogger)) {
-      std::cerr << "error in "
-                << "FileLogAppender::log "
-                << "with Formatter format" << std::endl;
-      std::cerr << "log file cannot be created" << std::endl;
+  const int64_t now = nowMs() / 1000;
+  const int64_t max_age = job.options.max_age_days * 24 * 3600;
+  uint64_t total = 0;
+  bool full = false;
+  auto remove = [](const std::string &filename) {
+    os_api::unlink(filename);
+    // left over if an exit interrupted its compression
+    if (!string_util::end_with(filename, ".gz"))
+      os_api::unlink(filename + ".gz.part");
+  };
+  // newest first: the size limit cuts off everything older, and files
+  // that are going to be deleted are not compressed first
+  for (auto it = entries.rbegin(); it != entries.rend(); ++it) {
+    if (full || (max_age > 0 && now - it->mtime > max_age)) {
+      remove(it->filename);
+      continue;
     }
-    else {
-      ++lines_;
-      if (lines_ >= g_max_file_line) {
-        ++cnt_;
-        lines_ = 0;
-      }
+    if (job.options.compress && !string_util::end_with(it->filename, ".gz"))
+      compressRotated(it->filename);
+
+    struct stat st;
+    if (::stat(it->filename.c_str(), &st) != 0) continue;
+    const auto size = static_cast<uint64_t>(st.st_size);
+    if (job.options.max_total_bytes > 0
+        && total + size > job.options.max_total_bytes) {
+      full = true;
+      remove(it->filename);
+      continue;
     }
+    total += size;
   }
 }
 
-bool FileLogAppender::reopen() {
-  Mutex::lock locker(mutex_);
-  if (file_stream_) {
-    file_stream_.close();
+/**
+ * Compresses and trims rotated files off the logging threads. Jobs of the
+ * same sink collapse into the latest, which covers everything before it.
+ */
+class LogArchiver
+{
+public:
+  static LogArchiver &instance() {
+    // leaked with the loggers, the thread may still be busy at exit
+    static auto *archiver = new LogArchiver();
+    return *archiver;
+  }
+
+  void submit(ArchiveJob job) {
+    {
+      Mutex::lock locker(mutex_);
+      auto it = std::find_if(jobs_.begin(), jobs_.end(),
+        [&job](const ArchiveJob &queued) {
+          return queued.basename == job.basename;
+        });
+      if (it != jobs_.end())
+        *it = std::move(job);
+      else
+        jobs_.push_back(std::move(job));
+      if (!started_) {
+        started_ = true;
+        std::thread(&LogArchiver::run, this).detach();
+      }
+    }
+    cond_.notify_one();
   }
 
-  // file_stream_.open(filename_, std::ios::app);
-  os_api::touch(getWholeFilename());
-  file_stream_.open(getWholeFilename(), std::ios::app);
-  return file_stream_.is_open();
+private:
+  void run() {
+    Thread::setCurrentName("LogArchiver");
+    lowerArchiverPriority();
+    while (true) {
+      ArchiveJob job;
+      {
+        Mutex::ulock locker(mutex_);
+        cond_.wait(locker, [this] { return !jobs_.empty(); });
+        job = std::move(jobs_.front());
+        jobs_.pop_front();
+      }
+      archive(job);
+    }
+  }
+
+private:
+  Mutex::type mutex_;
+  std::condition_variable cond_;
+  std::deque<ArchiveJob> jobs_;
+  bool started_{false};
+};
+}  // namespace
+
+LogFileSink::LogFileSink(const std::string &basename, LogFileOptions options)
+  : basename_(basename), options_(options) {
+  buffer_.reserve(options_.buffer_bytes);
 }
 
-YAML::Node FileLogAppender::toYaml() const {
-  YAML::Node node;
-  node["type"] = "SyncFileLogAppender";
-  node["filename"] = filename_;
-  node["lines"] = lines_;
-  node["count"] = static_cast<uint32_t>(cnt_);
-  node["today"] = today_;
+LogFileSink::~LogFileSink() {
+  flush();
+  if (file_) std::fclose(file_);
+}
 
-  node["level"] = level_.toString();
-  if (formatter_) {
-    node["formatter"] = formatter_->toYaml();
+void LogFileSink::append(const char *data, size_t size, int64_t timestamp) {
+  if (!file_ || timestamp >= day_end_
+      || (file_bytes_ > 0 && file_bytes_ + size > options_.max_bytes)) {
+    rotate(timestamp);
   }
 
-  return node;
+  if (buffer_.size() + size > options_.buffer_bytes) flush();
+  file_bytes_ += size;
+  if (size >= options_.buffer_bytes) {
+    write(data, size);
+    return;
+  }
+  if (buffer_.empty()) first_buffered_ = timestamp;
+  buffer_.append(data, size);
+}
+
+void LogFileSink::flushIfDue(int64_t now) {
+  if (!buffer_.empty() && now - first_buffered_ >= options_.flush_interval_ms)
+    flush();
+}
+
+void LogFileSink::flush() {
+  if (buffer_.empty()) return;
+  write(buffer_.data(), buffer_.size());
+  buffer_.clear();
 }
 
-std::string FileLogAppender::getWholeFilename() {
-  std::string wholeFilename;
-  time_t t =
-    std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+void LogFileSink::write(const char *data, size_t size) {
+  if (file_ && std::fwrite(data, 1, size, file_) == size) return;
+  if (!has_error_) {
+    has_error_ = true;
+    std::cerr << "error in LogFileSink::write, "
+              << "log file " << filename_ << " cannot be written"
+              << std::endl;
+  }
+}
+
+void LogFileSink::rotate(int64_t timestamp) {
+  flush();
+  if (file_) {
+    std::fclose(file_);
+    file_ = nullptr;
+  }
+
+  if (timestamp >= day_end_) {
+    time_t t = timestamp / 1000;
 #ifdef __WIN__
-  struct tm tm;
-  localtime_s(&tm, &t);
+    struct tm tm;
+    localtime_s(&tm, &t);
 #elif defined(__LINUX__)
-  struct tm tm;
-  localtime_r(&t, &tm);
+    struct tm tm;
+    localtime_r(&t, &tm);
 #else
-  struct tm tm = *localtime(&t);
+    struct tm tm = *localtime(&t);
 #endif
+    std::strftime(day_, sizeof(day_), "%Y-%m-%d", &tm);
+
+    struct tm next = tm;
+    next.tm_mday += 1;
+    next.tm_hour = next.tm_min = next.tm_sec = 0;
+    next.tm_isdst = -1;
+    day_end_ = static_cast<int64_t>(mktime(&next)) * 1000;
+    index_ = 0;
+  }
+  else {
+    ++index_;
+  }
+
+  // continue the last file of an earlier run if it still has room
+  filename_ = getWholeFilename(index_);
+  while ((file_bytes_ = fileSize(filename_)) >= options_.max_bytes
+         || os_api::exist_file(filename_ + ".gz")) {
+    filename_ = getWholeFilename(++index_);
+  }
 
-  char todayStr[30];
-  std::strftime(todayStr, 20, "%Y-%m-%d", &tm);
-  const int today = tm.tm_yday;
-  if (today != today_) {
-    today_ = today;
-    cnt_ = 0;
+  file_ = std::fopen(filename_.c_str(), "ab");
+  if (!file_ && os_api::mkdir(os_api::dirname(filename_))) {
+    file_ = std::fopen(filename_.c_str(), "ab");
+  }
+  if (file_) {
+    // buffer_ is the only buffer
+    std::setvbuf(file_, nullptr, _IONBF, 0);
+    has_error_ = false;
   }
-  wholeFilename.append(filename_);
-  wholeFilename.append("_");
-  wholeFilename.append(todayStr);
-  wholeFilename.append("_");
-  if (cnt_ < 10) wholeFilename.append("0");
-  wholeFilename.append(std::to_string(cnt_));
-  wholeFilename.append(".log");
 
-  return wholeFilename;
+  if (options_.compress || options_.max_total_bytes > 0
+      || options_.max_age_days > 0) {
+    LogArchiver::instance().submit({basename_, filename_, options_});
+  }
 }
 
-/*************************************** AsyncFileLogAppender
- * ***************************************/
-AsyncFileLogAppender::AsyncFileLogAppender(const std::string &filename)
-  : filename_(kLogBasePath + filename) {}
-void AsyncFileLogAppender::log(
-  LogEvent::ptr pLogEvent, std::shared_ptr<Logger> pLogger) {
-  if (pLogEvent->getLevel() >= level_) {
-    (void) std::async(std::launch::async, [&]() {
-      Mutex::lock locker(mutex_);
+std::string LogFileSink::getWholeFilename(int index) const {
+  return fmt::format("{}_{}_{:02d}.log", basename_, day_, index);
+}
 
-      int64_t now = pLogEvent->getTimestamp();
-      reopenNewFileIfShould(now);
-      if (!formatter_->format(file_stream_, pLogEvent, pLogger)) {
-        std::cerr << "error in "
-                  << "AsyncFileLogAppender::log"
-                  << " with Formatter format" << std::endl;
-        std::cerr << "log file cannot be created" << std::endl;
-      }
-      else {
-        lines_++;
-      }
-    });
-  }
+/***************************************** FileLogAppender
+ * *******************************************/
+FileLogAppender::FileLogAppender(
+  const std::string &filename, LogFileOptions options)
+  : sink_(kLogBasePath + filename, options) {
+  registerFlush();
 }
 
-YAML::Node AsyncFileLogAppender::toYaml() const {
+FileLogAppender::~FileLogAppender() {
+  unregisterFlush();
+}
+
+void FileLogAppender::log(const LogEvent::ptr &pLogEvent,
+  const std::shared_ptr<Logger> &pLogger) {
+  const LogLevel level = pLogEvent->getLevel();
+  if (level < level_) return;
+
+  auto &text = LogFormatter::threadBuffer();
+  text.clear();
+  formatter_->format(text, *pLogEvent, *pLogger);
+
+  Mutex::lock locker(mutex_);
+  const int64_t timestamp = pLogEvent->getTimestamp();
+  sink_.append(text.data(), text.size(), timestamp);
+  if (level >= LogLevel::LERROR)
+    sink_.flush();
+  else
+    sink_.flushIfDue(timestamp);
+}
+
+void FileLogAppender::flush() {
+  Mutex::lock locker(mutex_);
+  sink_.flush();
+}
+
+static void fileOptionsToYaml(YAML::Node &node, const LogFileOptions &options) {
+  node["max_bytes"] = options.max_bytes;
+  node["buffer_bytes"] = options.buffer_bytes;
+  node["flush_interval_ms"] = options.flush_interval_ms;
+  node["compress"] = options.compress;
+  node["max_total_bytes"] = options.max_total_bytes;
+  node["max_age_days"] = options.max_age_days;
+}
+static LogFileOptions fileOptionsFromYaml(const YAML::Node &node) {
+  LogFileOptions options;
+  if (node["max_bytes"].IsDefined())
+    options.max_bytes = node["max_bytes"].as<uint64_t>();
+  if (node["buffer_bytes"].IsDefined())
+    options.buffer_bytes = node["buffer_bytes"].as<size_t>();
+  if (node["flush_interval_ms"].IsDefined())
+    options.flush_interval_ms = node["flush_interval_ms"].as<int64_t>();
+  if (node["compress"].IsDefined())
+    options.compress = node["compress"].as<bool>();
+  if (node["max_total_bytes"].IsDefined())
+    options.max_total_bytes = node["max_total_bytes"].as<uint64_t>();
+  if (node["max_age_days"].IsDefined())
+    options.max_age_days = node["max_age_days"].as<int64_t>();
+  return options;
+}
+
+/* the name the appender was created with, without the log directory */
+static std::string logFilename(const std::string &basename) {
+  return string_util::start_with(basename, kLogBasePath)
+           ? basename.substr(kLogBasePath.size())
+           : basename;
+}
+
+YAML::Node FileLogAppender::toYaml() const {
   YAML::Node node;
-  node["type"] = "AsyncFileLogAppender";
-  node["filename"] = filename_;
-  node["lines"] = lines_;
-  node["count"] = static_cast<uint32_t>(cnt_);
-  node["today"] = today_;
+  node["type"] = "SyncFileLogAppender";
+  node["filename"] = logFilename(sink_.getBasename());
+  fileOptionsToYaml(node, sink_.getOptions());
 
   node["level"] = level_.toString();
   if (formatter_) {
@@ -449,69 +734,175 @@ YAML::Node AsyncFileLogAppender::toYaml() const {
   return node;
 }
 
-bool AsyncFileLogAppender::reopen(tm *tm) {
-  if (file_stream_) {
-    file_stream_.close();
+/*************************************** AsyncFileLogAppender
+ * ***************************************/
+static const char *overflowPolicyToString(LogOverflowPolicy policy) {
+  switch (policy) {
+  case LogOverflowPolicy::DROP: return "DROP";
+  case LogOverflowPolicy::DROP_BELOW_LEVEL: return "DROP_BELOW_LEVEL";
+  case LogOverflowPolicy::BLOCK:
+  default: return "BLOCK";
   }
+}
+static LogOverflowPolicy overflowPolicyFromString(const std::string &str) {
+  if (str == "DROP") return LogOverflowPolicy::DROP;
+  if (str == "DROP_BELOW_LEVEL") return LogOverflowPolicy::DROP_BELOW_LEVEL;
+  return LogOverflowPolicy::BLOCK;
+}
 
-  os_api::touch(getWholeFilename(tm));
-  file_stream_.open(getWholeFilename(tm), std::ios::app);
-  return file_stream_.is_open();
+AsyncFileLogAppender::AsyncFileLogAppender(
+  const std::string &filename, size_t capacity, LogFileOptions options)
+  : sink_(kLogBasePath + filename, options), ring_(capacity) {
+  registerFlush();
+  writer_ = std::thread([this] {
+    Thread::setCurrentName("AsyncLogWriter");
+    onWrite();
+  });
 }
 
-std::string AsyncFileLogAppender::getWholeFilename(tm *tm) const {
-  std::string wholeFilename;
+AsyncFileLogAppender::~AsyncFileLogAppender() {
+  unregisterFlush();
+  // the writer drains whatever is left before it returns
+  stop_.store(true, std::memory_order_release);
+  not_empty_.notifyOne();
+  if (writer_.joinable()) writer_.join();
+}
+
+void AsyncFileLogAppender::log(const LogEvent::ptr &pLogEvent,
+  const std::shared_ptr<Logger> &pLogger) {
+  const LogLevel level = pLogEvent->getLevel();
+  if (level < level_) return;
+
+  const int64_t timestamp = pLogEvent->getTimestamp();
+  auto &text = LogFormatter::threadBuffer();
+  text.clear();
+  formatter_->format(text, *pLogEvent, *pLogger);
+  auto fill = [&](Record &record) {
+    record.timestamp = timestamp;
+    record.text.assign(text.data(), text.size());
+  };
 
-  char todayStr[20];
-  std::strftime(todayStr, 20, "%Y-%m-%d", tm);
-  wholeFilename.append(filename_);
-  wholeFilename.append("_");
-  wholeFilename.append(todayStr);
-  wholeFilename.append("_");
-  if (cnt_ < 10) wholeFilename.append("0");
-  wholeFilename.append(std::to_string(cnt_));
-  wholeFilename.append(".log");
+  if (!ring_.tryEmplace(fill)) {
+    const auto policy = policy_.load(std::memory_order_relaxed);
+    if (policy == LogOverflowPolicy::DROP
+        || (policy == LogOverflowPolicy::DROP_BELOW_LEVEL
+            && level < keep_level_.load(std::memory_order_relaxed))) {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    while (true) {
+      auto key = not_full_.prepareWait();
+      if (ring_.tryEmplace(fill)) {
+        not_full_.cancelWait();
+        break;
+      }
+      not_empty_.notifyOne();
+      not_full_.wait(key, Futex::Timeout(g_async_block_wait_us));
+    }
+  }
+  // the writer polls on its own, wake it early only when the ring fills up
+  if (ring_.approxSize() >= ring_.capacity() / 2) not_empty_.notifyOne();
 
-  return wholeFilename;
+  if (level >= LogLevel::LFATAL) flush();
 }
 
-void AsyncFileLogAppender::reopenNewFileIfShould(int64_t timestamp) {
-  time_t t = timestamp / 1000;
-#ifdef __WIN__
-  struct tm tm;
-  localtime_s(&tm, &t);
-#elif defined(__LINUX__)
-  struct tm tm;
-  localtime_r(&t, &tm);
-#else
-  struct tm tm = *localtime(&t);
-#endif
+void AsyncFileLogAppender::flush() {
+  const size_t target = ring_.claimed();
+  while (written_.load(std::memory_order_acquire) < target) {
+    auto key = flushed_.prepareWait();
+    if (written_.load(std::memory_order_acquire) >= target) {
+      flushed_.cancelWait();
+      break;
+    }
+    flush_requested_.store(true, std::memory_order_release);
+    not_empty_.notifyOne();
+    flushed_.wait(key, Futex::Timeout(g_async_idle_wait_us));
+  }
+}
 
-  const int today = tm.tm_yday;
-  if (today != today_) {
-    today_ = today;
-    // switch to new file
-    cnt_ = 0;
-    lines_ = 0;
-    reopen(&tm);
-    return;
+void AsyncFileLogAppender::setOverflowPolicy(
+  LogOverflowPolicy policy, LogLevel keepLevel) {
+  policy_.store(policy, std::memory_order_relaxed);
+  keep_level_.store(keepLevel.level(), std::memory_order_relaxed);
+}
+
+void AsyncFileLogAppender::onWrite() {
+  size_t consumed = 0;
+  while (true) {
+    size_t n = 0;
+    while (n < g_async_batch_records
+           && ring_.tryConsume([this](Record &record) {
+                sink_.append(
+                  record.text.data(), record.text.size(), record.timestamp);
+              })) {
+      ++n;
+    }
+    consumed += n;
+    if (n > 0) not_full_.notifyAll();
+
+    const int64_t now = nowMs();
+    const uint64_t dropped = dropped_.load(std::memory_order_relaxed);
+    if (dropped != reported_dropped_) {
+      const std::string line = fmt::format(
+        "<<{} log records dropped>>\n", dropped - reported_dropped_);
+      sink_.append(line.data(), line.size(), now);
+      reported_dropped_ = dropped;
+    }
+
+    const bool stopping = stop_.load(std::memory_order_acquire);
+    if (flush_requested_.exchange(false, std::memory_order_acq_rel)
+        || stopping) {
+      sink_.flush();
+    }
+    else {
+      sink_.flushIfDue(now);
+    }
+    if (!sink_.isBuffered()
+        && written_.load(std::memory_order_relaxed) != consumed) {
+      written_.store(consumed, std::memory_order_release);
+      flushed_.notifyAll();
+    }
+
+    if (n == g_async_batch_records) continue;
+    if (stopping) {
+      // an empty head slot may only be one a producer is still filling,
+      // stop once every claimed slot has been consumed
+      if (ring_.consumed() == ring_.claimed()) break;
+      continue;
+    }
+    auto key = not_empty_.prepareWait();
+    if (ring_.approxSize() >= ring_.capacity() / 2
+        || flush_requested_.load(std::memory_order_acquire)
+        || stop_.load(std::memory_order_acquire)) {
+      not_empty_.cancelWait();
+      continue;
+    }
+    not_empty_.wait(key, Futex::Timeout(g_async_idle_wait_us));
   }
+  sink_.flush();
+}
 
-  if (lines_ >= g_max_file_line) {
-    // switch to new file
-    cnt_++;
-    lines_ = 0;
-    reopen(&tm);
-    return;
+YAML::Node AsyncFileLogAppender::toYaml() const {
+  YAML::Node node;
+  node["type"] = "AsyncFileLogAppender";
+  node["filename"] = logFilename(sink_.getBasename());
+  fileOptionsToYaml(node, sink_.getOptions());
+  node["capacity"] = ring_.capacity();
+  node["overflow"] = overflowPolicyToString(policy_);
+  node["keep_level"] = LogLevel(keep_level_).toString();
+
+  node["level"] = level_.toString();
+  if (formatter_) {
+    node["formatter"] = formatter_->toYaml();
   }
 
-  // donothing
+  return node;
 }
 
 /**************************************** StdoutLogAppender
  * *****************************************/
-void StdoutLogAppender::log(
-  LogEvent::ptr pLogEvent, std::shared_ptr<Logger> pLogger) {
+void StdoutLogAppender::log(const LogEvent::ptr &pLogEvent,
+  const std::shared_ptr<Logger> &pLogger) {
   if (pLogEvent->getLevel() >= level_) {
     Mutex::lock locker(mutex_);
 
@@ -552,58 +943,238 @@ YAML::Node StdoutLogAppender::toYaml() const {
 /********************************************** Logger
  * **********************************************/
 Logger::Logger(const std::string &name)
-  : name_(name), formatter_(new LogFormatter()) {}
+  : name_(name)
+  , appenders_(std::make_shared<AppenderList>())
+  , formatter_(new LogFormatter()) {}
 Logger::Logger(const std::string &name, LogLevel level, const std::string &pattern, uint8_t flags, const std::string &filename)
-  : name_(name), level_(level), formatter_(new LogFormatter(pattern)) {
+  : name_(name), level_(level.level()), formatter_(new LogFormatter(pattern)) {
+  auto pAppenders = std::make_shared<AppenderList>();
   if ((flags & LogIniterFlag::CONSOLE) == LogIniterFlag::CONSOLE) {
     auto pAppender = std::make_shared<StdoutLogAppender>();
     pAppender->setFormatter(formatter_);
-    appenders_.push_back(pAppender);
+    pAppenders->push_back(pAppender);
   }
   if ((flags & LogIniterFlag::ASYNC_FILE) == LogIniterFlag::ASYNC_FILE) {
     auto pAppender = std::make_shared<AsyncFileLogAppender>(filename);
     pAppender->setFormatter(formatter_);
-    appenders_.push_back(pAppender);
+    pAppenders->push_back(pAppender);
   }
   else if ((flags & LogIniterFlag::SYNC_FILE) == LogIniterFlag::SYNC_FILE) {
     auto pAppender = std::make_shared<FileLogAppender>(filename);
     pAppender->setFormatter(formatter_);
-    appenders_.push_back(pAppender);
+    pAppenders->push_back(pAppender);
   }
+  appenders_ = std::move(pAppenders);
 }
 
-void Logger::log(LogEvent::ptr pLogEvent) {
-  if (pLogEvent->getLevel() >= level_) {
-    auto self = shared_from_this();
-    Mutex::lock locker(mutex_);
-    if (!appenders_.empty()) {
-      for (auto &pAppender : appenders_) {
-        pAppender->log(pLogEvent, self);
+namespace
+{
+/**
+ * Writes the "last message repeated N times" lines whose window passed
+ * while their logger went quiet, no later event would bring them out.
+ */
+class RepeatFlusher
+{
+public:
+  static RepeatFlusher &instance() {
+    // leaked with the loggers, the thread may still be waiting at exit
+    static auto *flusher = new RepeatFlusher();
+    return *flusher;
+  }
+
+  void schedule(const Logger::ptr &pLogger, int64_t deadline) {
+    {
+      Mutex::lock locker(mutex_);
+      pending_.push_back({pLogger, deadline});
+      if (!started_) {
+        started_ = true;
+        installExitFlush();
+        std::thread(&RepeatFlusher::run, this).detach();
+      }
+    }
+    cond_.notify_one();
+  }
+
+  /* every pending summary, due or not */
+  void flushAll() {
+    std::vector<Pending> pending;
+    {
+      Mutex::lock locker(mutex_);
+      pending.swap(pending_);
+    }
+    for (auto &entry : pending) {
+      if (auto pLogger = entry.logger.lock()) pLogger->flushRepeats(true);
+    }
+  }
+
+private:
+  struct Pending
+  {
+    std::weak_ptr<Logger> logger;
+    int64_t deadline;
+  };
+
+  void run() {
+    Thread::setCurrentName("LogRepeatFlusher");
+    std::vector<Pending> due;
+    while (true) {
+      {
+        Mutex::ulock locker(mutex_);
+        while (due.empty()) {
+          const int64_t now = nowMs();
+          auto it = std::partition(pending_.begin(), pending_.end(),
+            [now](const Pending &entry) { return entry.deadline > now; });
+          due.assign(std::make_move_iterator(it),
+            std::make_move_iterator(pending_.end()));
+          pending_.erase(it, pending_.end());
+          if (!due.empty()) break;
+          if (pending_.empty()) {
+            cond_.wait(locker);
+            continue;
+          }
+          int64_t next = pending_.front().deadline;
+          for (auto &entry : pending_) next = std::min(next, entry.deadline);
+          cond_.wait_for(locker, std::chrono::milliseconds(next - now));
+        }
       }
+      // the logger's lock is taken without ours, dispatch() nests them
+      // the other way round
+      for (auto &entry : due) {
+        if (auto pLogger = entry.logger.lock()) pLogger->flushRepeats(false);
+      }
+      due.clear();
+    }
+  }
+
+private:
+  Mutex::type mutex_;
+  std::condition_variable cond_;
+  std::vector<Pending> pending_;
+  bool started_{false};
+};
+}  // namespace
+
+static void flushPendingRepeats() {
+  RepeatFlusher::instance().flushAll();
+}
+
+Logger::~Logger() {
+  // nobody owns *this any more, but the appenders only format through it
+  if (repeats_) writeRepeats(Logger::ptr(this, [](Logger *) {}));
+}
+
+void Logger::log(LogEvent::ptr pLogEvent) {
+  if (!isEnabled(pLogEvent->getLevel().level())) return;
+  // one handle per event, the appenders below all borrow it
+  dispatch(pLogEvent, shared_from_this());
+}
+
+void Logger::dispatch(const LogEvent::ptr &pLogEvent, const Logger::ptr &self) {
+  const uint32_t window = collapse_ms_.load(std::memory_order_relaxed);
+  if (!window) {
+    write(pLogEvent, self);
+    return;
+  }
+
+  // holds the lock through the write, a summary must precede what ended it
+  Mutex::lock locker(mutex_);
+  if (last_event_ && isRepeatOf(*pLogEvent, *last_event_)
+      && pLogEvent->getTimestamp() - last_event_->getTimestamp() < window) {
+    if (repeats_++ == 0) {
+      // written by the next different event, or by the flusher if none
+      // comes before the window is over
+      repeats_deadline_ = last_event_->getTimestamp() + window;
+      RepeatFlusher::instance().schedule(self, repeats_deadline_);
     }
-    else if (parent_)
-      parent_->log(pLogEvent);
+    return;
+  }
+  writeRepeats(self);
+  last_event_ = pLogEvent;
+  write(pLogEvent, self);
+}
+
+void Logger::setRepeatCollapse(uint32_t windowMs) {
+  Mutex::lock locker(mutex_);
+  collapse_ms_.store(windowMs, std::memory_order_relaxed);
+  if (!windowMs) {
+    writeRepeats(shared_from_this());
+    last_event_.reset();
   }
 }
 
+void Logger::flushRepeats(bool force) {
+  Mutex::lock locker(mutex_);
+  if (!repeats_ || (!force && nowMs() < repeats_deadline_)) return;
+  writeRepeats(shared_from_this());
+}
+
+bool Logger::isRepeatOf(const LogEvent &event, const LogEvent &last) {
+  return event.getLevel().level() == last.getLevel().level()
+         && event.getLine() == last.getLine()
+         && event.getFilename() == last.getFilename()
+         && event.getContent() == last.getContent();
+}
+
+void Logger::writeRepeats(const Logger::ptr &self) {
+  if (!repeats_) return;
+  auto pEvent = std::make_shared<LogEvent>(last_event_->getLevel(),
+    last_event_->getThreadId(), last_event_->getFilename(),
+    last_event_->getLine(), last_event_->getFunctionName(),
+    std::chrono::duration_cast<std::chrono::milliseconds>(
+      std::chrono::system_clock::now().time_since_epoch())
+      .count());
+  pEvent->format("last message repeated {} times", repeats_);
+  repeats_ = 0;
+  write(pEvent, self);
+}
+
+void Logger::write(const LogEvent::ptr &pLogEvent, const Logger::ptr &self) {
+  const auto pAppenders = std::atomic_load(&appenders_);
+  if (!pAppenders->empty()) {
+    for (const auto &pAppender : *pAppenders) {
+      pAppender->log(pLogEvent, self);
+    }
+  }
+  else if (auto pParent = getParent())
+    pParent->log(pLogEvent);
+}
+
 void Logger::addAppender(LogAppender::ptr pAppender) {
   Mutex::lock locker(mutex_);
 
   if (!pAppender->getFormatter()) {
     pAppender->setFormatter(formatter_);
   }
-  appenders_.push_back(pAppender);
+  auto pAppenders = std::make_shared<AppenderList>(*appenders_);
+  pAppenders->push_back(pAppender);
+  std::atomic_store(
+    &appenders_, std::shared_ptr<const AppenderList>(pAppenders));
 }
 void Logger::removeAppender(LogAppender::ptr pAppender) {
   Mutex::lock locker(mutex_);
-  auto it = std::find(appenders_.begin(), appenders_.end(), pAppender);
-  if (it != appenders_.end()) {
-    appenders_.erase(it);
+  auto it = std::find(appenders_->begin(), appenders_->end(), pAppender);
+  if (it != appenders_->end()) {
+    auto pAppenders = std::make_shared<AppenderList>(*appenders_);
+    pAppenders->erase(pAppenders->begin() + (it - appenders_->begin()));
+    std::atomic_store(
+      &appenders_, std::shared_ptr<const AppenderList>(pAppenders));
   }
 }
 void Logger::clearAppenders() {
   Mutex::lock locker(mutex_);
-  appenders_.clear();
+  std::atomic_store(
+    &appenders_, std::shared_ptr<const AppenderList>(
+                   std::make_shared<AppenderList>()));
+}
+std::shared_ptr<const Logger::AppenderList> Logger::getAppenders() const {
+  return std::atomic_load(&appenders_);
+}
+
+Logger::ptr Logger::getParent() const {
+  return std::atomic_load(&parent_);
+}
+void Logger::setParent(Logger::ptr pLogger) {
+  std::atomic_store(&parent_, pLogger);
 }
 
 void Logger::setFormatter(LogFormatter::ptr pFormatter) {
@@ -623,14 +1194,14 @@ YAML::Node Logger::toYaml() const {
   YAML::Node node;
 
   node["name"] = this->name_;
-  node["level"] = this->level_.toString();
-  if (!appenders_.empty()) {
-    for (const auto &appender : appenders_) {
-      node["appenders"].push_back(appender->toYaml());
-    }
+  node["level"] = getLevel().toString();
+  for (const auto &appender : *getAppenders()) {
+    node["appenders"].push_back(appender->toYaml());
   }
-  node["formatter"] = formatter_->toYaml();
-  node["parent"] = parent_ ? parent_->getName() : "root";
+  node["formatter"] = getFormatter()->toYaml();
+  auto pParent = getParent();
+  node["parent"] = pParent ? pParent->getName() : "root";
+  if (getRepeatCollapse()) node["collapse_repeats_ms"] = getRepeatCollapse();
 
   return node;
 }
@@ -641,6 +1212,35 @@ YAML::Node Logger::toYaml() const {
 LogEventWrapper::LogEventWrapper(LogEvent::ptr pEvent, Logger::ptr pLogger)
   : event_(pEvent), logger_(pLogger) {}
 
+LogEventWrapper::~LogEventWrapper() {
+  if (suppressed_) {
+    event_->format(" ({} similar suppressed)", suppressed_);
+  }
+  logger_->log(event_);
+
+  const LogLevel level = event_->getLevel();
+  if (level >= LogLevel::LERROR && FlightRecorder::isEnabled()) {
+    FlightRecorder::onError(level);
+  }
+}
+
+/********************************************* LogSite
+ * *********************************************/
+bool LogSite::everyMs(int64_t periodMs) {
+  const int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+    std::chrono::steady_clock::now().time_since_epoch())
+                        .count();
+  int64_t next = next_ms_.load(std::memory_order_relaxed);
+  if (now < next
+      || !next_ms_.compare_exchange_strong(
+        next, now + periodMs, std::memory_order_relaxed)) {
+    skipped_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  s_last_skipped = skipped_.exchange(0, std::memory_order_relaxed);
+  return true;
+}
+
 /******************************************** LogManager
  * ********************************************/
 LogManager::LogManager() {
@@ -649,46 +1249,63 @@ LogManager::LogManager() {
   // pAppender->setFormatter(root_->getFormatter());
   root_->addAppender(pAppender);
 
-  loggers_[root_->getName()] = root_;
+  auto pLoggers = std::make_shared<LoggerMap>();
+  (*pLoggers)[root_->getName()] = root_;
+  loggers_ = std::move(pLoggers);
 
   init();
 }
 
 Logger::ptr LogManager::getLogger(const std::string &name) {
+  if (auto pLogger = getLogger2(name)) return pLogger;
+
   Mutex::lock locker(mutex_);
-  auto it = loggers_.find(name);
-  if (it != loggers_.end()) {
+  // someone may have added it since the lookup above
+  auto it = loggers_->find(name);
+  if (it != loggers_->end()) {
     return it->second;
   }
 
   auto pLogger = std::make_shared<Logger>(name, LogLevel::LDEBUG);
   pLogger->setParent(root_);
-  loggers_[name] = pLogger;
+  publish(name, pLogger);
   return pLogger;
 }
 Logger::ptr LogManager::getLogger2(const std::string &name) {
-  Mutex::lock locker(mutex_);
-  auto it = loggers_.find(name);
-  if (it != loggers_.end()) {
+  const auto pLoggers = std::atomic_load(&loggers_);
+  auto it = pLoggers->find(name);
+  if (it != pLoggers->end()) {
     return it->second;
   }
   return nullptr;
 }
 bool LogManager::putLogger(Logger::ptr pLogger) {
-  if (auto it = loggers_.find(pLogger->getName()); it != loggers_.end()) {
+  Mutex::lock locker(mutex_);
+  if (auto it = loggers_->find(pLogger->getName()); it != loggers_->end()) {
     return false;
   }
-  loggers_[pLogger->getName()] = pLogger;
+  publish(pLogger->getName(), pLogger);
   return true;
 }
 void LogManager::insert(Logger::ptr pLogger) {
-  loggers_[pLogger->getName()] = pLogger;
+  Mutex::lock locker(mutex_);
+  publish(pLogger->getName(), pLogger);
+}
+
+void LogManager::publish(const std::string &name, Logger::ptr pLogger) {
+  auto pLoggers = std::make_shared<LoggerMap>(*loggers_);
+  (*pLoggers)[name] = std::move(pLogger);
+  std::atomic_store(&loggers_, std::shared_ptr<const LoggerMap>(pLoggers));
+}
+
+std::string LogManager::dumpFlightRecorder(const std::string &filename) {
+  return FlightRecorder::dump(filename);
 }
 
 std::string LogManager::toYamlString() const {
   YAML::Node node;
 
-  for (auto &[k, v] : loggers_) {
+  for (auto &[k, v] : *std::atomic_load(&loggers_)) {
     node["logger"].push_back(v->toYaml());
   }
 
@@ -699,7 +1316,7 @@ void LogManager::toYamlFile(std::string_view filename) const {
   os_api::rm(std::string{filename});
 
   YAML::Node node;
-  for (auto &[k, v] : loggers_) {
+  for (auto &[k, v] : *std::atomic_load(&loggers_)) {
     node["logger"].push_back(v->toYaml());
   }
   std::ofstream{filename.data()} << node;
@@ -778,65 +1395,84 @@ void LogIniter::loadYamlFile(const std::string &filename) {
   loadYamlNode(node);
 }
 
+/* nullptr for a type it does not know */
+static LogAppender::ptr appenderFromYaml(const YAML::Node &node) {
+  const auto type = node["type"].as<std::string>();
+  LogAppender::ptr pAppender;
+  if (type == "StdoutLogAppender") {
+    pAppender = std::make_shared<StdoutLogAppender>();
+  }
+  else if (type == "SyncFileLogAppender") {
+    pAppender = std::make_shared<FileLogAppender>(
+      node["filename"].as<std::string>(), fileOptionsFromYaml(node));
+  }
+  else if (type == "AsyncFileLogAppender") {
+    auto pAsync = std::make_shared<AsyncFileLogAppender>(
+      node["filename"].as<std::string>(),
+      node["capacity"].IsDefined() ? node["capacity"].as<size_t>()
+                                   : AsyncFileLogAppender::kDefaultCapacity,
+      fileOptionsFromYaml(node));
+    if (node["overflow"].IsDefined()) {
+      pAsync->setOverflowPolicy(
+        overflowPolicyFromString(node["overflow"].as<std::string>()),
+        node["keep_level"].IsDefined()
+          ? LogLevel::fromString(node["keep_level"].as<std::string>())
+          : LogLevel(LogLevel::LWARN));
+    }
+    pAppender = pAsync;
+  }
+  else {
+    return nullptr;
+  }
+
+  if (node["level"].IsDefined())
+    pAppender->setLevel(LogLevel::fromString(node["level"].as<std::string>()));
+  if (node["formatter"].IsDefined() && !node["formatter"].IsNull()) {
+    pAppender->setFormatter(std::make_shared<LogFormatter>(
+      node["formatter"]["pattern"].as<std::string>()));
+  }
+  return pAppender;
+}
+
 void LogIniter::loadYamlNode(YAML::Node node) {
+  // by name, so parents come before their children
   auto compare = [](const YAML::Node &lhs, const YAML::Node &rhs) {
-    return lhs["name"].as<std::string>() < lhs["name"].as<std::string>();
+    return lhs["name"].as<std::string>() < rhs["name"].as<std::string>();
   };
 
   std::set<YAML::Node, decltype(compare)> loggers(
     node["logger"].begin(), node["logger"].end(), compare);
 
   for (auto it = loggers.begin(); it != loggers.end(); ++it) {
-    YAML::Node cur = *it;
-    // parse logger
-    auto pLogger = std::make_shared<Logger>(cur["name"].as<std::string>(),
-      LogLevel::fromString(cur["level"].as<std::string>()),
-      cur["formatter"]["pattern"].as<std::string>());
-
-    if (!cur["appenders"].IsDefined() || node.IsNull()) {
-      continue;
+    const YAML::Node &cur = *it;
+    const auto name = cur["name"].as<std::string>();
+    // reconfigured in place, the handles logging sites hold stay valid
+    auto pLogger = LogManager::instance()->getLogger2(name);
+    if (pLogger) {
+      pLogger->clearAppenders();
     }
-
-    for (auto appender : node["appenders"]) {
-      auto app_node = YAML::Load(appender.as<std::string>());
-      auto &&app_type = app_node["type"].as<std::string>();
-      if (app_type == "StdoutLogAppender") {
-        auto pAppender = std::make_shared<StdoutLogAppender>();
-        pAppender->setLevel(
-          LogLevel::fromString(app_node["level"].as<std::string>()));
-        if (app_node["formatter"].IsDefined()
-            && !app_node["formatter"].IsNull()) {
-          pAppender->setFormatter(std::make_shared<LogFormatter>(
-            app_node["formatter"]["pattern"].as<std::string>()));
-        }
-        pLogger->addAppender(pAppender);
-      }
-      else if (app_type == "SyncFileLogAppender") {
-        auto pAppender = std::make_shared<FileLogAppender>(
-          app_node["filename"].as<std::string>());
-        pAppender->setLevel(
-          LogLevel::fromString(app_node["level"].as<std::string>()));
-        if (app_node["formatter"].IsDefined()
-            && !app_node["formatter"].IsNull()) {
-          pAppender->setFormatter(std::make_shared<LogFormatter>(
-            app_node["formatter"]["pattern"].as<std::string>()));
-        }
-        pLogger->addAppender(pAppender);
-      }
-      else if (app_type == "AsyncFileLogAppender") {
-        auto pAppender = std::make_shared<AsyncFileLogAppender>(
-          app_node["filename"].as<std::string>());
-        pAppender->setLevel(
-          LogLevel::fromString(app_node["level"].as<std::string>()));
-        if (app_node["formatter"].IsDefined()
-            && !app_node["formatter"].IsNull()) {
-          pAppender->setFormatter(std::make_shared<LogFormatter>(
-            app_node["formatter"]["pattern"].as<std::string>()));
-        }
-        pLogger->addAppender(pAppender);
+    else {
+      pLogger = std::make_shared<Logger>(name);
+    }
+    if (cur["level"].IsDefined())
+      pLogger->setLevel(LogLevel::fromString(cur["level"].as<std::string>()));
+    if (cur["formatter"].IsDefined() && !cur["formatter"].IsNull())
+      pLogger->setFormatter(cur["formatter"]["pattern"].as<std::string>());
+    pLogger->setRepeatCollapse(cur["collapse_repeats_ms"].IsDefined()
+                                 ? cur["collapse_repeats_ms"].as<uint32_t>()
+                                 : 0);
+
+    if (cur["appenders"].IsDefined() && !cur["appenders"].IsNull()) {
+      for (const auto &appender : cur["appenders"]) {
+        if (auto pAppender = appenderFromYaml(appender))
+          pLogger->addAppender(pAppender);
       }
-      pLogger->setParent(GET_LOGGER(cur["parent"].as<std::string>()));
     }
-    LogManager::instance()->putLogger(pLogger);
+    // root is written with itself as the parent
+    if (cur["parent"].IsDefined()) {
+      const auto parent = cur["parent"].as<std::string>();
+      if (parent != name) pLogger->setParent(GET_LOGGER(parent));
+    }
+    LogManager::instance()->insert(pLogger);
   }
 }
@@ -6,6 +6,8 @@ Converter::~Converter() {
   if (sws_context_) {
     sws_freeContext(sws_context_);
   }
+  // outstanding buffers keep the pool alive until they are released
+  av_buffer_pool_uninit(&pool_);
 }
 
 Converter::ptr Converter::create() {
@@ -13,7 +15,7 @@ Converter::ptr Converter::create() {
 }
 
 bool Converter::init(Converter::Info in, Converter::Info out) {
-  if (!isDirty(out) && !sws_context_) {
+  if (!isDirty(in, out) && sws_context_) {
     return true;
   }
 
@@ -24,18 +26,94 @@ bool Converter::init(Converter::Info in, Converter::Info out) {
     out.height, out.format, SWS_BICUBIC, nullptr, nullptr, nullptr);
 
   if (!sws_context_) return false;
+  if (!initPool(out)) {
+    sws_freeContext(sws_context_);
+    sws_context_ = nullptr;
+    return false;
+  }
+  last_in_ = in;
+  last_out_ = out;
   return true;
 }
 
-bool Converter::isDirty(Converter::Info &out) const {
-  return last_.format != out.format || last_.height != out.height
-         || last_.width != out.width;
+bool Converter::isDirty(const Converter::Info &in,
+  const Converter::Info &out) const {
+  return last_in_.format != in.format || last_in_.height != in.height
+         || last_in_.width != in.width || last_out_.format != out.format
+         || last_out_.height != out.height || last_out_.width != out.width;
+}
+
+bool Converter::initPool(const Converter::Info &out) {
+  if (pool_ && last_out_.format == out.format
+      && last_out_.width == out.width && last_out_.height == out.height)
+    return true;
+
+  av_buffer_pool_uninit(&pool_);
+  pool_size_ = 0;
+
+  int r = av_image_fill_linesizes(pool_linesize_, out.format, out.width);
+  if (r < 0) return false;
+  for (auto &linesize : pool_linesize_) linesize = FFALIGN(linesize, kAlign);
+
+  ptrdiff_t linesizes[4];
+  size_t sizes[4];
+  for (int i = 0; i < 4; ++i) linesizes[i] = pool_linesize_[i];
+  r = av_image_fill_plane_sizes(sizes, out.format, out.height, linesizes);
+  if (r < 0) return false;
+
+  // every plane starts on its own aligned boundary
+  size_t total = 0;
+  for (int i = 0; i < 4; ++i) {
+    pool_plane_size_[i] = FFALIGN(sizes[i], kAlign);
+    total += pool_plane_size_[i];
+  }
+  // slack to realign the base pointer
+  total += kAlign - 1;
+
+  pool_size_ = total;
+  pool_ = av_buffer_pool_init(pool_size_, nullptr);
+  return pool_ != nullptr;
 }
+
+int Converter::getBuffer(AVFrame *pFrame) {
+  AVBufferRef *pBuf = av_buffer_pool_get(pool_);
+  if (!pBuf) return AVERROR(ENOMEM);
+
+  av_frame_unref(pFrame);
+  pFrame->buf[0] = pBuf;
+  pFrame->width = last_out_.width;
+  pFrame->height = last_out_.height;
+  pFrame->format = last_out_.format;
+
+  uint8_t *p = (uint8_t *) FFALIGN((uintptr_t) pBuf->data, kAlign);
+  for (int i = 0; i < 4; ++i) {
+    pFrame->data[i] = pool_plane_size_[i] ? p : nullptr;
+    pFrame->linesize[i] = pool_linesize_[i];
+    p += pool_plane_size_[i];
+  }
+  pFrame->extended_data = pFrame->data;
+  return 0;
+}
+
 int Converter::run(AVFramePtr pInFrame, AVFramePtr pOutFrame) {
-  int r = av_image_alloc(pOutFrame->data, pOutFrame->linesize, pOutFrame->width,
-    pOutFrame->height, (AVPixelFormat)pOutFrame->format, 32);
+  if (!sws_context_ || !pool_) return AVERROR(EINVAL);
+
+  int r = getBuffer(pOutFrame.get());
   if (r < 0) return r;
 
+  pOutFrame->pts = pInFrame->pts;
+  pOutFrame->pkt_dts = pInFrame->pkt_dts;
+  pOutFrame->duration = pInFrame->duration;
+  pOutFrame->time_base = pInFrame->time_base;
+  pOutFrame->sample_aspect_ratio = pInFrame->sample_aspect_ratio;
+  pOutFrame->opaque = pInFrame->opaque;
+
   return sws_scale(sws_context_, pInFrame->data, pInFrame->linesize, 0,
            pInFrame->height, pOutFrame->data, pOutFrame->linesize);
 }
+int Converter::run(
+  AVFramePtr pInFrame, uint8_t *const dst[4], const int dstStride[4]) {
+  if (!sws_context_) return AVERROR(EINVAL);
+  return sws_scale(sws_context_, pInFrame->data, pInFrame->linesize, 0,
+    pInFrame->height, dst, dstStride);
+}
@@ -2,10 +2,9 @@
 
 Resampler::Resampler() : Filter() {}
 Resampler::~Resampler() {
-  if (swr_context_ && swr_is_initialized(swr_context_)) {
-    swr_free(&swr_context_);
-    swr_context_ = nullptr;
-  }
+  swr_free(&swr_context_);
+  av_channel_layout_uninit(&out_layout_);
+  av_buffer_pool_uninit(&pool_);
 }
 
 Resampler::ptr Resampler::create() {
@@ -13,61 +12,137 @@ Resampler::ptr Resampler::create() {
 }
 
 bool Resampler::init(Info in, Info out) {
-  if (!isDirty(out) && !swr_context_) {
+  if (!isDirty(in, out) && (swr_context_ || passthrough_)) {
     return true;
   }
 
-  if (swr_context_ && swr_is_initialized(swr_context_)) {
-    swr_free(&swr_context_);
-    swr_context_ = nullptr;
-  }
+  swr_free(&swr_context_);
+  passthrough_ = false;
 
-  int r{-1};
   AVChannelLayout inChannelLayout{};
-  inChannelLayout.nb_channels = in.channels;
   AVChannelLayout outChannelLayout{};
-  outChannelLayout.nb_channels = out.channels;
-  r = swr_alloc_set_opts2(&swr_context_, &outChannelLayout, out.format,
+  if (!fillLayout(inChannelLayout, in) || !fillLayout(outChannelLayout, out))
+    return false;
+
+  av_channel_layout_uninit(&out_layout_);
+  av_channel_layout_copy(&out_layout_, &outChannelLayout);
+  last_in_ = in;
+  last_out_ = out;
+
+  if (in.sample_rate == out.sample_rate && in.format == out.format
+      && !av_channel_layout_compare(&inChannelLayout, &outChannelLayout)) {
+    passthrough_ = true;
+    return true;
+  }
+
+  int r = swr_alloc_set_opts2(&swr_context_, &outChannelLayout, out.format,
     out.sample_rate, &inChannelLayout, in.format, in.sample_rate, 0, nullptr);
-  if (!swr_context_ || r < 0) return false;
+  if (!swr_context_ || r < 0) {
+    swr_free(&swr_context_);
+    last_in_.format = last_out_.format = AV_SAMPLE_FMT_NONE;
+    return false;
+  }
 
   r = swr_init(swr_context_);
   if (r < 0) {
     swr_free(&swr_context_);
-    swr_context_ = nullptr;
+    last_in_.format = last_out_.format = AV_SAMPLE_FMT_NONE;
     return false;
   }
-  last_ = out;
   return true;
 }
 
 int Resampler::run(AVFramePtr pInFrame, AVFramePtr pOutFrame) {
-  int64_t outCount = (int64_t) pInFrame->nb_samples * pOutFrame->sample_rate
-                       / pInFrame->sample_rate
-                     + 256;
-  int outSize =
-    av_samples_get_buffer_size(nullptr, pOutFrame->ch_layout.nb_channels,
-      outCount, (AVSampleFormat) pOutFrame->format, 1);
-  if (outSize < 0) return -1;
-
-  uint32_t size = 48000 * 4 * 1;
-  pOutFrame->extended_data[0] = (uint8_t*)av_malloc(size);
-  av_fast_malloc(&pOutFrame->extended_data[0], &size, outSize);
-  if (!pOutFrame->extended_data[0]) return false;
-
-  int len = swr_convert(swr_context_, &pOutFrame->extended_data[0], outCount,
+  if (passthrough_) {
+    av_frame_unref(pOutFrame.get());
+    if (av_frame_ref(pOutFrame.get(), pInFrame.get()) < 0) return -1;
+    return av_samples_get_buffer_size(nullptr, last_out_.channels,
+      pOutFrame->nb_samples, last_out_.format, 1);
+  }
+  if (!swr_context_) return -1;
+
+  // room for what swr still holds from earlier calls as well
+  int64_t delay = swr_get_delay(swr_context_, last_in_.sample_rate);
+  int outCount = (int) av_rescale_rnd(delay + pInFrame->nb_samples,
+    last_out_.sample_rate, last_in_.sample_rate, AV_ROUND_UP);
+  if (!getBuffer(pOutFrame.get(), outCount)) return -1;
+
+  int len = swr_convert(swr_context_, pOutFrame->extended_data, outCount,
     (const uint8_t **) pInFrame->extended_data, pInFrame->nb_samples);
+  if (len < 0) {
+    av_frame_unref(pOutFrame.get());
+    return -1;
+  }
+  pOutFrame->nb_samples = len;
+  if (pInFrame->pts != AV_NOPTS_VALUE) {
+    pOutFrame->pts = pInFrame->pts;
+    pOutFrame->time_base = pInFrame->time_base;
+  }
+  pOutFrame->opaque = pInFrame->opaque;
+
+  return av_samples_get_buffer_size(
+    nullptr, last_out_.channels, len, last_out_.format, 1);
+}
+
+void Resampler::reset() {
+  // re-initializing an existing context clears its internal buffers
+  if (swr_context_) swr_init(swr_context_);
+}
+
+bool Resampler::isDirty(const Info &in, const Info &out) const {
+  return last_in_.channels != in.channels || last_in_.format != in.format
+         || last_in_.sample_rate != in.sample_rate
+         || last_in_.channel_mask != in.channel_mask
+         || last_out_.channels != out.channels || last_out_.format != out.format
+         || last_out_.sample_rate != out.sample_rate
+         || last_out_.channel_mask != out.channel_mask;
+}
+
+bool Resampler::getBuffer(AVFrame *pFrame, int nbSamples) {
+  const int channels = last_out_.channels;
+  const bool planar = av_sample_fmt_is_planar(last_out_.format);
+  if (planar && channels > AV_NUM_DATA_POINTERS) return false;
 
-  if (len <= 0 || len == outCount) {
-    av_freep(pOutFrame->extended_data);
-    return 0;
+  int linesize;
+  int size = av_samples_get_buffer_size(
+    &linesize, channels, nbSamples, last_out_.format, 0);
+  if (size < 0) return false;
+
+  // grow-only, outstanding buffers keep the old pool alive
+  if (!pool_ || (size_t) size > pool_size_) {
+    av_buffer_pool_uninit(&pool_);
+    pool_size_ = FFMAX((size_t) size, pool_size_ * 3 / 2);
+    pool_ = av_buffer_pool_init(pool_size_, nullptr);
+    if (!pool_) {
+      pool_size_ = 0;
+      return false;
+    }
   }
 
-  return len * pOutFrame->ch_layout.nb_channels
-         * av_get_bytes_per_sample((AVSampleFormat) pOutFrame->format);
+  AVBufferRef *pBuf = av_buffer_pool_get(pool_);
+  if (!pBuf) return false;
+
+  av_frame_unref(pFrame);
+  pFrame->buf[0] = pBuf;
+  pFrame->format = last_out_.format;
+  pFrame->sample_rate = last_out_.sample_rate;
+  pFrame->nb_samples = nbSamples;
+  av_channel_layout_copy(&pFrame->ch_layout, &out_layout_);
+  if (av_samples_fill_arrays(pFrame->data, pFrame->linesize, pBuf->data,
+        channels, nbSamples, last_out_.format, 0) < 0) {
+    av_frame_unref(pFrame);
+    return false;
+  }
+  pFrame->extended_data = pFrame->data;
+  return true;
 }
 
-bool Resampler::isDirty(Info &out) const {
-  return last_.channels != out.channels || last_.format != out.format
-         || last_.sample_rate != out.sample_rate;
-}
\ No newline at end of file
+bool Resampler::fillLayout(AVChannelLayout &layout, const Info &info) {
+  if (info.channels <= 0) return false;
+  if (info.channel_mask != 0
+      && av_popcount64(info.channel_mask) == info.channels) {
+    return av_channel_layout_from_mask(&layout, info.channel_mask) == 0;
+  }
+  av_channel_layout_default(&layout, info.channels);
+  return true;
+}
@@ -1,4 +1,5 @@
 ﻿#include "multimedia/common/AudioBuffer.hpp"
+#include "multimedia/common/BinaryLog.hpp"
 #include "multimedia/common/Logger.hpp"
 #include "multimedia/common/Math.hpp"
 #include "multimedia/common/Time.hpp"
@@ -11,8 +12,31 @@
 #define SDL_AUDIO_MIN_BUFFER_SIZE       512
 #define SDL_AUDIO_MAX_CALLBACKS_PER_SEC 30
 
+// queue limits, see AVQueueLimits
+#define MAX_PACKET_QUEUE_BYTES          (16 * 1024 * 1024)
+#define MIN_PACKET_QUEUE_ITEMS          25
+#define MAX_PACKET_QUEUE_ITEMS          4096
+#define MAX_VIDEO_FRAME_QUEUE_BYTES     (64 * 1024 * 1024)
+#define MIN_VIDEO_FRAME_QUEUE_ITEMS     3
+#define MAX_VIDEO_FRAME_QUEUE_ITEMS     16
+// decoded PCM waiting for the device, see AudioBuffer
+#define AUDIO_RING_DURATION_MS          500
+
+// upper bound for a blocked thread to notice abort/seek/pause
+#define QUEUE_WAIT_TIMEOUT_US           100000
+// the native display loop still has to pump SDL events while idle
+#define EVENT_POLL_TIMEOUT_US           10000
+// per-packet/per-frame warnings are sampled to one line per interval
+#define HOT_LOG_INTERVAL_MS             1000
+
 static auto g_FFmpegPlayerLogger = GET_LOGGER3("multimedia.FFmpegPlayer");
 
+static int64_t steadyMicros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+    TimeUtil::now().time_since_epoch())
+    .count();
+}
+
 #define FFMPEG_LOG_ERROR(fmt, ...)                              \
   do {                                                          \
     if (config_.enable_log)                                     \
@@ -24,14 +48,16 @@ static auto g_FFmpegPlayerLogger = GET_LOGGER3("multimedia.FFmpegPlayer");
 FFmpegPlayer::FFmpegPlayer(AudioDevice audioDevice, VideoDevice videoDevice)
   : audio_device_(audioDevice)
   , video_device_(videoDevice) {
-  SDL_Init(SDL_INIT_AUDIO | SDL_INIT_VIDEO);
-  audio_buffer_.reset(new AudioBuffer(48000 * 4 * 1 * 3));
+  // the headless devices must work without a display or a sound server
+  if (audio_device_ == AudioDevice::SDL) sdl_subsystems_ |= SDL_INIT_AUDIO;
+  if (video_device_ == VideoDevice::SDL) sdl_subsystems_ |= SDL_INIT_VIDEO;
+  if (sdl_subsystems_) SDL_Init(sdl_subsystems_);
   openVideo();
 }
 FFmpegPlayer::~FFmpegPlayer() {
   close();
   closeVideo();
-  SDL_Quit();
+  if (sdl_subsystems_) SDL_Quit();
 }
 
 bool FFmpegPlayer::init(PlayerConfig config) {
@@ -40,6 +66,13 @@ bool FFmpegPlayer::init(PlayerConfig config) {
   }
 
   config_ = config;
+  if (config_.common.freerun && !clock_->isFreerun())
+    clock_ = std::make_shared<FreerunClock>();
+  if (clock_->isFreerun() && audio_device_ == AudioDevice::SDL
+      && isEnableAudio()) {
+    ILOG_WARN_FMT(g_FFmpegPlayerLogger,
+      "Freerun needs a headless audio device, SDL audio stays real-time");
+  }
   is_eof_.unset();
   is_aborted_.unset();
   is_streaming_.unset();
@@ -64,18 +97,18 @@ void FFmpegPlayer::destroy() {
     video_codec_context_ = nullptr;
   }
 
-  video_frame_queue_.clear();
-  video_packet_queue_.clear();
-  audio_frame_queue_.clear();
-  audio_packet_queue_.clear();
+  video_frame_queue_.reset();
+  video_packet_queue_.reset();
+  audio_packet_queue_.reset();
   audio_stream_index_ = video_stream_index_ = -1;
   audio_stream_ = video_stream_ = nullptr;
 
   audio_clock_.reset();
   video_clock_.reset();
 
-  resampler_.release();
-  converter_.release();
+  resampler_.reset();
+  converter_.reset();
+  texture_converter_.reset();
 
   is_eof_.unset();
   is_aborted_.unset();
@@ -91,8 +124,12 @@ bool FFmpegPlayer::close() {
   if (isEnableAudio()) closeAudio();
 
   is_aborted_.set();
+  continue_read_cond_.signalAll();
+  pause_cond_.signalAll();
+  // wakes both a blocked delivery and the embedder's pop()
+  if (video_tap_) video_tap_->close();
+  if (audio_tap_) audio_tap_->close();
   if (isEnableAudio()) {
-    audio_frame_queue_.close();
     audio_packet_queue_.close();
   }
   if (isEnableVideo()) {
@@ -108,7 +145,13 @@ bool FFmpegPlayer::close() {
   if (writer_)
     writer_.release();
 
+  if (audio_buffer_) {
+    ILOG_DEBUG_FMT(g_FFmpegPlayerLogger,
+      "Audio ring: {} underruns, {:.0f}% full at close",
+      audio_buffer_->underruns(), audio_buffer_->fillLevel() * 100);
+  }
   destroy();
+  dumpAVPoolStats();
 
   state_ = READY;
   return true;
@@ -120,6 +163,21 @@ bool FFmpegPlayer::open(
     close();
   }
 
+  open_started_us_ = steadyMicros();
+  timings_ = Timings{};
+  seek_serial_ = -1;
+  first_decoded_us_ = first_presented_us_ = -1;
+  seek_decoded_us_ = seek_presented_us_ = -1;
+  // wall time of a phase, since the previous one ended
+  auto lapStarted = TimeUtil::now();
+  auto lap = [&lapStarted] {
+    const auto now = TimeUtil::now();
+    const int64_t us =
+      TimeUtil::elapse<std::chrono::microseconds>(lapStarted, now).count();
+    lapStarted = now;
+    return us;
+  };
+
   int r;
   format_context_ = avformat_alloc_context();
   if (!format_context_) {
@@ -156,12 +214,14 @@ bool FFmpegPlayer::open(
     this->destroy();
     return false;
   }
+  timings_.open_input_us = lap();
   r = avformat_find_stream_info(format_context_, nullptr);
   if (r < 0) {
     FFMPEG_LOG_ERROR("Couldn't find stream information");
     this->destroy();
     return false;
   }
+  timings_.stream_info_us = lap();
 
   if (config_.debug_on) av_dump_format(format_context_, 0, url.c_str(), 0);
 
@@ -199,16 +259,13 @@ bool FFmpegPlayer::open(
         this->destroy();
         return false;
       }
-      audio_frame_queue_.clear();
-      audio_packet_queue_.clear();
+      audio_packet_queue_.reset();
       audio_clock_.reset();
 
       if (config_.audio.sample_rate)
         config_.audio.sample_rate = audio_codec_context_->sample_rate;
-      size_t maxFrameNum = config_.common.seek_step * config_.audio.sample_rate
-                           * config_.audio.channels;
-      audio_packet_queue_.setMaxSize(maxFrameNum);
-      audio_frame_queue_.setMaxSize(maxFrameNum);
+      audio_packet_queue_.setTimeBase(audio_stream_->time_base);
+      audio_packet_queue_.setLimits(packetQueueLimits(audio_stream_));
     }
   } while (0);
 
@@ -246,19 +303,24 @@ bool FFmpegPlayer::open(
         this->destroy();
         return false;
       }
-      video_frame_queue_.clear();
-      video_packet_queue_.clear();
+      video_frame_queue_.reset();
+      video_packet_queue_.reset();
       video_clock_.reset();
 
       setWidthAndHeight();
 
-      size_t maxFrameNum = config_.common.seek_step
-                           * config_.video.frame_rate.num
-                           / config_.video.frame_rate.den;
-      video_packet_queue_.setMaxSize(maxFrameNum);
-      video_frame_queue_.setMaxSize(maxFrameNum);
+      video_packet_queue_.setTimeBase(video_stream_->time_base);
+      video_packet_queue_.setLimits(packetQueueLimits(video_stream_));
+      // decoded pictures are big and constant-sized, bytes bound them best
+      AVQueueLimits frameLimits;
+      frameLimits.max_items = MAX_VIDEO_FRAME_QUEUE_ITEMS;
+      frameLimits.min_items = MIN_VIDEO_FRAME_QUEUE_ITEMS;
+      frameLimits.max_bytes = MAX_VIDEO_FRAME_QUEUE_BYTES;
+      video_frame_queue_.setTimeBase(video_stream_->time_base);
+      video_frame_queue_.setLimits(frameLimits);
     }
   } while (0);
+  timings_.codec_init_us = lap();
 
   if (!isEnableAudio() && !isEnableVideo()) {
     ILOG_ERROR_FMT(g_FFmpegPlayerLogger, "No Source to Play!!");
@@ -269,7 +331,10 @@ bool FFmpegPlayer::open(
   url_ = url;
   short_name_ = shortName;
   if (!shortName.empty()) is_streaming_.set();
-  if (!openAudio()) config_.common.enable_audio = false;
+  if (isEnableAudio()) {
+    if (!openAudio()) config_.common.enable_audio = false;
+    timings_.audio_device_us = lap();
+  }
   if (isEnableVideo() && is_native_mode) setWindowSize(config_.video.width, config_.video.height);
   state_ = READY2PLAY;
   return true;
@@ -279,7 +344,6 @@ bool FFmpegPlayer::play() {
   if (state_ != READY2PLAY) return false;
 
   if (isEnableAudio()) {
-    audio_frame_queue_.open();
     audio_packet_queue_.open();
   }
   if (isEnableVideo()) {
@@ -289,6 +353,14 @@ bool FFmpegPlayer::play() {
 
   if (isNetworkStream()) av_read_play(format_context_);
 
+  if (video_tap_ && isEnableVideo()) video_tap_->open();
+  if (audio_tap_ && isEnableAudio()) audio_tap_->open();
+  video_frames_decoded_ = 0;
+  video_frames_presented_ = 0;
+  video_frames_dropped_ = 0;
+  audio_frames_decoded_ = 0;
+  present_cpu_us_ = 0;
+  play_serial_ = serial_;
   read_thread_.dispatch(&FFmpegPlayer::onReadFrame, this);
   if (isEnableAudio())
     audio_decode_thread_.dispatch(&FFmpegPlayer::onAudioDecode, this);
@@ -299,22 +371,28 @@ bool FFmpegPlayer::play() {
   if (isEnableAudio()) {
     audio_clock_.set(
       audio_stream_->start_time * av_q2d(audio_stream_->time_base));
-    SDL_LockAudioDevice(device_id_);
-    SDL_PauseAudioDevice(device_id_, 0);
-    SDL_UnlockAudioDevice(device_id_);
   }
   if (isEnableVideo()) {
     video_clock_.set(
       video_stream_->start_time * av_q2d(video_stream_->time_base));
+  }
+  next_frame_due_ = -1;
+  play_started_ = TimeUtil::now();
+  play_started_pos_ = getCurrentTime();
+
+  if (isEnableAudio()) pauseAudioDevice(false);
+  if (isEnableVideo()) {
     if (is_native_mode)
       doVideoDisplay();
     else
       play_thread_.dispatch(&FFmpegPlayer::doVideoDisplay, this);
   }
-  else {
-    if (is_native_mode)
-      while (!is_aborted_ || !is_eof_)
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  else if (is_native_mode) {
+    // until aborted or the decoder finished and the device took all of it
+    while (!is_aborted_
+           && !audio_buffer_->waitDrained(
+             std::chrono::microseconds(QUEUE_WAIT_TIMEOUT_US))) {}
+    finishPlayback();
   }
 
   return true;
@@ -322,13 +400,11 @@ bool FFmpegPlayer::play() {
 
 bool FFmpegPlayer::replay() {
   if (isPaused()) {
-    if (isEnableAudio()) {
-      SDL_LockAudioDevice(device_id_);
-      SDL_PauseAudioDevice(device_id_, 0);
-      SDL_UnlockAudioDevice(device_id_);
-    }
+    if (isEnableAudio()) pauseAudioDevice(false);
     if (isNetworkStream()) av_read_play(format_context_);
     state_ = PLAYING;
+    continue_read_cond_.signalAll();
+    pause_cond_.signalAll();
     return true;
   }
   return false;
@@ -338,11 +414,7 @@ bool FFmpegPlayer::pause() {
   // PLAYING, READY2PLAY
   if (isPlaying() || state_ == READY2PLAY) {
     last_paused_time_ = getCurrentTime();
-    if (isEnableAudio()) {
-      SDL_LockAudioDevice(device_id_);
-      SDL_PauseAudioDevice(device_id_, 1);
-      SDL_UnlockAudioDevice(device_id_);
-    }
+    if (isEnableAudio()) pauseAudioDevice(true);
     if (isNetworkStream()) av_read_pause(format_context_);
     state_ = PAUSED;
     return true;
@@ -407,10 +479,12 @@ void FFmpegPlayer::playNext() {
 void FFmpegPlayer::onPlayPrev() {
   is_aborted_ = true;
   need_move_to_prev_.set();
+  continue_read_cond_.signalAll();
 }
 void FFmpegPlayer::onPlayNext() {
   is_aborted_ = true;
   need_move_to_next_.set();
+  continue_read_cond_.signalAll();
 }
 
 void FFmpegPlayer::seek(double pos) {
@@ -420,7 +494,25 @@ void FFmpegPlayer::seek(double pos) {
     pos = getTotalTime();
   ILOG_INFO_FMT(g_FFmpegPlayerLogger, "Seek to {}s", pos);
   seek_pos_ = pos * AV_TIME_BASE;
+  // frames of an earlier seek must not complete this one
+  seek_serial_ = -1;
+  seek_decoded_us_ = seek_presented_us_ = -1;
+  seek_requested_us_ = steadyMicros();
   need2seek_.set();
+  continue_read_cond_.signalAll();
+}
+
+AVQueueLimits FFmpegPlayer::packetQueueLimits(AVStream *pStream) const {
+  AVQueueLimits limits;
+  limits.max_items = MAX_PACKET_QUEUE_ITEMS;
+  limits.min_items = MIN_PACKET_QUEUE_ITEMS;
+  limits.max_bytes = MAX_PACKET_QUEUE_BYTES;
+  limits.max_duration = (int64_t) config_.common.seek_step * AV_TIME_BASE;
+  limits.auto_tune = true;
+  limits.bit_rate = pStream->codecpar->bit_rate > 0
+                      ? pStream->codecpar->bit_rate
+                      : format_context_->bit_rate;
+  return limits;
 }
 
 bool FFmpegPlayer::check(PlayerConfig &config) const {
@@ -450,81 +542,85 @@ void FFmpegPlayer::onReadFrame() {
   int r;
   while (!is_aborted_) {
     if (need2seek_) {
-      if (isPlaying()) {
-        if (isEnableAudio()) {
-          SDL_LockAudioDevice(device_id_);
-          SDL_PauseAudioDevice(device_id_, 1);
-          SDL_UnlockAudioDevice(device_id_);
-        }
-      }
-
       int64_t seekTarget = seek_pos_;
       r = av_seek_frame(format_context_, -1, seekTarget,
         AVSEEK_FLAG_FRAME | AVSEEK_FLAG_BACKWARD);
       if (r < 0) {
         FFMPEG_LOG_ERROR("Seek to {} failed!", seekTarget / AV_TIME_BASE);
+        need2seek_.unset();
         continue;
       }
 
-      if (isEnableAudio()) {
-        audio_packet_queue_.clear();
-        audio_frame_queue_.clear();
-      }
-      if (isEnableVideo()) {
-        video_packet_queue_.clear();
-        video_frame_queue_.clear();
-      }
+      // whatever is still queued belongs to the old position, the decoders
+      // and the renderers drop it as they meet it
+      seek_serial_ = ++serial_;
       need2seek_.unset();
       is_eof_.unset();
-
-      if (isPlaying()) {
-        if (isEnableAudio()) {
-          SDL_LockAudioDevice(device_id_);
-          SDL_PauseAudioDevice(device_id_, 0);
-          SDL_UnlockAudioDevice(device_id_);
-        }
-      }
     }
 
-    continue_read_cond_.waitFor(std::chrono::microseconds(10), [&]() {
-      bool audio_is_full = isEnableAudio() && audio_packet_queue_.isFull();
-      bool video_is_full = isEnableVideo() && video_packet_queue_.isFull();
-      bool is_paused = isPaused();
-      if (audio_is_full || video_is_full || is_paused) {
-        return false;
-      }
-      return true;
-    });
+    if (isPaused()) {
+      continue_read_cond_.waitFor(
+        std::chrono::microseconds(QUEUE_WAIT_TIMEOUT_US),
+        [&] { return !isPaused() || need2seek_ || is_aborted_; });
+      continue;
+    }
 
     auto pPkt = makeAVPacket();
     r = av_read_frame(format_context_, pPkt.get());
     if (r == AVERROR_EOF) {
+      if (is_eof_) {
+        // the decoders may still be busy with the tail, a seek brings us back
+        continue_read_cond_.waitFor(
+          std::chrono::microseconds(QUEUE_WAIT_TIMEOUT_US),
+          [&] { return need2seek_ || is_aborted_; });
+        continue;
+      }
       ILOG_INFO_FMT(g_FFmpegPlayerLogger, "End of file");
       is_eof_.set();
-      continue_read_cond_.waitFor(
-        std::chrono::microseconds(10), [&] { return false; });
-      return;
+      if (!isEnableAudio()) continue;
+      // av_read_frame() left the packet blank, queued like any other it
+      // drains the audio decoder, see onAudioDecode()
+      pPkt->stream_index = audio_stream_index_;
     }
     else if (r < 0) {
-      ILOG_WARN_FMT(g_FFmpegPlayerLogger, "Some errors on av_read_frame()");
+      ILOG_WARN_EVERY_MS(g_FFmpegPlayerLogger, HOT_LOG_INTERVAL_MS,
+        "Some errors on av_read_frame()");
       continue;
     }
-
-    if (pPkt->stream_index == audio_stream_index_) {
-      audio_packet_queue_.push(pPkt);
-    }
-    else if (pPkt->stream_index == video_stream_index_) {
-      video_packet_queue_.push(pPkt);
+    setSerial(pPkt.get(), serial_);
+
+    AVPacketQueue *pQueue = nullptr;
+    if (pPkt->stream_index == audio_stream_index_)
+      pQueue = &audio_packet_queue_;
+    else if (pPkt->stream_index == video_stream_index_)
+      pQueue = &video_packet_queue_;
+    if (!pQueue) continue;
+
+    // sleep while the decoder is behind, but keep reacting to seek/abort
+    while (!pQueue->waitWritable(
+      std::chrono::microseconds(QUEUE_WAIT_TIMEOUT_US))) {
+      if (is_aborted_ || need2seek_) break;
     }
+    if (is_aborted_ || need2seek_) continue;
+    pQueue->push(pPkt);
   }
 }
 void FFmpegPlayer::onAudioDecode() {
   int r;
+  int serial = -1;
   while (!is_aborted_) {
     AVPacketPtr pPkt;
-    if (!audio_packet_queue_.pop(pPkt)) {
-      continue_read_cond_.signal();
+    if (!audio_packet_queue_.popWait(
+          pPkt, std::chrono::microseconds(QUEUE_WAIT_TIMEOUT_US)))
       continue;
+
+    // read before the last seek
+    if (getSerial(pPkt.get()) != serial_) continue;
+    if (getSerial(pPkt.get()) != serial) {
+      avcodec_flush_buffers(audio_codec_context_);
+      if (resampler_) resampler_->reset();
+      audio_buffer_->discard();
+      serial = getSerial(pPkt.get());
     }
 
     r = avcodec_send_packet(audio_codec_context_, pPkt.get());
@@ -532,27 +628,49 @@ void FFmpegPlayer::onAudioDecode() {
       FFMPEG_LOG_ERROR("Error on sending a packet for decoding");
       break;
     }
-    while (true) {
+    while (serial == serial_) {
       auto pFrame = makeAVFrame();
       r = avcodec_receive_frame(audio_codec_context_, pFrame.get());
       if (r == AVERROR_EOF || r == AVERROR(EAGAIN))
         break;
       else if (r < 0) {
-        FFMPEG_LOG_ERROR("Audio frame may be broken");
+        ILOG_ERROR_EVERY_MS(g_FFmpegPlayerLogger, HOT_LOG_INTERVAL_MS,
+          "Audio frame may be broken");
         break;
       }
-
-      audio_frame_queue_.push(pFrame);
+      setSerial(pFrame.get(), serial);
+      audio_frames_decoded_.fetch_add(1, std::memory_order_relaxed);
+      if (!isEnableVideo()) markFirstFrame(serial, false);
+
+      if (audio_tap_) {
+        audio_tap_->deliver(pFrame,
+          std::chrono::microseconds(QUEUE_WAIT_TIMEOUT_US),
+          [&] { return is_aborted_ || serial != serial_; });
+      }
+      if (!writeAudioFrame(pFrame, serial)) break;
+      if (!isEnableVideo()) markFirstFrame(serial, true);
     }
+    // the end of file packet, the decoder gave up its last frames and all
+    // of the file is in the ring, the device running dry from here on is
+    // the end of it
+    if (r == AVERROR_EOF && !pPkt->data && serial == serial_)
+      audio_buffer_->markEnded();
   }
 }
 void FFmpegPlayer::onVideoDecode() {
   int r;
+  int serial = -1;
   while (!is_aborted_) {
     AVPacketPtr pPkt;
-    if (!video_packet_queue_.pop(pPkt)) {
-      continue_read_cond_.signal();
+    if (!video_packet_queue_.popWait(
+          pPkt, std::chrono::microseconds(QUEUE_WAIT_TIMEOUT_US)))
       continue;
+
+    // read before the last seek
+    if (getSerial(pPkt.get()) != serial_) continue;
+    if (getSerial(pPkt.get()) != serial) {
+      avcodec_flush_buffers(video_codec_context_);
+      serial = getSerial(pPkt.get());
     }
 
     r = avcodec_send_packet(video_codec_context_, pPkt.get());
@@ -560,59 +678,154 @@ void FFmpegPlayer::onVideoDecode() {
       FFMPEG_LOG_ERROR("Error on sending a packet for decoding");
       break;
     }
-    while (true) {
+    while (serial == serial_) {
       auto pFrame = makeAVFrame();
       r = avcodec_receive_frame(video_codec_context_, pFrame.get());
       if (r == AVERROR_EOF || r == AVERROR(EAGAIN))
         break;
       else if (r < 0) {
-        FFMPEG_LOG_ERROR("Video frame  may be broken");
+        ILOG_ERROR_EVERY_MS(g_FFmpegPlayerLogger, HOT_LOG_INTERVAL_MS,
+          "Video frame  may be broken");
         break;
       }
+      setSerial(pFrame.get(), serial);
+      video_frames_decoded_.fetch_add(1, std::memory_order_relaxed);
+      markFirstFrame(serial, false);
 
+      while (!video_frame_queue_.waitWritable(
+        std::chrono::microseconds(QUEUE_WAIT_TIMEOUT_US))) {
+        if (is_aborted_ || serial != serial_) break;
+      }
+      if (is_aborted_ || serial != serial_) break;
       video_frame_queue_.push(pFrame);
     }
   }
 }
 
-int FFmpegPlayer::decodeAudioFrame(AVFramePtr &pOutFrame) {
-  AVFramePtr pFrame;
-  bool success = audio_frame_queue_.pop(pFrame);
-  if (!success) {
-    return -1;
+double FFmpegPlayer::getAchievedSpeed() const {
+  if (state_ != PLAYING && state_ != PAUSED) return achieved_speed_;
+  const double wall =
+    (double) TimeUtil::elapse<std::chrono::microseconds>(play_started_).count()
+    / AV_TIME_BASE;
+  return wall > 0 ? (getCurrentTime() - play_started_pos_) / wall : 0.0;
+}
+
+void FFmpegPlayer::finishPlayback() {
+  achieved_speed_ = getAchievedSpeed();
+  const double wall =
+    (double) TimeUtil::elapse<std::chrono::microseconds>(play_started_).count()
+    / AV_TIME_BASE;
+  ILOG_INFO_FMT(g_FFmpegPlayerLogger,
+    "Played {:.3f}s of media in {:.3f}s, {:.1f}x",
+    getCurrentTime() - play_started_pos_, wall, achieved_speed_);
+}
+
+FFmpegPlayer::Stats FFmpegPlayer::getStats() {
+  Stats stats;
+  stats.video_frames_decoded =
+    video_frames_decoded_.load(std::memory_order_relaxed);
+  stats.video_frames_presented =
+    video_frames_presented_.load(std::memory_order_relaxed);
+  stats.video_frames_dropped =
+    video_frames_dropped_.load(std::memory_order_relaxed);
+  stats.audio_frames_decoded =
+    audio_frames_decoded_.load(std::memory_order_relaxed);
+  stats.present_cpu_us = present_cpu_us_.load(std::memory_order_relaxed);
+  stats.demux_cpu_us = read_thread_.cpuTime();
+  if (isEnableVideo())
+    stats.video_decode_cpu_us = video_decode_thread_.cpuTime();
+  if (isEnableAudio()) {
+    stats.audio_decode_cpu_us = audio_decode_thread_.cpuTime();
+    if (audio_buffer_) stats.audio_underruns = audio_buffer_->underruns();
+    if (audio_device_ == AudioDevice::NULL_SINK)
+      stats.audio_output_cpu_us = null_audio_thread_.cpuTime();
   }
+  return stats;
+}
 
-  if (!pOutFrame) pOutFrame = makeAVFrame();
-  auto tgtFormat = config_.audio.format == AV_SAMPLE_FMT_NONE
-                     ? (AVSampleFormat) pFrame->format
-                     : config_.audio.format;
-  pOutFrame->format = tgtFormat;
-  pOutFrame->sample_rate = config_.audio.sample_rate;
-  pOutFrame->ch_layout.nb_channels = config_.audio.channels;
-  // pOutFrame->channel_layout =
-  // av_get_default_channel_layout(config_.audio.channels);
+FFmpegPlayer::Timings FFmpegPlayer::getTimings() const {
+  Timings timings = timings_;
+  timings.first_decoded_us = first_decoded_us_.load();
+  timings.first_presented_us = first_presented_us_.load();
+  timings.seek_decoded_us = seek_decoded_us_.load();
+  timings.seek_presented_us = seek_presented_us_.load();
+  return timings;
+}
+
+void FFmpegPlayer::markFirstFrame(int serial, bool isPresented) {
+  std::atomic<int64_t> *pSlot;
+  int64_t since;
+  if (serial == seek_serial_) {
+    pSlot = isPresented ? &seek_presented_us_ : &seek_decoded_us_;
+    since = seek_requested_us_;
+  }
+  else if (serial == play_serial_) {
+    pSlot = isPresented ? &first_presented_us_ : &first_decoded_us_;
+    since = open_started_us_;
+  }
+  else {
+    return;
+  }
+  // every frame passes here, only the first one pays for the clock
+  if (pSlot->load(std::memory_order_relaxed) >= 0) return;
+  int64_t unset = -1;
+  pSlot->compare_exchange_strong(unset, steadyMicros() - since);
+}
+
+bool FFmpegPlayer::writeAudioFrame(const AVFramePtr &pFrame, int serial) {
   Resampler::Info in;
   in.sample_rate = pFrame->sample_rate;
   in.channels = pFrame->ch_layout.nb_channels;
   in.format = (AVSampleFormat) pFrame->format;
+  if (pFrame->ch_layout.order == AV_CHANNEL_ORDER_NATIVE)
+    in.channel_mask = pFrame->ch_layout.u.mask;
+  // whatever the device actually accepted in openAudio()
   Resampler::Info out;
-  out.sample_rate = pFrame->sample_rate;
-  out.channels = pFrame->ch_layout.nb_channels;
-  out.format = AV_SAMPLE_FMT_S16;
+  out.sample_rate = audio_hw_params.freq;
+  out.channels = audio_hw_params.channels;
+  out.format = audio_hw_params.fmt;
+  out.channel_mask = audio_hw_params.channel_layout;
 
   if (!resampler_) resampler_ = std::make_unique<Resampler>();
-  success = resampler_->init(in, out);
-  if (!success) return -1;
+  if (!resampler_->init(in, out)) return true;
 
+  auto pOutFrame = makeAVFrame();
   auto dataSize = resampler_->run(pFrame, pOutFrame);
-  audio_clock_.set(pFrame->pts * av_q2d(audio_stream_->time_base)
-                   + (double) pFrame->nb_samples / pFrame->sample_rate);
-  return dataSize;
+  if (dataSize <= 0) return true;
+
+  // whole sample frames only, the callback may stop at any boundary
+  const uint32_t frameSize = audio_hw_params.frame_size;
+  const uint8_t *pData = pOutFrame->extended_data[0];
+  uint32_t left = dataSize;
+  while (left > 0) {
+    if (!audio_buffer_->waitWritable(
+          left, std::chrono::microseconds(QUEUE_WAIT_TIMEOUT_US))) {
+      if (is_aborted_ || serial != serial_) return false;
+    }
+    if (is_aborted_ || serial != serial_) return false;
+
+    uint32_t n = FFMIN(left, audio_buffer_->writableBytes());
+    n -= n % frameSize;
+    if (n == 0) continue;
+    n = audio_buffer_->fill(pData, n);
+    pData += n;
+    left -= n;
+  }
+
+  if (pFrame->pts != AV_NOPTS_VALUE) {
+    audio_buffer_->stamp(pFrame->pts * av_q2d(audio_stream_->time_base)
+                         + (double) pFrame->nb_samples / pFrame->sample_rate);
+  }
+  return true;
 }
-bool FFmpegPlayer::decodeVideoFrame(AVFramePtr &pOutFrame) {
-  AVFramePtr pFrame;
-  if (!video_frame_queue_.pop(pFrame)) {
-    return false;
+bool FFmpegPlayer::decodeVideoFrame(AVFramePtr &pFrame, AVFramePtr &pOutFrame) {
+  auto timeout = is_native_mode ? EVENT_POLL_TIMEOUT_US : QUEUE_WAIT_TIMEOUT_US;
+  while (true) {
+    if (!video_frame_queue_.popWait(
+          pFrame, std::chrono::microseconds(timeout)))
+      return false;
+    if (getSerial(pFrame.get()) == serial_) break;
+    video_frames_dropped_.fetch_add(1, std::memory_order_relaxed);
   }
 
   if (is_streaming_ && config_.common.track_mode) {
@@ -627,12 +840,22 @@ bool FFmpegPlayer::decodeVideoFrame(AVFramePtr &pOutFrame) {
       drop++;
     }
     if (pLastestFrame) pFrame = pLastestFrame;
-    if (drop > 0) ILOG_WARN_FMT(g_FFmpegPlayerLogger, "Drop {} frames", drop);
+    video_frames_dropped_.fetch_add(drop, std::memory_order_relaxed);
+    if (drop > 0)
+      ILOG_WARN_EVERY_MS(
+        g_FFmpegPlayerLogger, HOT_LOG_INTERVAL_MS, "Drop {} frames", drop);
   }
 
   last_video_duration_pts_ = pFrame->pts - last_vframe_pts_;
   last_vframe_pts_ = pFrame->pts;
 
+  // the SDL renderer scales on its own and takes the decoder planes as-is
+  if (isDirectRender(pFrame)) {
+    pOutFrame = pFrame;
+    video_clock_.set(pFrame->pts * av_q2d(video_stream_->time_base));
+    return true;
+  }
+
   if (!pOutFrame) pOutFrame = makeAVFrame();
   auto tgtFormat = (config_.video.format == AV_PIX_FMT_NONE)
                      ? (AVPixelFormat) pFrame->format
@@ -658,7 +881,6 @@ bool FFmpegPlayer::decodeVideoFrame(AVFramePtr &pOutFrame) {
   pOutFrame->format = out.format;
   success = converter_->run(pFrame, pOutFrame) >= 0;
   if (!success) {
-    av_freep(pOutFrame->data);
     video_clock_.set(pFrame->pts * av_q2d(video_stream_->time_base));
     return false;
   }
@@ -668,20 +890,69 @@ bool FFmpegPlayer::decodeVideoFrame(AVFramePtr &pOutFrame) {
 }
 
 bool FFmpegPlayer::openVideo() {
-  if (video_device_ == VideoDevice::SDL) return openSDL(false);
-  return false;
+  switch (video_device_) {
+  case VideoDevice::SDL: return openSDL(false);
+  case VideoDevice::NULL_SINK:
+  case VideoDevice::OFFSCREEN: return true;
+  default: return false;
+  }
 }
 bool FFmpegPlayer::openAudio() {
-  if (audio_device_ == AudioDevice::SDL) return openSDL(true);
-  return false;
+  switch (audio_device_) {
+  case AudioDevice::SDL: return openSDL(true);
+  case AudioDevice::NULL_SINK: return openNullAudio();
+  default: return false;
+  }
 }
 bool FFmpegPlayer::closeVideo() {
-  if (video_device_ == VideoDevice::SDL) return closeSDL(false);
-  return false;
+  switch (video_device_) {
+  case VideoDevice::SDL: return closeSDL(false);
+  case VideoDevice::NULL_SINK:
+  case VideoDevice::OFFSCREEN: return true;
+  default: return false;
+  }
 }
 bool FFmpegPlayer::closeAudio() {
-  if (audio_device_ == AudioDevice::SDL) return closeSDL(true);
-  return false;
+  switch (audio_device_) {
+  case AudioDevice::SDL: return closeSDL(true);
+  case AudioDevice::NULL_SINK: return closeNullAudio();
+  default: return false;
+  }
+}
+
+void FFmpegPlayer::pauseAudioDevice(bool pause) {
+  if (audio_device_ == AudioDevice::SDL) {
+    SDL_LockAudioDevice(device_id_);
+    SDL_PauseAudioDevice(device_id_, pause ? 1 : 0);
+    SDL_UnlockAudioDevice(device_id_);
+  }
+  else {
+    null_audio_paused_ = pause;
+  }
+}
+
+bool FFmpegPlayer::setupAudioParams(int freq, int channels, int bufSize) {
+  audio_hw_params.fmt = config_.audio.format;
+  audio_hw_params.freq = freq;
+  audio_hw_params.channel_layout = av_get_default_channel_layout(channels);
+  audio_hw_params.channels = channels;
+  audio_hw_params.frame_size = av_samples_get_buffer_size(nullptr,
+    audio_hw_params.channels, 1, (AVSampleFormat) audio_hw_params.fmt, 1);
+  audio_hw_params.bytes_per_sec =
+    av_samples_get_buffer_size(nullptr, audio_hw_params.channels,
+      audio_hw_params.freq, (AVSampleFormat) audio_hw_params.fmt, 1);
+  if (audio_hw_params.bytes_per_sec <= 0 || audio_hw_params.frame_size <= 0) {
+    ILOG_ERROR_FMT(g_FFmpegPlayerLogger, "av_samples_get_buffer_size failed!");
+    return false;
+  }
+  audio_hw_params.buf_size = bufSize;
+
+  // sized once here, the device side must not allocate
+  uint32_t ringSize =
+    (int64_t) audio_hw_params.bytes_per_sec * AUDIO_RING_DURATION_MS / 1000;
+  audio_buffer_.reset(new AudioBuffer(FFMAX(ringSize, 4 * (uint32_t) bufSize)));
+  audio_mix_buffer_.assign(bufSize, 0);
+  return true;
 }
 
 bool FFmpegPlayer::openSDL(bool isAudio) {
@@ -714,27 +985,12 @@ bool FFmpegPlayer::openSDL(bool isAudio) {
       return false;
     }
 
-    auto wanted_channel_layout = av_get_default_channel_layout(
-      wanted.channels == have.channels ? wanted.channels : have.channels);
-
-    audio_hw_params.fmt = config_.audio.format;
-    audio_hw_params.freq = have.freq;
-    audio_hw_params.channel_layout = wanted_channel_layout;
-    audio_hw_params.channels = have.channels;
-    audio_hw_params.frame_size = av_samples_get_buffer_size(nullptr,
-      audio_hw_params.channels, 1, (AVSampleFormat) audio_hw_params.fmt, 1);
-    audio_hw_params.bytes_per_sec =
-      av_samples_get_buffer_size(nullptr, audio_hw_params.channels,
-        audio_hw_params.freq, (AVSampleFormat) audio_hw_params.fmt, 1);
-    if (audio_hw_params.bytes_per_sec <= 0 || audio_hw_params.frame_size <= 0) {
-      ILOG_ERROR_FMT(
-        g_FFmpegPlayerLogger, "av_samples_get_buffer_size failed!");
+    if (!setupAudioParams(have.freq, have.channels, have.size)) {
       SDL_CloseAudioDevice(device_id_);
       device_id_ = 0;
       return false;
     }
     ILOG_INFO_FMT(g_FFmpegPlayerLogger, "Setup SDL Audio");
-    audio_hw_params.buf_size = have.size;
   }
   else {
     window_ = SDL_CreateWindow("SDL Window", config_.video.xleft,
@@ -764,6 +1020,7 @@ bool FFmpegPlayer::closeSDL(bool isAudio) {
     device_id_ = 0;
   }
   else {
+    destroyTexture();
     if (renderer_) {
       SDL_DestroyRenderer(renderer_);
       renderer_ = nullptr;
@@ -775,8 +1032,118 @@ bool FFmpegPlayer::closeSDL(bool isAudio) {
   }
   return true;
 }
+/* canonical 44-byte PCM header, the sizes are patched in at close */
+static bool writeWavHeader(
+  std::FILE *file, int channels, int freq, int bits, uint32_t dataSize) {
+  auto le16 = [](uint8_t *p, uint32_t v) {
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+  };
+  auto le32 = [&](uint8_t *p, uint32_t v) {
+    le16(p, v & 0xffff);
+    le16(p + 2, v >> 16);
+  };
+  uint8_t header[44];
+  memcpy(header, "RIFF", 4);
+  le32(header + 4, 36 + dataSize);
+  memcpy(header + 8, "WAVEfmt ", 8);
+  le32(header + 16, 16);
+  le16(header + 20, 1);  // PCM
+  le16(header + 22, channels);
+  le32(header + 24, freq);
+  le32(header + 28, freq * channels * bits / 8);
+  le16(header + 32, channels * bits / 8);
+  le16(header + 34, bits);
+  memcpy(header + 36, "data", 4);
+  le32(header + 40, dataSize);
+  return std::fseek(file, 0, SEEK_SET) == 0
+         && std::fwrite(header, 1, sizeof(header), file) == sizeof(header);
+}
+
+bool FFmpegPlayer::openNullAudio() {
+  // same sample format and period as an SDL device would get
+  config_.audio.format = AV_SAMPLE_FMT_S16;
+  const int freq = config_.audio.sample_rate;
+  const int samples = FFMAX(SDL_AUDIO_MIN_BUFFER_SIZE,
+    2 << av_log2(freq / SDL_AUDIO_MAX_CALLBACKS_PER_SEC));
+  const int bufSize = samples * config_.audio.channels
+                      * av_get_bytes_per_sample(config_.audio.format);
+  if (freq <= 0
+      || !setupAudioParams(freq, config_.audio.channels, bufSize)) {
+    return false;
+  }
+
+  if (!config_.audio.wav_file.empty()) {
+    wav_file_ = std::fopen(config_.audio.wav_file.c_str(), "wb");
+    wav_bytes_ = 0;
+    if (!wav_file_
+        || !writeWavHeader(wav_file_, audio_hw_params.channels,
+          audio_hw_params.freq, 16, 0)) {
+      ILOG_WARN_FMT(g_FFmpegPlayerLogger, "Couldn't write WAV file {}",
+        config_.audio.wav_file);
+      if (wav_file_) std::fclose(wav_file_);
+      wav_file_ = nullptr;
+    }
+  }
+
+  null_audio_paused_ = true;
+  null_audio_stop_ = false;
+  null_audio_thread_.dispatch(&FFmpegPlayer::onNullAudio, this);
+  ILOG_INFO_FMT(g_FFmpegPlayerLogger, "Setup null audio sink");
+  return true;
+}
+bool FFmpegPlayer::closeNullAudio() {
+  null_audio_stop_ = true;
+  null_audio_thread_.stop();
+  if (wav_file_) {
+    writeWavHeader(wav_file_, audio_hw_params.channels, audio_hw_params.freq,
+      16, wav_bytes_);
+    std::fclose(wav_file_);
+    wav_file_ = nullptr;
+  }
+  return true;
+}
+
+void FFmpegPlayer::onNullAudio() {
+  // plays one period per period of wall time, like a device callback
+  std::vector<Uint8> period(audio_hw_params.buf_size);
+  const auto interval = std::chrono::microseconds(
+    (int64_t) audio_hw_params.buf_size * AV_TIME_BASE
+    / audio_hw_params.bytes_per_sec);
+  auto deadline = std::chrono::steady_clock::now();
+  while (!null_audio_stop_) {
+    if (null_audio_paused_) {
+      std::this_thread::sleep_for(interval);
+      deadline = std::chrono::steady_clock::now();
+      continue;
+    }
+    uint32_t len = (uint32_t) period.size();
+    if (clock_->isFreerun()) {
+      // nothing to keep up with, periods go out as soon as they are
+      // decoded, the short tail once the decoder has finished
+      if (!audio_buffer_->waitReadable(
+            len, std::chrono::microseconds(QUEUE_WAIT_TIMEOUT_US)))
+        continue;
+      const uint32_t readable = audio_buffer_->readableBytes();
+      if (readable < len)
+        len = readable - readable % audio_hw_params.frame_size;
+      if (len == 0) continue;
+    }
+    onAudioPull(period.data(), (int) len);
+    if (wav_file_ && std::fwrite(period.data(), 1, len, wav_file_) == len) {
+      wav_bytes_ += len;
+    }
+    if (clock_->isFreerun()) continue;
+    // a late wakeup is caught up by the following ones, a long stall is not
+    deadline += interval;
+    const auto now = std::chrono::steady_clock::now();
+    if (now - deadline > 4 * interval) deadline = now;
+    std::this_thread::sleep_until(deadline);
+  }
+}
+
 void FFmpegPlayer::setWindowSize(int w, int h) {
-  SDL_SetWindowSize(window_, w, h);
+  if (window_) SDL_SetWindowSize(window_, w, h);
 }
 
 void FFmpegPlayer::setWidthAndHeight() {
@@ -825,59 +1192,46 @@ void FFmpegPlayer::setWidthAndHeight() {
 }
 
 void FFmpegPlayer::sdlAudioCallback(void *ptr, Uint8 *stream, int len) {
-  reinterpret_cast<FFmpegPlayer *>(ptr)->sdlAudioHandle(stream, len);
+  reinterpret_cast<FFmpegPlayer *>(ptr)->onAudioPull(stream, len);
 }
-void FFmpegPlayer::sdlAudioHandle(Uint8 *stream, int len) {
-  int len2 = len;
-
-  int len1, size{0};
-  bool success;
-  bool silent;
-  while (len > 0) {
-    silent = false;
-    if (audio_buffer_->readableBytes() <= 0) {
-      AVFramePtr pOutFrame;
-      size = decodeAudioFrame(pOutFrame);
-      if (size < 0) {
-        silent = true;
-        audio_buffer_.reset(
-          new AudioBuffer(SDL_AUDIO_MIN_BUFFER_SIZE / audio_hw_params.frame_size
-                          * audio_hw_params.frame_size));
-      }
-      else {
-        audio_buffer_.reset(new AudioBuffer(size));
-      }
-      if (size > 0) {
-        audio_buffer_->fill(pOutFrame->extended_data[0], size);
-        av_freep(pOutFrame->extended_data);
-      }
-    }
-
-    len1 = audio_buffer_->readableBytes();
-    if (len1 > len) len1 = len;
-    if (!config_.audio.is_muted && !silent
-        && config_.audio.volume * 100 >= SDL_MIX_MAXVOLUME) {
-      memcpy(stream, audio_buffer_->peek(), len1);
-    }
-    else {
-      // silent
-      memset(stream, 0, len1);
-      if (!config_.audio.is_muted) {
-        SDL_MixAudioFormat(stream, audio_buffer_->peek(),
-          cvtFFSampleFmtToSDLSampleFmt(config_.audio.format), len1,
+void FFmpegPlayer::onAudioPull(Uint8 *stream, int len) {
+  // only copies out of the ring, decoding happens on AudioDecodeThread
+  uint32_t size = len;
+  bool isMixing = config_.audio.is_muted
+                  || config_.audio.volume * 100 < SDL_MIX_MAXVOLUME;
+  if (!isMixing) {
+    uint32_t n = audio_buffer_->extract(stream, size);
+    if (n < size) memset(stream + n, 0, size - n);
+  }
+  else {
+    memset(stream, 0, size);
+    while (size > 0) {
+      uint32_t chunk = FFMIN(size, (uint32_t) audio_mix_buffer_.size());
+      uint32_t n = audio_buffer_->extract(
+        config_.audio.is_muted ? nullptr : audio_mix_buffer_.data(), chunk);
+      if (!config_.audio.is_muted && n > 0) {
+        SDL_MixAudioFormat(stream, audio_mix_buffer_.data(),
+          cvtFFSampleFmtToSDLSampleFmt(config_.audio.format), n,
           config_.audio.volume * 100);
       }
+      if (n < chunk) break;
+      size -= n;
+      stream += n;
     }
-
-    len -= len1;
-    stream += len1;
-    audio_buffer_->extract(nullptr, len1);
   }
 
-  audio_clock_.set(
-    audio_clock_.get()
-    - (double) (2 * audio_hw_params.buf_size + audio_buffer_->readableBytes())
-        / audio_hw_params.bytes_per_sec);
+  // the ring knows what is queued exactly, an SDL device holds about two
+  // periods on top of that, the null sink the one it just took unless it
+  // freeruns
+  int periods = 2;
+  if (audio_device_ == AudioDevice::NULL_SINK)
+    periods = clock_->isFreerun() ? 0 : 1;
+  double clock;
+  if (audio_buffer_->clock(audio_hw_params.bytes_per_sec, clock)) {
+    audio_clock_.set(clock
+                     - (double) (periods * audio_hw_params.buf_size)
+                         / audio_hw_params.bytes_per_sec);
+  }
 }
 
 void FFmpegPlayer::doEventLoop() {
@@ -928,7 +1282,7 @@ void FFmpegPlayer::doVideoDelay() {
   auto tb = av_q2d(video_stream_->time_base);
   double delay = last_video_duration_pts_ * tb;
   auto x = video_frame_queue_.peek();
-  if (x) {
+  if (x && getSerial(x.get()) == serial_) {
     delay = (x->pts - last_vframe_pts_) * tb;
     if (delay < 0.0f || delay > 1.0f) {
       delay = x->duration * tb;
@@ -936,8 +1290,13 @@ void FFmpegPlayer::doVideoDelay() {
   }
 
   double diff = 0.0f;
-  if (isEnableAudioAndVideo()) {
-    ILOG_TRACE_FMT(g_FFmpegPlayerLogger, "Audio: {:3f} | Video: {:3f}",
+  if (clock_->isFreerun()) {
+    // the delay only moves the virtual clock, there is nothing to sync to
+  }
+  else if (isEnableAudioAndVideo() && audio_buffer_->hasClock()) {
+    // without a clock, right after a seek, the pre-seek audio position
+    // would rush or hold the new frames, they keep their own pace instead
+    ILOG_TRACE_BIN(g_FFmpegPlayerLogger, "Audio: {:3f} | Video: {:3f}",
       audio_clock_.get(), video_clock_.get());
 
     double sync_threshold =
@@ -953,24 +1312,32 @@ void FFmpegPlayer::doVideoDelay() {
     }
   }
   else {
-    double elapse = (double) Clock::elapse() / AV_TIME_BASE;
-    delay = 1.0f / av_q2d(config_.video.frame_rate) / config_.common.speed;
-    delay = FFMAX(0, delay - elapse);
+    // one frame interval after another; the first frame and a return from
+    // a pause or stall restart the schedule
+    const auto interval = (int64_t) (AV_TIME_BASE
+                                     / av_q2d(config_.video.frame_rate)
+                                     / config_.common.speed);
+    const int64_t now = clock_->now();
+    if (next_frame_due_ < 0 || now - next_frame_due_ > AV_TIME_BASE)
+      next_frame_due_ = now;
+    next_frame_due_ += interval;
+    delay = (double) FFMAX(0, next_frame_due_ - now) / AV_TIME_BASE;
   }
 
   if (!(is_streaming_ && config_.common.track_mode)) {
     auto curr = getCurrentTime();
     int minutes = (int) curr / 60;
     double seconds = curr - minutes * 60;
-    ILOG_DEBUG_FMT(g_FFmpegPlayerLogger,
+    ILOG_DEBUG_BIN(g_FFmpegPlayerLogger,
       "{}m:{:.3f}s | Delay: {:.3f}s | A-V: {:.3f}s", minutes, seconds, delay,
       -diff);
-    Clock::sleep(delay * AV_TIME_BASE);
+    clock_->sleep((int64_t) (delay * AV_TIME_BASE));
   }
 }
 
 void FFmpegPlayer::doVideoDisplay() {
   int r;
+  const int64_t cpuStarted = Thread::currentCpuTime();
   while (true) {
     if (is_native_mode) doEventLoop();
     if (!is_streaming_) {
@@ -981,46 +1348,34 @@ void FFmpegPlayer::doVideoDisplay() {
     if (is_aborted_) break;
 
     if (isPaused()) {
+      auto timeout =
+        is_native_mode ? EVENT_POLL_TIMEOUT_US : QUEUE_WAIT_TIMEOUT_US;
+      pause_cond_.waitFor(std::chrono::microseconds(timeout),
+        [&] { return !isPaused() || is_aborted_; });
       continue;
     }
 
-    AVFramePtr pOutFrame;
-    bool success = decodeVideoFrame(pOutFrame);
+    AVFramePtr pFrame, pOutFrame;
+    bool success = decodeVideoFrame(pFrame, pOutFrame);
     if (!success) {
-      if (pOutFrame) doVideoDelay();
+      // a frame was taken but could not be converted
+      if (pOutFrame) {
+        video_frames_dropped_.fetch_add(1, std::memory_order_relaxed);
+        doVideoDelay();
+      }
       continue;
     }
 
-    do {
-      if (!is_native_mode) {
-        // sendVFrame2Queue(pOutFrame);
-        continue;
-      }
-      if (video_device_ == VideoDevice::SDL) {
-        SDL_PixelFormatEnum format =
-          cvtFFPixFmtToSDLPixFmt(config_.video.format);
-        SDL_Texture *pTexture =
-          SDL_CreateTexture(renderer_, format, SDL_TEXTUREACCESS_STREAMING,
-            config_.video.width, config_.video.height);
-        if (pTexture == nullptr) {
-          LOG_ERROR_FMT("Failed to create texture while playing");
-          break;
-        }
-
-        if (format == SDL_PIXELFORMAT_YV12 || format == SDL_PIXELFORMAT_IYUV)
-          SDL_UpdateYUVTexture(pTexture, nullptr, pOutFrame->data[0],
-            pOutFrame->linesize[0], pOutFrame->data[1], pOutFrame->linesize[1],
-            pOutFrame->data[2], pOutFrame->linesize[2]);
-        else
-          SDL_UpdateTexture(
-            pTexture, nullptr, pOutFrame->data[0], pOutFrame->linesize[0]);
-
-        SDL_RenderClear(renderer_);
-        SDL_RenderCopy(renderer_, pTexture, nullptr, nullptr);
-        SDL_RenderPresent(renderer_);
-        SDL_DestroyTexture(pTexture);
-      }
-    } while (0);
+    if (video_tap_) {
+      const int serial = getSerial(pFrame.get());
+      video_tap_->deliver(pFrame,
+        std::chrono::microseconds(QUEUE_WAIT_TIMEOUT_US),
+        [&] { return is_aborted_ || serial != serial_; });
+    }
+    if (is_native_mode && video_device_ == VideoDevice::SDL)
+      renderSDL(pOutFrame);
+    video_frames_presented_.fetch_add(1, std::memory_order_relaxed);
+    markFirstFrame(getSerial(pFrame.get()), true);
 
     if (is_streaming_ && config_.common.save_while_playing) {
       if (!writer_) {
@@ -1039,19 +1394,111 @@ void FFmpegPlayer::doVideoDisplay() {
       writer_->write(pOutFrame);
     } 
 
-    av_freep(pOutFrame->data);
     doVideoDelay();
   }
 
+  present_cpu_us_ += Thread::currentCpuTime() - cpuStarted;
+  finishPlayback();
   state_ = FINISHED;
 }
 
+bool FFmpegPlayer::isDirectRender(const AVFramePtr &pFrame) const {
+  // the null sink drops what it gets, the SDL renderer scales on its own
+  const bool anyFormat =
+    video_device_ == VideoDevice::NULL_SINK
+    || (is_native_mode && video_device_ == VideoDevice::SDL);
+  if (!anyFormat) return false;
+  // the writer wants frames in the configured format
+  if (is_streaming_ && config_.common.save_while_playing)
+    return pFrame->format == config_.video.format;
+  return true;
+}
+
+SDL_Texture *FFmpegPlayer::getTexture(Uint32 format, int w, int h) {
+  if (texture_ && texture_format_ == format && texture_width_ == w
+      && texture_height_ == h)
+    return texture_;
+
+  destroyTexture();
+  texture_ = SDL_CreateTexture(
+    renderer_, format, SDL_TEXTUREACCESS_STREAMING, w, h);
+  if (!texture_) {
+    ILOG_ERROR_FMT(g_FFmpegPlayerLogger, "SDL_CreateTexture Error: {}",
+      SDL_GetError());
+    return nullptr;
+  }
+  texture_format_ = format;
+  texture_width_ = w;
+  texture_height_ = h;
+  return texture_;
+}
+void FFmpegPlayer::destroyTexture() {
+  if (texture_) {
+    SDL_DestroyTexture(texture_);
+    texture_ = nullptr;
+  }
+  texture_format_ = SDL_PIXELFORMAT_UNKNOWN;
+  texture_width_ = texture_height_ = 0;
+}
+
+bool FFmpegPlayer::renderSDL(const AVFramePtr &pFrame) {
+  auto format = cvtFFPixFmtToSDLPixFmt((AVPixelFormat) pFrame->format);
+  bool isNative = format != SDL_PIXELFORMAT_UNKNOWN;
+  if (!isNative) format = SDL_PIXELFORMAT_IYUV;
+
+  SDL_Texture *pTexture = getTexture(format, pFrame->width, pFrame->height);
+  if (!pTexture) return false;
+
+  int r = 0;
+  if (!isNative) {
+    // convert straight into the texture, no intermediate picture
+    Converter::Info in{pFrame->width, pFrame->height,
+      (AVPixelFormat) pFrame->format};
+    Converter::Info out{pFrame->width, pFrame->height, AV_PIX_FMT_YUV420P};
+    if (!texture_converter_) texture_converter_ = std::make_unique<Converter>();
+    if (!texture_converter_->init(in, out)) return false;
+
+    void *pixels;
+    int pitch;
+    if (SDL_LockTexture(pTexture, nullptr, &pixels, &pitch) < 0) return false;
+    const int h = pFrame->height;
+    uint8_t *dst[4] = {(uint8_t *) pixels, nullptr, nullptr, nullptr};
+    int dstStride[4] = {pitch, (pitch + 1) / 2, (pitch + 1) / 2, 0};
+    dst[1] = dst[0] + pitch * h;
+    dst[2] = dst[1] + dstStride[1] * ((h + 1) / 2);
+    r = texture_converter_->run(pFrame, dst, dstStride);
+    SDL_UnlockTexture(pTexture);
+  }
+  else if (format == SDL_PIXELFORMAT_YV12 || format == SDL_PIXELFORMAT_IYUV) {
+    r = SDL_UpdateYUVTexture(pTexture, nullptr, pFrame->data[0],
+      pFrame->linesize[0], pFrame->data[1], pFrame->linesize[1],
+      pFrame->data[2], pFrame->linesize[2]);
+  }
+  else if (format == SDL_PIXELFORMAT_NV12 || format == SDL_PIXELFORMAT_NV21) {
+    r = SDL_UpdateNVTexture(pTexture, nullptr, pFrame->data[0],
+      pFrame->linesize[0], pFrame->data[1], pFrame->linesize[1]);
+  }
+  else {
+    r = SDL_UpdateTexture(
+      pTexture, nullptr, pFrame->data[0], pFrame->linesize[0]);
+  }
+  if (r < 0) return false;
+
+  SDL_RenderClear(renderer_);
+  SDL_RenderCopy(renderer_, pTexture, nullptr, nullptr);
+  SDL_RenderPresent(renderer_);
+  return true;
+}
+
 SDL_PixelFormatEnum FFmpegPlayer::cvtFFPixFmtToSDLPixFmt(AVPixelFormat format) {
   switch (format) {
   case AV_PIX_FMT_YUVJ420P:
-  case AV_PIX_FMT_YUV420P: return SDL_PIXELFORMAT_YV12;
-  case AV_PIX_FMT_YUV422P: return SDL_PIXELFORMAT_YUY2;
-  case AV_PIX_FMT_YUV444P: return SDL_PIXELFORMAT_IYUV;
+  case AV_PIX_FMT_YUV420P: return SDL_PIXELFORMAT_IYUV;
+  case AV_PIX_FMT_NV12: return SDL_PIXELFORMAT_NV12;
+  case AV_PIX_FMT_NV21: return SDL_PIXELFORMAT_NV21;
+  case AV_PIX_FMT_YUYV422: return SDL_PIXELFORMAT_YUY2;
+  case AV_PIX_FMT_UYVY422: return SDL_PIXELFORMAT_UYVY;
+  case AV_PIX_FMT_YVYU422: return SDL_PIXELFORMAT_YVYU;
   case AV_PIX_FMT_RGB24: return SDL_PIXELFORMAT_RGB24;
   case AV_PIX_FMT_BGR24: return SDL_PIXELFORMAT_BGR24;
   case AV_PIX_FMT_RGBA: return SDL_PIXELFORMAT_RGBA32;
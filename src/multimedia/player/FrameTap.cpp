@@ -0,0 +1,84 @@
+#include "multimedia/player/FrameTap.hpp"
+
+FrameTap::FrameTap(Callback callback, FrameTapOptions options)
+  : options_(options), callback_(std::move(callback)) {}
+
+FrameTap::FrameTap(FrameTapOptions options) : options_(options) {
+  AVQueueLimits limits;
+  limits.max_items = FFMAX(options_.queue_size, (size_t) 1);
+  queue_.setLimits(limits);
+}
+
+bool FrameTap::pop(AVFramePtr &pFrame, Futex::Timeout timeout) {
+  return queue_.popWait(pFrame, timeout);
+}
+
+FrameTap::Stats FrameTap::getStats() const {
+  Stats stats;
+  stats.delivered = delivered_.load(std::memory_order_relaxed);
+  stats.dropped = dropped_.load(std::memory_order_relaxed);
+  stats.blocked = blocked_.load(std::memory_order_relaxed);
+  return stats;
+}
+
+void FrameTap::open() {
+  queue_.open();
+}
+void FrameTap::close() {
+  queue_.close();
+}
+
+AVFramePtr FrameTap::convert(const AVFramePtr &pFrame) {
+  if (pFrame->nb_samples > 0) {
+    Resampler::Info in;
+    in.sample_rate = pFrame->sample_rate;
+    in.channels = pFrame->ch_layout.nb_channels;
+    in.format = (AVSampleFormat) pFrame->format;
+    if (pFrame->ch_layout.order == AV_CHANNEL_ORDER_NATIVE)
+      in.channel_mask = pFrame->ch_layout.u.mask;
+    Resampler::Info out = in;
+    if (options_.sample_rate > 0) out.sample_rate = options_.sample_rate;
+    if (options_.sample_format != AV_SAMPLE_FMT_NONE)
+      out.format = options_.sample_format;
+    if (options_.channels > 0 && options_.channels != in.channels) {
+      out.channels = options_.channels;
+      out.channel_mask = 0;
+    }
+    if (out.sample_rate == in.sample_rate && out.format == in.format
+        && out.channels == in.channels) {
+      return pFrame;
+    }
+
+    if (!resampler_) resampler_ = std::make_unique<Resampler>();
+    if (!resampler_->init(in, out)) return nullptr;
+    // samples buffered before a seek must not leak into the new position
+    if (getSerial(pFrame.get()) != serial_) {
+      resampler_->reset();
+      serial_ = getSerial(pFrame.get());
+    }
+    auto pOutFrame = makeAVFrame();
+    if (resampler_->run(pFrame, pOutFrame) <= 0) return nullptr;
+    return pOutFrame;
+  }
+
+  Converter::Info in{pFrame->width, pFrame->height,
+    (AVPixelFormat) pFrame->format};
+  Converter::Info out = in;
+  if (options_.width > 0) out.width = options_.width;
+  if (options_.height > 0) out.height = options_.height;
+  if (options_.pixel_format != AV_PIX_FMT_NONE)
+    out.format = options_.pixel_format;
+  if (out.width == in.width && out.height == in.height
+      && out.format == in.format) {
+    return pFrame;
+  }
+
+  if (!converter_) converter_ = std::make_unique<Converter>();
+  if (!converter_->init(in, out)) return nullptr;
+  auto pOutFrame = makeAVFrame();
+  pOutFrame->width = out.width;
+  pOutFrame->height = out.height;
+  pOutFrame->format = out.format;
+  if (converter_->run(pFrame, pOutFrame) < 0) return nullptr;
+  return pOutFrame;
+}
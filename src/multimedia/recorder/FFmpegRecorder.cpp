@@ -11,6 +11,20 @@
 
 static auto g_FFmpegRecorderLogger = GET_LOGGER3("multimedia.FFmpegRecorder");
 
+// upper bound for a blocked thread to notice abort
+#define QUEUE_WAIT_TIMEOUT_US 100000
+// per-packet/per-frame messages are sampled to one line per interval
+#define HOT_LOG_INTERVAL_MS   1000
+
+// queue limits, see AVQueueLimits
+#define MAX_PACKET_QUEUE_BYTES      (16 * 1024 * 1024)
+#define MAX_PACKET_QUEUE_DURATION_S 5
+#define MIN_PACKET_QUEUE_ITEMS      25
+#define MAX_PACKET_QUEUE_ITEMS      4096
+#define MAX_FRAME_QUEUE_BYTES       (64 * 1024 * 1024)
+#define MIN_FRAME_QUEUE_ITEMS       3
+#define MAX_FRAME_QUEUE_ITEMS       16
+
 FFmpegRecorder::FFmpegRecorder() : Recorder() {}
 FFmpegRecorder::~FFmpegRecorder() {
   close();
@@ -55,6 +69,8 @@ void FFmpegRecorder::close() {
 
   if (state_ == RECORDING || state_ == PAUSED) {
     is_aborted_ = true;
+    in_packets_.close();
+    in_frames_.close();
     read_thread_.stop();
     if (config_.isEnableAudio()) 
       audio_decode_thread_.stop();
@@ -73,6 +89,7 @@ void FFmpegRecorder::close() {
   in_.cleanup();
   out_.cleanup();
   output_filename_.clear();
+  dumpAVPoolStats();
 
   is_aborted_ = false;
   state_ = READY;
@@ -83,6 +100,8 @@ void FFmpegRecorder::record() {
       throw 0;
       return;
     }
+    in_packets_.open();
+    in_frames_.open();
     read_thread_.dispatch(&FFmpegRecorder::onRead, this);
     if (config_.isEnableAudio()) 
       audio_decode_thread_.dispatch(&FFmpegRecorder::onAudioFrameDecode, this);
@@ -147,7 +166,8 @@ void FFmpegRecorder::onWrite() {
   assert(pInputVideoStream && pOutputVideoStream);
   while (!is_aborted_) {
     AVFramePtr pFrame;
-    if (!in_frames_.pop(pFrame)) {
+    if (!in_frames_.popWait(
+          pFrame, std::chrono::microseconds(QUEUE_WAIT_TIMEOUT_US))) {
       continue;
     }
     
@@ -158,8 +178,8 @@ void FFmpegRecorder::onWrite() {
       break;
     }
     else if (r == AVERROR(EAGAIN)) {
-      ILOG_DEBUG_FMT(
-        g_FFmpegRecorderLogger, "avcodec_receive_packet() send EAGAIN");
+      ILOG_DEBUG_EVERY_MS(g_FFmpegRecorderLogger, HOT_LOG_INTERVAL_MS,
+        "avcodec_receive_packet() send EAGAIN");
       continue;
     }
     else if (r < 0) {
@@ -197,7 +217,8 @@ void FFmpegRecorder::onAudioFrameDecode() {
   int r;
   while (!is_aborted_) {
     AVPacketPtr pPkt;
-    if (!in_packets_.pop(pPkt)) {
+    if (!in_packets_.popWait(
+          pPkt, std::chrono::microseconds(QUEUE_WAIT_TIMEOUT_US))) {
       continue;
     }
 
@@ -213,7 +234,8 @@ void FFmpegRecorder::onAudioFrameDecode() {
       if (r == AVERROR_EOF || r == AVERROR(EAGAIN))
         break;
       else if (r < 0) {
-        ILOG_ERROR_FMT(g_FFmpegRecorderLogger, "Audio frame may be broken");
+        ILOG_ERROR_EVERY_MS(g_FFmpegRecorderLogger, HOT_LOG_INTERVAL_MS,
+          "Audio frame may be broken");
         break;
       }
 
@@ -226,7 +248,8 @@ void FFmpegRecorder::onVideoFrameDecode() {
   int r;
   while (!is_aborted_) {
     AVPacketPtr pPkt;
-    if (!in_packets_.pop(pPkt)) {
+    if (!in_packets_.popWait(
+          pPkt, std::chrono::microseconds(QUEUE_WAIT_TIMEOUT_US))) {
       continue;
     }
 
@@ -242,7 +265,8 @@ void FFmpegRecorder::onVideoFrameDecode() {
       if (r == AVERROR_EOF || r == AVERROR(EAGAIN))
         break;
       else if (r < 0) {
-        ILOG_ERROR_FMT(g_FFmpegRecorderLogger, "Video frame  may be broken");
+        ILOG_ERROR_EVERY_MS(g_FFmpegRecorderLogger, HOT_LOG_INTERVAL_MS,
+          "Video frame  may be broken");
         break;
       }
 
@@ -361,8 +385,34 @@ bool FFmpegRecorder::openInputStream(
       in_.video_codec_context->width, in_.video_codec_context->height,
       config_.video.max_width, config_.video.max_height, 1);
   }
+
+  // only one stream is recorded, see record(); a stalled encoder must not
+  // pile up packets or decoded pictures without bound
+  AVStream *pStream =
+    config_.isEnableVideo() ? in_.video_stream : in_.audio_stream;
+  in_packets_.setTimeBase(pStream->time_base);
+  in_packets_.setLimits(packetQueueLimits(pStream));
+  AVQueueLimits frameLimits;
+  frameLimits.max_items = MAX_FRAME_QUEUE_ITEMS;
+  frameLimits.min_items = MIN_FRAME_QUEUE_ITEMS;
+  frameLimits.max_bytes = MAX_FRAME_QUEUE_BYTES;
+  in_frames_.setTimeBase(pStream->time_base);
+  in_frames_.setLimits(frameLimits);
   return true;
 }
+
+AVQueueLimits FFmpegRecorder::packetQueueLimits(AVStream *pStream) const {
+  AVQueueLimits limits;
+  limits.max_items = MAX_PACKET_QUEUE_ITEMS;
+  limits.min_items = MIN_PACKET_QUEUE_ITEMS;
+  limits.max_bytes = MAX_PACKET_QUEUE_BYTES;
+  limits.max_duration = (int64_t) MAX_PACKET_QUEUE_DURATION_S * AV_TIME_BASE;
+  limits.auto_tune = true;
+  limits.bit_rate = pStream->codecpar->bit_rate > 0
+                      ? pStream->codecpar->bit_rate
+                      : in_.format_context->bit_rate;
+  return limits;
+}
 bool FFmpegRecorder::openOutputStream(const std::string &url) {
   int r;
 
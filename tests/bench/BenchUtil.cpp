@@ -0,0 +1,220 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <new>
+
+#include <fmt/format.h>
+
+#include "BenchUtil.hpp"
+
+#if defined(_WIN32)
+# include <Windows.h>
+# include <Psapi.h>
+#else
+# include <sys/resource.h>
+#endif
+
+namespace
+{
+std::atomic<uint64_t> g_allocations{0};
+
+void *countedAlloc(size_t size) {
+  g_allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void *p = std::malloc(size ? size : 1)) return p;
+  throw std::bad_alloc();
+}
+}  // namespace
+
+// replaced for the whole executable, the player's threads included
+void *operator new(size_t size) { return countedAlloc(size); }
+void *operator new[](size_t size) { return countedAlloc(size); }
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+void operator delete[](void *p, size_t) noexcept { std::free(p); }
+
+namespace bench
+{
+JsonWriter &JsonWriter::beginObject() {
+  open('{');
+  return *this;
+}
+JsonWriter &JsonWriter::endObject() {
+  close('}');
+  return *this;
+}
+JsonWriter &JsonWriter::beginArray() {
+  open('[');
+  return *this;
+}
+JsonWriter &JsonWriter::endArray() {
+  close(']');
+  return *this;
+}
+
+JsonWriter &JsonWriter::key(std::string_view name) {
+  value(name);
+  out_ += ": ";
+  after_key_ = true;
+  return *this;
+}
+
+JsonWriter &JsonWriter::value(std::string_view str) {
+  separate();
+  out_ += '"';
+  for (char c : str) {
+    switch (c) {
+    case '"': out_ += "\\\""; break;
+    case '\\': out_ += "\\\\"; break;
+    case '\n': out_ += "\\n"; break;
+    case '\t': out_ += "\\t"; break;
+    default:
+      if ((unsigned char) c < 0x20)
+        out_ += fmt::format("\\u{:04x}", (unsigned) c);
+      else
+        out_ += c;
+    }
+  }
+  out_ += '"';
+  return *this;
+}
+JsonWriter &JsonWriter::value(bool b) {
+  separate();
+  out_ += b ? "true" : "false";
+  return *this;
+}
+JsonWriter &JsonWriter::value(int64_t v) {
+  separate();
+  out_ += std::to_string(v);
+  return *this;
+}
+JsonWriter &JsonWriter::value(uint64_t v) {
+  separate();
+  out_ += std::to_string(v);
+  return *this;
+}
+JsonWriter &JsonWriter::value(double v, int precision) {
+  separate();
+  out_ += std::isfinite(v) ? fmt::format("{:.{}f}", v, precision) : "null";
+  return *this;
+}
+
+void JsonWriter::open(char bracket) {
+  separate();
+  out_ += bracket;
+  has_items_.push_back(false);
+}
+void JsonWriter::close(char bracket) {
+  const bool hasItems = has_items_.back();
+  has_items_.pop_back();
+  if (hasItems) {
+    out_ += '\n';
+    out_.append(2 * has_items_.size(), ' ');
+  }
+  out_ += bracket;
+  if (has_items_.empty()) out_ += '\n';
+}
+void JsonWriter::separate() {
+  if (after_key_) {
+    after_key_ = false;
+    return;
+  }
+  if (has_items_.empty()) return;
+  if (has_items_.back()) out_ += ',';
+  has_items_.back() = true;
+  out_ += '\n';
+  out_.append(2 * has_items_.size(), ' ');
+}
+
+Summary summarize(std::vector<double> samples) {
+  Summary summary;
+  if (samples.empty()) return summary;
+  std::sort(samples.begin(), samples.end());
+  auto rank = [&](double p) {
+    size_t i = (size_t) std::ceil(p * samples.size());
+    return samples[i > 0 ? i - 1 : 0];
+  };
+  double sum = 0;
+  for (double v : samples) sum += v;
+  summary.samples = samples.size();
+  summary.mean = sum / samples.size();
+  summary.min = samples.front();
+  summary.p50 = rank(0.50);
+  summary.p95 = rank(0.95);
+  summary.p99 = rank(0.99);
+  summary.max = samples.back();
+  return summary;
+}
+
+void write_summary(JsonWriter &json, const Summary &summary) {
+  json.field("samples", (uint64_t) summary.samples)
+    .field("mean", summary.mean, 1)
+    .field("min", summary.min, 1)
+    .field("p50", summary.p50, 1)
+    .field("p95", summary.p95, 1)
+    .field("p99", summary.p99, 1)
+    .field("max", summary.max, 1);
+}
+
+uint64_t allocations() {
+  return g_allocations.load(std::memory_order_relaxed);
+}
+
+int64_t process_cpu_time() {
+#if defined(_WIN32)
+  FILETIME creation, exit, kernel, user;
+  if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user))
+    return 0;
+  auto ticks = [](const FILETIME &t) {
+    return ((int64_t) t.dwHighDateTime << 32) | t.dwLowDateTime;
+  };
+  return (ticks(kernel) + ticks(user)) / 10;  // 100ns ticks
+#else
+  rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+  return (int64_t) (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000
+         + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+#endif
+}
+
+int64_t peak_rss_kb() {
+#if defined(__linux__)
+  // VmHWM follows clear_refs, ru_maxrss does not
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.compare(0, 6, "VmHWM:") == 0)
+      return std::strtoll(line.c_str() + 6, nullptr, 10);
+  }
+#endif
+#if defined(_WIN32)
+  PROCESS_MEMORY_COUNTERS counters;
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    return -1;
+  return (int64_t) counters.PeakWorkingSetSize / 1024;
+#else
+  rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) return -1;
+  return usage.ru_maxrss;
+#endif
+}
+
+void reset_peak_rss() {
+#if defined(__linux__)
+  std::ofstream("/proc/self/clear_refs") << "5";
+#endif
+}
+
+bool write_report(const std::string &str, const std::string &filename) {
+  if (filename.empty()) {
+    std::fwrite(str.data(), 1, str.size(), stdout);
+    return std::fflush(stdout) == 0;
+  }
+  std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+  out << str;
+  return (bool) out.flush();
+}
+}  // namespace bench
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * Helpers shared by the benchmark targets: a JSON writer for the reports,
+ * timing loops, and process-wide CPU, memory and allocation counters.
+ */
+namespace bench
+{
+/**
+ * Streams pretty-printed JSON with keys in the order they are written, so
+ * two reports of the same build diff line by line.
+ */
+class JsonWriter
+{
+public:
+  JsonWriter &beginObject();
+  JsonWriter &endObject();
+  JsonWriter &beginArray();
+  JsonWriter &endArray();
+  JsonWriter &key(std::string_view name);
+
+  JsonWriter &value(std::string_view str);
+  JsonWriter &value(const char *str) { return value(std::string_view{str}); }
+  JsonWriter &value(bool b);
+  JsonWriter &value(int v) { return value((int64_t) v); }
+  JsonWriter &value(int64_t v);
+  JsonWriter &value(uint64_t v);
+  /* fixed point, NaN and infinities become null */
+  JsonWriter &value(double v, int precision = 3);
+
+  template <typename T>
+  JsonWriter &field(std::string_view name, T v) {
+    return key(name).value(v);
+  }
+  JsonWriter &field(std::string_view name, double v, int precision) {
+    return key(name).value(v, precision);
+  }
+
+  const std::string &str() const { return out_; }
+
+private:
+  void open(char bracket);
+  void close(char bracket);
+  void separate();
+
+  std::string out_;
+  std::vector<bool> has_items_;  // per open bracket
+  bool after_key_{false};
+};
+
+/* nanoseconds per operation over the timed samples */
+struct Summary
+{
+  size_t samples{0};
+  double mean{0};
+  double min{0};
+  double p50{0};
+  double p95{0};
+  double p99{0};
+  double max{0};
+};
+/* nearest-rank percentiles of samples */
+Summary summarize(std::vector<double> samples);
+void write_summary(JsonWriter &json, const Summary &summary);
+
+/**
+ * Calls fn() warmup times untimed, then iterations times timed. fn returns
+ * how many operations it ran, each sample is its time divided by that.
+ */
+template <typename Fn>
+Summary measure(int warmup, int iterations, Fn &&fn) {
+  for (int i = 0; i < warmup; ++i) fn();
+  std::vector<double> samples;
+  samples.reserve(iterations);
+  for (int i = 0; i < iterations; ++i) {
+    const auto started = std::chrono::steady_clock::now();
+    const int64_t ops = fn();
+    const auto elapsed = std::chrono::steady_clock::now() - started;
+    samples.push_back(
+      (double) std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed)
+        .count()
+      / (ops > 0 ? ops : 1));
+  }
+  return summarize(std::move(samples));
+}
+
+/* operator new/new[] calls since start, only C++ code is counted */
+uint64_t allocations();
+
+/* user + system time of the whole process, in microseconds */
+int64_t process_cpu_time();
+
+/**
+ * Resident set high-water mark in KiB, -1 if unknown. On Linux it can be
+ * reset, so every run gets its own peak; elsewhere it is since start.
+ */
+int64_t peak_rss_kb();
+void reset_peak_rss();
+
+/* writes str to filename, or to stdout if filename is empty */
+bool write_report(const std::string &str, const std::string &filename);
+}  // namespace bench
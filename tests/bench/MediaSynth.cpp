@@ -0,0 +1,402 @@
+#include <memory>
+
+#include <fmt/format.h>
+
+#include "MediaSynth.hpp"
+#include "multimedia/common/OSUtil.hpp"
+
+extern "C"
+{
+#include <libavfilter/buffersink.h>
+#include <libavutil/channel_layout.h>
+#include <libavutil/opt.h>
+}
+
+std::string SynthSpec::name() const {
+  std::string name;
+  if (hasVideo()) {
+    name += fmt::format("{}_{}x{}p{}", avcodec_get_name(video_codec), width,
+      height, frame_rate);
+    if (gop_size > 0) name += fmt::format("_g{}", gop_size);
+    if (vfr) name += "_vfr";
+  }
+  if (hasAudio()) {
+    if (!name.empty()) name += '_';
+    name += fmt::format("{}_{}hz{}ch", avcodec_get_name(audio_codec),
+      sample_rate, channels);
+    if (audio_source == NOISE) name += "_noise";
+    if (audio_tracks > 1) name += fmt::format("_x{}", audio_tracks);
+  }
+  return name + fmt::format("_{}ms", (int64_t) (duration * 1000));
+}
+
+namespace
+{
+/* a source graph feeding one encoder, in the muxer's stream order */
+struct Track
+{
+  AVFilterGraph *graph{nullptr};
+  AVFilterContext *sink{nullptr};
+  AVCodecContext *codec_context{nullptr};
+  AVStream *stream{nullptr};
+  int64_t next_pts{0};  // codec time base
+  bool eof{false};
+
+  ~Track() {
+    avfilter_graph_free(&graph);
+    avcodec_free_context(&codec_context);
+  }
+};
+
+std::string errorString(int r) {
+  char buf[AV_ERROR_MAX_STRING_SIZE]{};
+  av_strerror(r, buf, sizeof(buf));
+  return buf;
+}
+
+bool openGraph(Track &track, const std::string &desc, std::string &error) {
+  track.graph = avfilter_graph_alloc();
+  if (!track.graph) {
+    error = "Couldn't allocate filter graph";
+    return false;
+  }
+  const bool isVideo = track.codec_context->codec_type == AVMEDIA_TYPE_VIDEO;
+  int r = avfilter_graph_create_filter(&track.sink,
+    avfilter_get_by_name(isVideo ? "buffersink" : "abuffersink"), "out",
+    nullptr, nullptr, track.graph);
+  if (r < 0) {
+    error = "Couldn't create buffer sink: " + errorString(r);
+    return false;
+  }
+
+  // the chain's unlabeled output is "out"
+  AVFilterInOut *inputs = avfilter_inout_alloc();
+  if (!inputs) {
+    error = "Couldn't allocate filter pads";
+    return false;
+  }
+  inputs->name = av_strdup("out");
+  inputs->filter_ctx = track.sink;
+  inputs->pad_idx = 0;
+  inputs->next = nullptr;
+  r = avfilter_graph_parse_ptr(
+    track.graph, desc.c_str(), &inputs, nullptr, nullptr);
+  avfilter_inout_free(&inputs);
+  if (r >= 0) r = avfilter_graph_config(track.graph, nullptr);
+  if (r < 0) {
+    error = fmt::format("Couldn't set up \"{}\": {}", desc, errorString(r));
+    return false;
+  }
+  return true;
+}
+
+bool openVideo(const SynthSpec &spec, AVFormatContext *pFormatContext,
+  Track &track, std::string &error) {
+  const AVCodec *pCodec = avcodec_find_encoder(spec.video_codec);
+  track.codec_context = avcodec_alloc_context3(pCodec);
+  if (!track.codec_context) {
+    error = "Couldn't allocate video codec context";
+    return false;
+  }
+  auto *c = track.codec_context;
+  c->width = spec.width;
+  c->height = spec.height;
+  c->pix_fmt = pCodec->pix_fmts ? pCodec->pix_fmts[0] : AV_PIX_FMT_YUV420P;
+  c->time_base = {1, spec.frame_rate};
+  c->framerate = {spec.frame_rate, 1};
+  c->gop_size = spec.gop_size > 0 ? spec.gop_size : 2 * spec.frame_rate;
+  // about what a streaming service spends, 0.1 bit per pixel
+  c->bit_rate = (int64_t) spec.width * spec.height * spec.frame_rate / 10;
+  c->thread_count = 1;
+  c->flags |= AV_CODEC_FLAG_BITEXACT;
+  if (pFormatContext->oformat->flags & AVFMT_GLOBALHEADER)
+    c->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+  // libx264 only, other encoders ignore it
+  av_opt_set(c->priv_data, "preset", "veryfast", 0);
+
+  int r = avcodec_open2(c, pCodec, nullptr);
+  if (r < 0) {
+    error = fmt::format(
+      "Couldn't open encoder {}: {}", pCodec->name, errorString(r));
+    return false;
+  }
+  std::string desc = fmt::format("testsrc2=size={}x{}:rate={}:duration={}",
+    spec.width, spec.height, spec.frame_rate, spec.duration);
+  // the kept frames keep their timestamps, leaving gaps of two frames
+  if (spec.vfr) desc += ",select='not(eq(mod(n\\,4)\\,3))'";
+  desc += fmt::format(",format={}", av_get_pix_fmt_name(c->pix_fmt));
+  return openGraph(track, desc, error);
+}
+
+bool openAudio(const SynthSpec &spec, int index,
+  AVFormatContext *pFormatContext, Track &track, std::string &error) {
+  const AVCodec *pCodec = avcodec_find_encoder(spec.audio_codec);
+  track.codec_context = avcodec_alloc_context3(pCodec);
+  if (!track.codec_context) {
+    error = "Couldn't allocate audio codec context";
+    return false;
+  }
+  auto *c = track.codec_context;
+  c->sample_fmt =
+    pCodec->sample_fmts ? pCodec->sample_fmts[0] : AV_SAMPLE_FMT_S16;
+  c->sample_rate = spec.sample_rate;
+  av_channel_layout_default(&c->ch_layout, spec.channels);
+  c->time_base = {1, spec.sample_rate};
+  c->bit_rate = 64000 * spec.channels;
+  c->thread_count = 1;
+  c->flags |= AV_CODEC_FLAG_BITEXACT;
+  if (pFormatContext->oformat->flags & AVFMT_GLOBALHEADER)
+    c->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+
+  int r = avcodec_open2(c, pCodec, nullptr);
+  if (r < 0) {
+    error = fmt::format(
+      "Couldn't open encoder {}: {}", pCodec->name, errorString(r));
+    return false;
+  }
+
+  char layout[64];
+  av_channel_layout_describe(&c->ch_layout, layout, sizeof(layout));
+  // every track sounds different, so a wrong track switch is audible
+  std::string desc;
+  if (spec.audio_source == SynthSpec::NOISE) {
+    desc = fmt::format("anoisesrc=color=pink:seed={}:amplitude=0.5:"
+                       "sample_rate={}:duration={}",
+      42 + index, spec.sample_rate, spec.duration);
+  }
+  else {
+    desc = fmt::format("sine=frequency={}:beep_factor=4:sample_rate={}:"
+                       "duration={}",
+      440 * (index + 1), spec.sample_rate, spec.duration);
+  }
+  desc += fmt::format(",aformat=sample_fmts={}:channel_layouts={}",
+    av_get_sample_fmt_name(c->sample_fmt), layout);
+  // most encoders take exactly frame_size samples per frame
+  if (c->frame_size > 0
+      && !(pCodec->capabilities & AV_CODEC_CAP_VARIABLE_FRAME_SIZE)) {
+    desc += fmt::format(",asetnsamples=n={}", c->frame_size);
+  }
+  return openGraph(track, desc, error);
+}
+
+/* sends pFrame (nullptr flushes) and muxes whatever comes out */
+bool encode(AVFormatContext *pFormatContext, Track &track, AVFrame *pFrame,
+  std::string &error) {
+  int r = avcodec_send_frame(track.codec_context, pFrame);
+  if (r < 0) {
+    error = "Error on sending a frame for encoding: " + errorString(r);
+    return false;
+  }
+  auto pPkt = makeAVPacket();
+  while ((r = avcodec_receive_packet(track.codec_context, pPkt.get())) >= 0) {
+    av_packet_rescale_ts(
+      pPkt.get(), track.codec_context->time_base, track.stream->time_base);
+    pPkt->stream_index = track.stream->index;
+    r = av_interleaved_write_frame(pFormatContext, pPkt.get());
+    if (r < 0) {
+      error = "Couldn't write a packet: " + errorString(r);
+      return false;
+    }
+  }
+  if (r != AVERROR(EAGAIN) && r != AVERROR_EOF) {
+    error = "Error on encoding: " + errorString(r);
+    return false;
+  }
+  return true;
+}
+
+bool run(const SynthSpec &spec, AVFormatContext *pFormatContext,
+  const std::string &filename, std::string &error) {
+  std::vector<std::unique_ptr<Track>> tracks;
+  // audio tracks count from 0, video is -1
+  auto addTrack = [&](int audioIndex) {
+    tracks.push_back(std::make_unique<Track>());
+    auto &track = *tracks.back();
+    const bool success = audioIndex < 0
+      ? openVideo(spec, pFormatContext, track, error)
+      : openAudio(spec, audioIndex, pFormatContext, track, error);
+    if (!success) return false;
+    track.stream = avformat_new_stream(pFormatContext, nullptr);
+    if (!track.stream) {
+      error = "Couldn't create a stream";
+      return false;
+    }
+    track.stream->time_base = track.codec_context->time_base;
+    if (audioIndex >= 0 && spec.audio_tracks > 1) {
+      av_dict_set(&track.stream->metadata, "title",
+        fmt::format("Track {}", audioIndex + 1).c_str(), 0);
+    }
+    return avcodec_parameters_from_context(
+             track.stream->codecpar, track.codec_context) >= 0;
+  };
+  if (spec.hasVideo() && !addTrack(-1)) return false;
+  for (int i = 0; spec.hasAudio() && i < spec.audio_tracks; ++i) {
+    if (!addTrack(i)) return false;
+  }
+
+  int r = avio_open(&pFormatContext->pb, filename.c_str(), AVIO_FLAG_WRITE);
+  if (r < 0) {
+    error = fmt::format("Couldn't open {}: {}", filename, errorString(r));
+    return false;
+  }
+  r = avformat_write_header(pFormatContext, nullptr);
+  if (r < 0) {
+    error = "Couldn't write the header: " + errorString(r);
+    return false;
+  }
+
+  auto pFrame = makeAVFrame();
+  while (true) {
+    // whichever track is behind, the muxer gets them about interleaved
+    Track *pTrack = nullptr;
+    for (auto &track : tracks) {
+      if (track->eof) continue;
+      if (!pTrack
+          || av_compare_ts(track->next_pts, track->codec_context->time_base,
+               pTrack->next_pts, pTrack->codec_context->time_base) < 0) {
+        pTrack = track.get();
+      }
+    }
+    if (!pTrack) break;
+
+    r = av_buffersink_get_frame(pTrack->sink, pFrame.get());
+    if (r == AVERROR_EOF) {
+      pTrack->eof = true;
+      if (!encode(pFormatContext, *pTrack, nullptr, error)) return false;
+      continue;
+    }
+    else if (r < 0) {
+      error = "Couldn't pull from the filter graph: " + errorString(r);
+      return false;
+    }
+    pFrame->pts = av_rescale_q(pFrame->pts,
+      av_buffersink_get_time_base(pTrack->sink),
+      pTrack->codec_context->time_base);
+    pFrame->pict_type = AV_PICTURE_TYPE_NONE;
+    pTrack->next_pts = pFrame->pts + FFMAX(pFrame->nb_samples, 1);
+    const bool success = encode(pFormatContext, *pTrack, pFrame.get(), error);
+    av_frame_unref(pFrame.get());
+    if (!success) return false;
+  }
+
+  r = av_write_trailer(pFormatContext);
+  if (r < 0) {
+    error = "Couldn't write the trailer: " + errorString(r);
+    return false;
+  }
+  return true;
+}
+}  // namespace
+
+namespace bench
+{
+bool can_synthesize(const SynthSpec &spec, std::string &reason) {
+  for (auto id : {spec.video_codec, spec.audio_codec}) {
+    if (id == AV_CODEC_ID_NONE) continue;
+    if (!avcodec_find_encoder(id)) {
+      reason = fmt::format("no {} encoder in this build", avcodec_get_name(id));
+      return false;
+    }
+    if (!avcodec_find_decoder(id)) {
+      reason = fmt::format("no {} decoder in this build", avcodec_get_name(id));
+      return false;
+    }
+  }
+  return true;
+}
+
+bool synthesize(
+  const SynthSpec &spec, const std::string &filename, std::string &error) {
+  if (!can_synthesize(spec, error)) return false;
+
+  AVFormatContext *pFormatContext = nullptr;
+  int r = avformat_alloc_output_context2(
+    &pFormatContext, nullptr, "matroska", nullptr);
+  if (r < 0) {
+    error = "Couldn't allocate output context: " + errorString(r);
+    return false;
+  }
+  pFormatContext->flags |= AVFMT_FLAG_BITEXACT;
+
+  // renamed once complete, an interrupted run leaves no usable file behind
+  const std::string partial = filename + ".part";
+  bool success = run(spec, pFormatContext, partial, error);
+  if (pFormatContext->pb) avio_closep(&pFormatContext->pb);
+  avformat_free_context(pFormatContext);
+  if (success && !os_api::move(partial, filename)) {
+    error = "Couldn't rename " + partial;
+    success = false;
+  }
+  if (!success) os_api::unlink(partial);
+  return success;
+}
+
+std::string synthesize_cached(
+  const SynthSpec &spec, const std::string &dir, std::string &error) {
+  const std::string filename = dir + "/" + spec.name() + ".mkv";
+  if (os_api::exist_file(filename)) return filename;
+  if (!os_api::exist_dir(dir) && !os_api::mk(dir, true)) {
+    error = "Couldn't create " + dir;
+    return "";
+  }
+  return synthesize(spec, filename, error) ? filename : "";
+}
+
+std::vector<CorpusEntry> corpus(double duration) {
+  struct Resolution
+  {
+    const char *name;
+    int width;
+    int height;
+  };
+  const Resolution resolutions[] = {{"360p", 640, 360}, {"720p", 1280, 720},
+    {"1080p", 1920, 1080}, {"2160p", 3840, 2160}};
+  const AVCodecID codecs[] = {
+    AV_CODEC_ID_H264, AV_CODEC_ID_MPEG4, AV_CODEC_ID_MJPEG};
+
+  std::vector<CorpusEntry> entries;
+  auto add = [&](const std::string &name, AVCodecID videoCodec,
+               const Resolution &res) {
+    CorpusEntry entry;
+    entry.name = name;
+    entry.spec.video_codec = videoCodec;
+    entry.spec.width = res.width;
+    entry.spec.height = res.height;
+    entry.spec.audio_codec = AV_CODEC_ID_AAC;
+    entry.spec.duration = duration;
+    entries.push_back(entry);
+    return &entries.back().spec;
+  };
+  for (auto codec : codecs) {
+    for (auto &res : resolutions) {
+      add(fmt::format("{}_{}", avcodec_get_name(codec), res.name), codec, res);
+    }
+  }
+  const Resolution &fullHd = resolutions[2];
+  add("h264_1080p_intra", AV_CODEC_ID_H264, fullHd)->gop_size = 1;
+  // one keyframe per ten seconds, seeks have to decode far
+  auto *pLongGop = add("h264_1080p_longgop", AV_CODEC_ID_H264, fullHd);
+  pLongGop->gop_size = 10 * pLongGop->frame_rate;
+  add("mpeg4_720p_vfr", AV_CODEC_ID_MPEG4, resolutions[1])->vfr = true;
+  add("h264_720p_3audio", AV_CODEC_ID_H264, resolutions[1])->audio_tracks = 3;
+
+  add("aac_48k", AV_CODEC_ID_NONE, fullHd);
+  auto *pNoise = add("aac_44k_noise", AV_CODEC_ID_NONE, fullHd);
+  pNoise->sample_rate = 44100;
+  pNoise->audio_source = SynthSpec::NOISE;
+  return entries;
+}
+
+MediaSource lavfi_camera(int width, int height, int fps) {
+  return MediaSource{fmt::format("testsrc2=size={}x{}:rate={},format=yuyv422",
+                       width, height, fps),
+    "lavfi"};
+}
+MediaSource lavfi_screen(int width, int height, int fps) {
+  DeviceConfig config{};
+  config.grabber.draw_mouse = false;
+  return MediaSource{fmt::format("testsrc2=size={}x{}:rate={},format=bgr0",
+                       width, height, fps),
+    "lavfi", config};
+}
+}  // namespace bench
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "multimedia/MediaSource.hpp"
+#include "multimedia/common/FFmpegUtil.hpp"
+
+/* what synthesize() writes, AV_CODEC_ID_NONE leaves a track out */
+struct SynthSpec
+{
+  enum AudioSource
+  {
+    SINE,   // a beeping tone, one pitch per track
+    NOISE,  // pink noise, the worst case for a perceptual codec
+  };
+
+  // video, testsrc2
+  AVCodecID video_codec{AV_CODEC_ID_NONE};
+  int width{1280};
+  int height{720};
+  int frame_rate{30};
+  int gop_size{0};  // 0 is two seconds, 1 is all-intra
+  bool vfr{false};  // every 4th frame left out, so durations vary
+  // audio
+  AVCodecID audio_codec{AV_CODEC_ID_NONE};
+  AudioSource audio_source{SINE};
+  int audio_tracks{1};
+  int sample_rate{48000};
+  int channels{2};
+
+  double duration{10.0};  // seconds
+
+  bool hasVideo() const { return video_codec != AV_CODEC_ID_NONE; }
+  bool hasAudio() const {
+    return audio_codec != AV_CODEC_ID_NONE && audio_tracks > 0;
+  }
+  /* unique per spec, usable as a file name */
+  std::string name() const;
+};
+
+/* a named corpus file, the name stays put when the spec is tuned */
+struct CorpusEntry
+{
+  std::string name;
+  SynthSpec spec;
+};
+
+namespace bench
+{
+/* false with a reason if the build lacks an encoder or decoder for spec */
+bool can_synthesize(const SynthSpec &spec, std::string &reason);
+
+/**
+ * Renders spec with libavfilter sources and the bundled encoders into a
+ * Matroska file. Encoding is single-threaded and bit-exact and the noise
+ * is seeded, so the same spec and FFmpeg build give the same bytes. The
+ * file appears only once it is complete.
+ */
+bool synthesize(
+  const SynthSpec &spec, const std::string &filename, std::string &error);
+
+/* synthesizes into dir unless a previous run already did, returns the path */
+std::string synthesize_cached(
+  const SynthSpec &spec, const std::string &dir, std::string &error);
+
+/**
+ * The shared test corpus, each file `duration` seconds long: H.264,
+ * MPEG-4 Part 2 and MJPEG from 360p to 2160p with AAC, all-intra and
+ * long-GOP H.264, VFR, three audio tracks, and audio-only files.
+ */
+std::vector<CorpusEntry> corpus(double duration = 10.0);
+
+/**
+ * lavfi graphs standing in for capture devices, so the live paths run on
+ * hosts without a camera or a desktop. They never end; the camera delivers
+ * raw YUYV like a UVC webcam, the screen BGR0 like x11grab/gdigrab.
+ */
+MediaSource lavfi_camera(int width = 1280, int height = 720, int fps = 30);
+MediaSource lavfi_screen(int width = 1920, int height = 1080, int fps = 30);
+}  // namespace bench
@@ -0,0 +1,265 @@
+/**
+ * Measures how long the player takes to show the first frame of a file and
+ * the first frame after a seek, over the synthetic corpus, as JSON.
+ *
+ *   bench_latency [-o report.json] [-d seconds] [-m media_dir] [-r runs]
+ *                 [-n seeks] [-s] [filter]
+ *
+ * Every corpus file is opened `runs` times. Each open reports the phases of
+ * open(), then the time from open() to the first decoded and the first
+ * presented frame. One more player then seeks `seeks` times to random
+ * positions, the same ones on every run of the benchmark, and reports the
+ * time from seek() to the first frame of the new position. Latencies are in
+ * milliseconds, summarized over the samples.
+ *
+ * Playback is paced in real time, as a user sees it, with the null devices;
+ * -s opens the SDL audio device instead, device enumeration included.
+ * Inputs are generated into media_dir on the first run and reused after.
+ * Only corpus entries whose name contains filter run. Exits with 1 if a
+ * file failed.
+ */
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "BenchUtil.hpp"
+#include "MediaSynth.hpp"
+#include "multimedia/player/FFmpegPlayer.hpp"
+
+#define SDL_MAIN_HANDLED
+#include <SDL2/SDL.h>
+
+#define FIRST_FRAME_TIMEOUT_MS 10000
+#define SEEK_TIMEOUT_MS        5000
+#define POLL_INTERVAL_US       200
+#define SEEK_SEED              42
+// the player stops by itself this close to the end, seeks stay before it
+#define SEEK_END_MARGIN_S      1.0
+
+namespace
+{
+using Timings = FFmpegPlayer::Timings;
+
+struct Options
+{
+  int runs{5};
+  int seeks{50};
+  bool sdl_audio{false};
+};
+
+/* samples of one latency in milliseconds, unset ones are left out */
+struct Samples
+{
+  const char *name;
+  int64_t Timings::*field;
+  std::vector<double> ms;
+
+  void add(const Timings &timings) {
+    if (timings.*field >= 0) ms.push_back(timings.*field / 1000.0);
+  }
+};
+
+std::unique_ptr<FFmpegPlayer> startPlayer(
+  const SynthSpec &spec, const std::string &filename, const Options &opts) {
+  PlayerConfig config;
+  config.common.auto_read_next_media = false;
+  config.common.enable_audio = spec.hasAudio();
+  config.common.enable_video = spec.hasVideo();
+  config.debug_on = false;
+
+  auto pPlayer = std::make_unique<FFmpegPlayer>(
+    opts.sdl_audio ? AudioDevice::SDL : AudioDevice::NULL_SINK,
+    VideoDevice::NULL_SINK);
+  if (!pPlayer->init(config)) return nullptr;
+  // returns once playback runs, see is_native_mode
+  pPlayer->play(MediaSource{filename});
+  if (!pPlayer->isPlaying()) return nullptr;
+  return pPlayer;
+}
+
+/* until the player sets field, -1 if it does not within timeoutMs */
+int64_t waitFor(
+  const FFmpegPlayer &player, int64_t Timings::*field, int timeoutMs) {
+  const auto started = TimeUtil::now();
+  while (true) {
+    const int64_t us = player.getTimings().*field;
+    if (us >= 0) return us;
+    if (player.isAborted()) return -1;
+    if (TimeUtil::elapse<std::chrono::milliseconds>(started).count()
+        >= timeoutMs)
+      return -1;
+    std::this_thread::sleep_for(std::chrono::microseconds(POLL_INTERVAL_US));
+  }
+}
+
+bool waitForFirstFrame(const FFmpegPlayer &player) {
+  return waitFor(player, &Timings::first_presented_us, FIRST_FRAME_TIMEOUT_MS)
+         >= 0;
+}
+
+void writeSamples(bench::JsonWriter &json, std::vector<Samples> &all) {
+  for (auto &samples : all) {
+    if (samples.ms.empty()) continue;
+    json.key(samples.name).beginObject();
+    bench::write_summary(json, bench::summarize(std::move(samples.ms)));
+    json.endObject();
+  }
+}
+
+/* opens the file runs times, false if no run got to a presented frame */
+bool runStartup(bench::JsonWriter &json, const SynthSpec &spec,
+  const std::string &filename, const Options &opts) {
+  std::vector<Samples> all = {
+    {"open_input_ms", &Timings::open_input_us},
+    {"stream_info_ms", &Timings::stream_info_us},
+    {"codec_init_ms", &Timings::codec_init_us},
+    {"audio_device_ms", &Timings::audio_device_us},
+    {"first_decoded_ms", &Timings::first_decoded_us},
+    {"first_presented_ms", &Timings::first_presented_us},
+  };
+  int failures = 0;
+  for (int i = 0; i < opts.runs; ++i) {
+    auto pPlayer = startPlayer(spec, filename, opts);
+    if (!pPlayer || !waitForFirstFrame(*pPlayer)) {
+      ++failures;
+      continue;
+    }
+    const Timings timings = pPlayer->getTimings();
+    for (auto &samples : all) samples.add(timings);
+  }
+
+  json.key("startup")
+    .beginObject()
+    .field("runs", opts.runs)
+    .field("failures", failures);
+  writeSamples(json, all);
+  json.endObject();
+  return failures < opts.runs;
+}
+
+/* seeks one player around the file, false if it could not be played */
+bool runSeeks(bench::JsonWriter &json, const SynthSpec &spec,
+  const std::string &filename, const Options &opts) {
+  auto pPlayer = startPlayer(spec, filename, opts);
+  if (!pPlayer || !waitForFirstFrame(*pPlayer)) return false;
+
+  const double range = pPlayer->getTotalTime() - SEEK_END_MARGIN_S;
+  if (range <= 0.0) return true;  // too short to seek in
+
+  std::vector<Samples> all = {
+    {"decoded_ms", &Timings::seek_decoded_us},
+    {"presented_ms", &Timings::seek_presented_us},
+  };
+  std::mt19937 rng(SEEK_SEED);
+  std::uniform_real_distribution<double> position(0.0, range);
+  int timeouts = 0;
+  for (int i = 0; i < opts.seeks && !pPlayer->isAborted(); ++i) {
+    pPlayer->seek(position(rng));
+    if (waitFor(*pPlayer, &Timings::seek_presented_us, SEEK_TIMEOUT_MS) < 0) {
+      ++timeouts;
+      continue;
+    }
+    const Timings timings = pPlayer->getTimings();
+    for (auto &samples : all) samples.add(timings);
+  }
+
+  json.key("seek")
+    .beginObject()
+    .field("seeks", opts.seeks)
+    .field("timeouts", timeouts);
+  writeSamples(json, all);
+  json.endObject();
+  return true;
+}
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  std::string output;
+  std::string mediaDir = "bench_media";
+  std::string filter;
+  double duration = 10.0;
+  Options opts;
+  for (int i = 1; i < argc; ++i) {
+    if (!std::strcmp(argv[i], "-o") && i + 1 < argc)
+      output = argv[++i];
+    else if (!std::strcmp(argv[i], "-d") && i + 1 < argc)
+      duration = std::atof(argv[++i]);
+    else if (!std::strcmp(argv[i], "-m") && i + 1 < argc)
+      mediaDir = argv[++i];
+    else if (!std::strcmp(argv[i], "-r") && i + 1 < argc)
+      opts.runs = std::atoi(argv[++i]);
+    else if (!std::strcmp(argv[i], "-n") && i + 1 < argc)
+      opts.seeks = std::atoi(argv[++i]);
+    else if (!std::strcmp(argv[i], "-s"))
+      opts.sdl_audio = true;
+    else if (argv[i][0] != '-')
+      filter = argv[i];
+    else {
+      std::cerr << "usage: " << argv[0]
+                << " [-o report.json] [-d seconds] [-m media_dir]"
+                   " [-r runs] [-n seeks] [-s] [filter]\n";
+      return 2;
+    }
+  }
+  if (duration <= 0.0) duration = 10.0;
+  if (opts.runs <= 0) opts.runs = 5;
+  if (opts.seeks < 0) opts.seeks = 0;
+
+  ffinit();
+  av_log_set_level(AV_LOG_QUIET);
+  // the report may go to stdout, keep the console for errors
+  GET_LOGGER3("multimedia.FFmpegPlayer")->setLevel(LogLevel::LERROR);
+  GET_LOGGER3("ffmpeg")->setLevel(LogLevel::LERROR);
+  // play() returns once playback runs, so seeks can come from here
+  FFmpegPlayer::is_native_mode = false;
+
+  bench::JsonWriter json;
+  json.beginObject()
+    .field("benchmark", "bench_latency")
+    .field("ffmpeg", av_version_info())
+    .field("audio_device", opts.sdl_audio ? "sdl" : "null")
+    .key("cases")
+    .beginArray();
+
+  bool failed = false;
+  for (auto &entry : bench::corpus(duration)) {
+    if (!filter.empty() && entry.name.find(filter) == std::string::npos)
+      continue;
+    json.beginObject().field("name", entry.name);
+
+    std::string error;
+    if (!bench::can_synthesize(entry.spec, error)) {
+      json.field("status", "skipped").field("reason", error).endObject();
+      continue;
+    }
+    std::cerr << "Running " << entry.name << "\n";
+    const std::string filename =
+      bench::synthesize_cached(entry.spec, mediaDir, error);
+    if (filename.empty()) {
+      json.field("status", "failed").field("reason", error).endObject();
+      failed = true;
+      continue;
+    }
+    if (!runStartup(json, entry.spec, filename, opts)
+        || !runSeeks(json, entry.spec, filename, opts)) {
+      json.field("status", "failed")
+        .field("reason", "no frame was presented")
+        .endObject();
+      failed = true;
+      continue;
+    }
+    json.field("status", "ok").endObject();
+  }
+  json.endArray().endObject();
+
+  if (!bench::write_report(json.str(), output)) {
+    std::cerr << "Couldn't write " << output << "\n";
+    return 1;
+  }
+  return failed ? 1 : 0;
+}
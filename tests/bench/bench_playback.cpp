@@ -0,0 +1,223 @@
+/**
+ * Plays a matrix of synthesized inputs headless and as fast as the pipeline
+ * goes, and reports throughput, CPU, memory and allocations as JSON.
+ *
+ *   bench_playback [-o report.json] [-d seconds] [-m media_dir] [filter]
+ *
+ * Inputs are generated into media_dir on the first run and reused after.
+ * Only cases whose name contains filter run. Exits with 1 if a case failed;
+ * cases the FFmpeg build has no codec for are reported as skipped.
+ */
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "BenchUtil.hpp"
+#include "MediaSynth.hpp"
+#include "multimedia/player/FFmpegPlayer.hpp"
+
+#define SDL_MAIN_HANDLED
+#include <SDL2/SDL.h>
+
+namespace
+{
+struct Case
+{
+  std::string name;
+  SynthSpec spec;
+};
+
+std::vector<Case> makeCases(double duration) {
+  struct Resolution
+  {
+    const char *name;
+    int width;
+    int height;
+  };
+  const Resolution resolutions[] = {
+    {"360p", 640, 360}, {"720p", 1280, 720}, {"1080p", 1920, 1080}};
+  const AVCodecID codecs[] = {
+    AV_CODEC_ID_H264, AV_CODEC_ID_MPEG4, AV_CODEC_ID_MJPEG};
+
+  std::vector<Case> cases;
+  for (bool withAudio : {false, true}) {
+    for (auto codec : codecs) {
+      for (auto &res : resolutions) {
+        Case c;
+        c.spec.video_codec = codec;
+        c.spec.width = res.width;
+        c.spec.height = res.height;
+        c.spec.audio_codec = withAudio ? AV_CODEC_ID_AAC : AV_CODEC_ID_NONE;
+        c.spec.duration = duration;
+        c.name = fmt::format("{}_{}_{}", withAudio ? "av" : "video",
+          avcodec_get_name(codec), res.name);
+        cases.push_back(c);
+      }
+    }
+  }
+  Case audioOnly;
+  audioOnly.spec.audio_codec = AV_CODEC_ID_AAC;
+  audioOnly.spec.duration = duration;
+  audioOnly.name = "audio_aac";
+  cases.push_back(audioOnly);
+  return cases;
+}
+
+void writeInput(bench::JsonWriter &json, const SynthSpec &spec) {
+  json.key("input").beginObject();
+  if (spec.hasVideo()) {
+    json.field("video_codec", avcodec_get_name(spec.video_codec))
+      .field("width", spec.width)
+      .field("height", spec.height)
+      .field("frame_rate", spec.frame_rate);
+  }
+  if (spec.hasAudio()) {
+    json.field("audio_codec", avcodec_get_name(spec.audio_codec))
+      .field("sample_rate", spec.sample_rate)
+      .field("channels", spec.channels);
+  }
+  json.field("duration_s", spec.duration).endObject();
+}
+
+/* plays one input to its end, false if the player could not */
+bool runCase(bench::JsonWriter &json, const SynthSpec &spec,
+  const std::string &filename) {
+  PlayerConfig config;
+  config.common.freerun = true;
+  config.common.auto_read_next_media = false;
+  config.common.enable_audio = spec.hasAudio();
+  config.common.enable_video = spec.hasVideo();
+  config.debug_on = false;
+
+  bench::reset_peak_rss();
+  const auto framePool0 = AVFramePool::instance()->stats();
+  const uint64_t allocations0 = bench::allocations();
+  const int64_t cpu0 = bench::process_cpu_time();
+  const auto started = TimeUtil::now();
+
+  FFmpegPlayer player(AudioDevice::NULL_SINK, VideoDevice::NULL_SINK);
+  if (!player.init(config)) return false;
+  player.play(MediaSource{filename});
+
+  const double wall =
+    TimeUtil::elapse<std::chrono::microseconds>(started).count() / 1e6;
+  const int64_t cpu = bench::process_cpu_time() - cpu0;
+  const uint64_t allocations = bench::allocations() - allocations0;
+  const auto framePool = AVFramePool::instance()->stats();
+  const int64_t peakRss = bench::peak_rss_kb();
+  const auto stats = player.getStats();
+  // nothing was presented: it failed to open, or to decode anything
+  if (stats.video_frames_presented == 0 && stats.audio_frames_decoded == 0)
+    return false;
+
+  const uint64_t frames =
+    stats.video_frames_decoded + stats.audio_frames_decoded;
+  json.field("wall_s", wall)
+    .field("speed", player.getAchievedSpeed(), 2)
+    .key("video")
+    .beginObject()
+    .field("frames_decoded", stats.video_frames_decoded)
+    .field("frames_presented", stats.video_frames_presented)
+    .field("frames_dropped", stats.video_frames_dropped)
+    .field("decode_fps", stats.video_frames_decoded / wall, 1)
+    .endObject()
+    .key("audio")
+    .beginObject()
+    .field("frames_decoded", stats.audio_frames_decoded)
+    .field("underruns", stats.audio_underruns)
+    .endObject()
+    .key("cpu_us")
+    .beginObject()
+    .field("process", cpu)
+    .field("demux", stats.demux_cpu_us)
+    .field("video_decode", stats.video_decode_cpu_us)
+    .field("audio_decode", stats.audio_decode_cpu_us)
+    .field("audio_output", stats.audio_output_cpu_us)
+    .field("present", stats.present_cpu_us)
+    .endObject()
+    .field("peak_rss_kb", peakRss)
+    .key("allocations")
+    .beginObject()
+    .field("operator_new", allocations)
+    .field("per_frame", frames ? (double) allocations / frames : 0.0, 2)
+    .field("frame_pool_misses", framePool.created - framePool0.created)
+    .endObject();
+  return true;
+}
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  std::string output;
+  std::string mediaDir = "bench_media";
+  std::string filter;
+  double duration = 10.0;
+  for (int i = 1; i < argc; ++i) {
+    if (!std::strcmp(argv[i], "-o") && i + 1 < argc)
+      output = argv[++i];
+    else if (!std::strcmp(argv[i], "-d") && i + 1 < argc)
+      duration = std::atof(argv[++i]);
+    else if (!std::strcmp(argv[i], "-m") && i + 1 < argc)
+      mediaDir = argv[++i];
+    else if (argv[i][0] != '-')
+      filter = argv[i];
+    else {
+      std::cerr << "usage: " << argv[0]
+                << " [-o report.json] [-d seconds] [-m media_dir] [filter]\n";
+      return 2;
+    }
+  }
+  if (duration <= 0.0) duration = 10.0;
+
+  ffinit();
+  av_log_set_level(AV_LOG_QUIET);
+  // the report may go to stdout, keep the console for errors
+  GET_LOGGER3("multimedia.FFmpegPlayer")->setLevel(LogLevel::LERROR);
+  GET_LOGGER3("ffmpeg")->setLevel(LogLevel::LERROR);
+  FFmpegPlayer::is_native_mode = true;
+
+  bench::JsonWriter json;
+  json.beginObject()
+    .field("benchmark", "bench_playback")
+    .field("ffmpeg", av_version_info())
+    .key("cases")
+    .beginArray();
+
+  bool failed = false;
+  for (auto &c : makeCases(duration)) {
+    if (!filter.empty() && c.name.find(filter) == std::string::npos)
+      continue;
+    json.beginObject().field("name", c.name);
+    writeInput(json, c.spec);
+
+    std::string error;
+    if (!bench::can_synthesize(c.spec, error)) {
+      json.field("status", "skipped").field("reason", error).endObject();
+      continue;
+    }
+    std::cerr << "Running " << c.name << "\n";
+    const std::string filename =
+      bench::synthesize_cached(c.spec, mediaDir, error);
+    if (filename.empty()) {
+      json.field("status", "failed").field("reason", error).endObject();
+      failed = true;
+      continue;
+    }
+    if (!runCase(json, c.spec, filename)) {
+      json.field("status", "failed")
+        .field("reason", "nothing was played")
+        .endObject();
+      failed = true;
+      continue;
+    }
+    json.field("status", "ok").endObject();
+  }
+  json.endArray().endObject();
+
+  if (!bench::write_report(json.str(), output)) {
+    std::cerr << "Couldn't write " << output << "\n";
+    return 1;
+  }
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,418 @@
+/**
+ * Times the primitives the pipeline is built on and reports nanoseconds per
+ * operation as JSON.
+ *
+ *   bench_primitives [-o report.json] [-w warmup] [-n iterations] [filter]
+ *
+ * Every case runs `warmup` untimed samples, then `iterations` timed ones of
+ * a fixed batch of operations; the report has the percentiles over the
+ * samples. Only cases whose name contains filter run.
+ */
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <streambuf>
+#include <thread>
+#include <vector>
+
+#include "BenchUtil.hpp"
+#include "multimedia/common/AVQueue.hpp"
+#include "multimedia/common/AudioBuffer.hpp"
+#include "multimedia/common/Logger.hpp"
+#include "multimedia/common/MPSCQueue.hpp"
+#include "multimedia/common/Mutex.hpp"
+#include "multimedia/filter/Converter.hpp"
+#include "multimedia/filter/Resampler.hpp"
+
+#define QUEUE_ITEMS      100000
+#define QUEUE_PRODUCERS  4
+#define AUDIO_RING_BYTES (64 << 10)
+#define AUDIO_OPS        4096
+#define CONVERTER_FRAMES 4
+#define RESAMPLER_FRAMES 64
+#define RESAMPLER_FRAME_SAMPLES 1024
+#define LOGGER_OPS       10000
+
+namespace
+{
+class Runner
+{
+public:
+  Runner(bench::JsonWriter &json, int warmup, int iterations,
+    std::string filter)
+    : json_(json)
+    , warmup_(warmup)
+    , iterations_(iterations)
+    , filter_(std::move(filter)) {}
+
+  bool wants(const std::string &name) const {
+    return filter_.empty() || name.find(filter_) != std::string::npos;
+  }
+
+  /**
+   * fn runs one sample and returns its operation count; params adds the
+   * case's settings to its JSON object.
+   */
+  void run(const std::string &name, const std::function<int64_t()> &fn,
+    const std::function<void(bench::JsonWriter &)> &params = {}) {
+    if (!wants(name)) return;
+    std::cerr << "Running " << name << "\n";
+    const auto summary = bench::measure(warmup_, iterations_, fn);
+    json_.beginObject().field("name", name);
+    if (params) params(json_);
+    json_.key("ns_per_op").beginObject();
+    bench::write_summary(json_, summary);
+    json_.endObject().endObject();
+  }
+
+private:
+  bench::JsonWriter &json_;
+  int warmup_;
+  int iterations_;
+  std::string filter_;
+};
+
+void benchAVQueue(Runner &runner) {
+  auto pPkt = makeAVPacket();
+  pPkt->size = 4096;
+
+  AVPacketQueue queue;
+  queue.open();
+  runner.run(
+    "avqueue_push_pop_1to1",
+    [&] {
+      std::thread producer([&] {
+        for (int i = 0; i < QUEUE_ITEMS; ++i) queue.push(pPkt);
+      });
+      AVPacketPtr x;
+      for (int i = 0; i < QUEUE_ITEMS; ++i) queue.popWait(x);
+      producer.join();
+      return (int64_t) QUEUE_ITEMS;
+    },
+    [](bench::JsonWriter &json) {
+      json.field("producers", 1).field("items", QUEUE_ITEMS);
+    });
+
+  // AVQueue takes one producer, more have to serialize on their own
+  Mutex::type mutex;
+  runner.run(
+    "avqueue_push_pop_Nto1_locked",
+    [&] {
+      std::vector<std::thread> producers;
+      for (int p = 0; p < QUEUE_PRODUCERS; ++p) {
+        producers.emplace_back([&] {
+          for (int i = 0; i < QUEUE_ITEMS / QUEUE_PRODUCERS; ++i) {
+            Mutex::lock lock(mutex);
+            queue.push(pPkt);
+          }
+        });
+      }
+      AVPacketPtr x;
+      for (int i = 0; i < QUEUE_ITEMS; ++i) queue.popWait(x);
+      for (auto &producer : producers) producer.join();
+      return (int64_t) QUEUE_ITEMS;
+    },
+    [](bench::JsonWriter &json) {
+      json.field("producers", QUEUE_PRODUCERS).field("items", QUEUE_ITEMS);
+    });
+
+  // the lock-free ring the logger uses for N:1, for comparison
+  MPSCQueue<AVPacketPtr> ring(AVPacketQueue::kDefaultCapacity);
+  runner.run(
+    "mpscqueue_push_pop_Nto1",
+    [&] {
+      std::vector<std::thread> producers;
+      for (int p = 0; p < QUEUE_PRODUCERS; ++p) {
+        producers.emplace_back([&] {
+          for (int i = 0; i < QUEUE_ITEMS / QUEUE_PRODUCERS; ++i) {
+            while (!ring.tryEmplace([&](AVPacketPtr &slot) { slot = pPkt; }))
+              std::this_thread::yield();
+          }
+        });
+      }
+      AVPacketPtr x;
+      for (int i = 0; i < QUEUE_ITEMS;) {
+        if (ring.tryConsume([&](AVPacketPtr &slot) { x = std::move(slot); }))
+          ++i;
+        else
+          std::this_thread::yield();
+      }
+      for (auto &producer : producers) producer.join();
+      return (int64_t) QUEUE_ITEMS;
+    },
+    [](bench::JsonWriter &json) {
+      json.field("producers", QUEUE_PRODUCERS).field("items", QUEUE_ITEMS);
+    });
+}
+
+void benchAudioBuffer(Runner &runner) {
+  AudioBuffer buffer(AUDIO_RING_BYTES);
+  std::vector<uint8_t> data(AUDIO_RING_BYTES / 2, 0x5a);
+  // 4 KiB is one period of 1024 S16 stereo samples
+  for (uint32_t chunk : {1024u, 4096u, 16384u}) {
+    runner.run(
+      fmt::format("audiobuffer_fill_extract_{}", chunk),
+      [&] {
+        for (int i = 0; i < AUDIO_OPS; ++i) {
+          buffer.fill(data.data(), chunk);
+          buffer.extract(data.data(), chunk);
+        }
+        return (int64_t) AUDIO_OPS;
+      },
+      [&](bench::JsonWriter &json) {
+        json.field("bytes_per_op", (int64_t) chunk)
+          .field("ring_bytes", (int64_t) buffer.capacity());
+      });
+  }
+}
+
+AVFramePtr makeVideoFrame(int width, int height, AVPixelFormat format) {
+  auto pFrame = makeAVFrame();
+  pFrame->width = width;
+  pFrame->height = height;
+  pFrame->format = format;
+  if (av_frame_get_buffer(pFrame.get(), Converter::kAlign) < 0) return nullptr;
+  // a gradient, so swscale has no uniform rows to shortcut
+  for (int p = 0; p < AV_NUM_DATA_POINTERS && pFrame->data[p]; ++p) {
+    const int rows = p == 0 ? height : AV_CEIL_RSHIFT(height, 1);
+    for (int y = 0; y < rows; ++y) {
+      for (int x = 0; x < pFrame->linesize[p]; ++x)
+        pFrame->data[p][y * pFrame->linesize[p] + x] = (uint8_t) (x + y);
+    }
+  }
+  return pFrame;
+}
+
+void benchConverter(Runner &runner) {
+  struct Conversion
+  {
+    int in_width, in_height;
+    AVPixelFormat in_format;
+    int out_width, out_height;
+    AVPixelFormat out_format;
+  };
+  const Conversion conversions[] = {
+    // what a texture upload or a frame tap asks for
+    {640, 360, AV_PIX_FMT_YUV420P, 640, 360, AV_PIX_FMT_RGBA},
+    {1280, 720, AV_PIX_FMT_YUV420P, 1280, 720, AV_PIX_FMT_RGBA},
+    {1920, 1080, AV_PIX_FMT_YUV420P, 1920, 1080, AV_PIX_FMT_RGBA},
+    {1920, 1080, AV_PIX_FMT_YUV420P, 1920, 1080, AV_PIX_FMT_NV12},
+    // a window smaller than the picture
+    {1920, 1080, AV_PIX_FMT_YUV420P, 1280, 720, AV_PIX_FMT_YUV420P},
+    {3840, 2160, AV_PIX_FMT_YUV420P, 1920, 1080, AV_PIX_FMT_YUV420P},
+  };
+  for (auto &c : conversions) {
+    const std::string name = fmt::format("converter_{}x{}_{}_to_{}x{}_{}",
+      c.in_width, c.in_height, av_get_pix_fmt_name(c.in_format), c.out_width,
+      c.out_height, av_get_pix_fmt_name(c.out_format));
+    if (!runner.wants(name)) continue;
+
+    auto pInFrame = makeVideoFrame(c.in_width, c.in_height, c.in_format);
+    Converter converter;
+    if (!pInFrame
+        || !converter.init({c.in_width, c.in_height, c.in_format},
+          {c.out_width, c.out_height, c.out_format})) {
+      std::cerr << "Skipping " << name << ", couldn't set it up\n";
+      continue;
+    }
+    runner.run(name, [&] {
+      for (int i = 0; i < CONVERTER_FRAMES; ++i) {
+        auto pOutFrame = makeAVFrame();
+        pOutFrame->width = c.out_width;
+        pOutFrame->height = c.out_height;
+        pOutFrame->format = c.out_format;
+        converter.run(pInFrame, pOutFrame);
+      }
+      return (int64_t) CONVERTER_FRAMES;
+    });
+  }
+}
+
+void benchResampler(Runner &runner) {
+  struct Conversion
+  {
+    int in_rate;
+    AVSampleFormat in_format;
+    int out_rate;
+    AVSampleFormat out_format;
+  };
+  // decoders give planar float, the audio device takes S16
+  const Conversion conversions[] = {
+    {44100, AV_SAMPLE_FMT_FLTP, 48000, AV_SAMPLE_FMT_S16},
+    {48000, AV_SAMPLE_FMT_FLTP, 44100, AV_SAMPLE_FMT_S16},
+    {48000, AV_SAMPLE_FMT_FLTP, 48000, AV_SAMPLE_FMT_S16},
+    {44100, AV_SAMPLE_FMT_S16, 48000, AV_SAMPLE_FMT_S16},
+  };
+  for (auto &c : conversions) {
+    const std::string name =
+      fmt::format("resampler_{}_{}_to_{}_{}", c.in_rate,
+        av_get_sample_fmt_name(c.in_format), c.out_rate,
+        av_get_sample_fmt_name(c.out_format));
+    if (!runner.wants(name)) continue;
+
+    auto pInFrame = makeAVFrame();
+    pInFrame->sample_rate = c.in_rate;
+    pInFrame->format = c.in_format;
+    pInFrame->nb_samples = RESAMPLER_FRAME_SAMPLES;
+    av_channel_layout_default(&pInFrame->ch_layout, 2);
+    Resampler resampler;
+    if (av_frame_get_buffer(pInFrame.get(), 0) < 0
+        || !resampler.init({c.in_rate, 2, c.in_format},
+          {c.out_rate, 2, c.out_format})) {
+      std::cerr << "Skipping " << name << ", couldn't set it up\n";
+      continue;
+    }
+    // a 440 Hz tone, silence would take no real work in some paths
+    for (int i = 0; i < RESAMPLER_FRAME_SAMPLES; ++i) {
+      const double v = std::sin(2 * M_PI * 440 * i / c.in_rate) * 0.5;
+      if (c.in_format == AV_SAMPLE_FMT_FLTP) {
+        ((float *) pInFrame->data[0])[i] = (float) v;
+        ((float *) pInFrame->data[1])[i] = (float) v;
+      }
+      else {
+        ((int16_t *) pInFrame->data[0])[2 * i] = (int16_t) (v * 32767);
+        ((int16_t *) pInFrame->data[0])[2 * i + 1] = (int16_t) (v * 32767);
+      }
+    }
+    runner.run(
+      name,
+      [&] {
+        for (int i = 0; i < RESAMPLER_FRAMES; ++i) {
+          auto pOutFrame = makeAVFrame();
+          resampler.run(pInFrame, pOutFrame);
+        }
+        return (int64_t) RESAMPLER_FRAMES;
+      },
+      [](bench::JsonWriter &json) {
+        json.field("samples_per_op", RESAMPLER_FRAME_SAMPLES)
+          .field("channels", 2);
+      });
+  }
+}
+
+/* formats like a console or file appender would, then drops the text */
+class DiscardAppender : public LogAppender
+{
+public:
+  void log(const LogEvent::ptr &pEvent,
+    const std::shared_ptr<Logger> &pLogger) override {
+    formatter_->format(out_, pEvent, pLogger);
+  }
+  YAML::Node toYaml() const override { return {}; }
+
+private:
+  struct NullBuf : public std::streambuf
+  {
+    int overflow(int c) override { return c; }
+    std::streamsize xsputn(const char *, std::streamsize n) override {
+      return n;
+    }
+  };
+  NullBuf buf_;
+  std::ostream out_{&buf_};
+};
+
+void logAt(const Logger::ptr &pLogger, LogLevel::Level level, int i) {
+  switch (level) {
+  case LogLevel::LTRACE:
+    ILOG_TRACE_FMT(pLogger, "frame {} pts {} size {}", i, i * 3003, 4096);
+    break;
+  case LogLevel::LDEBUG:
+    ILOG_DEBUG_FMT(pLogger, "frame {} pts {} size {}", i, i * 3003, 4096);
+    break;
+  case LogLevel::LINFO:
+    ILOG_INFO_FMT(pLogger, "frame {} pts {} size {}", i, i * 3003, 4096);
+    break;
+  case LogLevel::LWARN:
+    ILOG_WARN_FMT(pLogger, "frame {} pts {} size {}", i, i * 3003, 4096);
+    break;
+  case LogLevel::LERROR:
+    ILOG_ERROR_FMT(pLogger, "frame {} pts {} size {}", i, i * 3003, 4096);
+    break;
+  case LogLevel::LCRITICAL:
+    ILOG_CRITICAL_FMT(pLogger, "frame {} pts {} size {}", i, i * 3003, 4096);
+    break;
+  case LogLevel::LFATAL:
+    ILOG_FATAL_FMT(pLogger, "frame {} pts {} size {}", i, i * 3003, 4096);
+    break;
+  default: break;
+  }
+}
+
+void benchLogger(Runner &runner) {
+  // no console or file, only the appender below
+  auto pLogger = std::make_shared<Logger>(
+    "bench.primitives", LogLevel::LTRACE, kDefaultFormatPattern, 0);
+  auto pAppender = std::make_shared<DiscardAppender>();
+  pAppender->setFormatter(pLogger->getFormatter());
+  pLogger->addAppender(pAppender);
+
+  for (bool emitted : {false, true}) {
+    pLogger->setLevel(emitted ? LogLevel::LTRACE : LogLevel::LCLOSE);
+    for (int l = LogLevel::LTRACE; l <= LogLevel::LFATAL; ++l) {
+      const auto level = (LogLevel::Level) l;
+      runner.run(
+        fmt::format("logger_{}_{}", LogLevel(level).toString(),
+          emitted ? "emitted" : "filtered"),
+        [&] {
+          for (int i = 0; i < LOGGER_OPS; ++i) logAt(pLogger, level, i);
+          return (int64_t) LOGGER_OPS;
+        },
+        [&](bench::JsonWriter &json) {
+          json.field("compiled_out", l < MM_LOG_MIN_LEVEL);
+        });
+    }
+  }
+}
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  std::string output;
+  std::string filter;
+  int warmup = 3;
+  int iterations = 30;
+  for (int i = 1; i < argc; ++i) {
+    if (!std::strcmp(argv[i], "-o") && i + 1 < argc)
+      output = argv[++i];
+    else if (!std::strcmp(argv[i], "-w") && i + 1 < argc)
+      warmup = std::atoi(argv[++i]);
+    else if (!std::strcmp(argv[i], "-n") && i + 1 < argc)
+      iterations = std::atoi(argv[++i]);
+    else if (argv[i][0] != '-')
+      filter = argv[i];
+    else {
+      std::cerr << "usage: " << argv[0]
+                << " [-o report.json] [-w warmup] [-n iterations] [filter]\n";
+      return 2;
+    }
+  }
+  if (warmup < 0) warmup = 0;
+  if (iterations <= 0) iterations = 30;
+
+  av_log_set_level(AV_LOG_QUIET);
+
+  bench::JsonWriter json;
+  json.beginObject()
+    .field("benchmark", "bench_primitives")
+    .field("ffmpeg", av_version_info())
+    .field("warmup", warmup)
+    .field("iterations", iterations)
+    .key("cases")
+    .beginArray();
+
+  Runner runner(json, warmup, iterations, filter);
+  benchAVQueue(runner);
+  benchAudioBuffer(runner);
+  benchConverter(runner);
+  benchResampler(runner);
+  benchLogger(runner);
+  json.endArray().endObject();
+
+  if (!bench::write_report(json.str(), output)) {
+    std::cerr << "Couldn't write " << output << "\n";
+    return 1;
+  }
+  return 0;
+}
@@ -3,6 +3,7 @@
 #include "multimedia/device/Device.hpp"
 #include "multimedia/common/FFmpegUtil.hpp"
 #include "multimedia/player/FFmpegPlayer.hpp"
+#include "../bench/MediaSynth.hpp"
 
 #define SDL_MAIN_HANDLED
 #include <SDL2/SDL.h>
@@ -20,10 +21,15 @@ int main(int argc, char *argv[]) {
 
   av_log_set_level(AV_LOG_QUIET);
 
+#if defined(__WIN__)
   DeviceConfig dconfig;
   dconfig.grabber.draw_mouse = 0;
   dconfig.is_camera = true;
   MediaSource cameraGarb = {"video=USB2.0 HD UVC WebCam", "dshow", dconfig};
+#else
+  // no dshow here, a lavfi test pattern stands in for the webcam
+  MediaSource cameraGarb = bench::lavfi_camera();
+#endif
 
   PlayerConfig config;
   FFmpegPlayer::is_native_mode = true;
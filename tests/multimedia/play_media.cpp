@@ -1,6 +1,7 @@
 #include <csignal>
 
 #include "multimedia/player/FFmpegPlayer.hpp"
+#include "../bench/MediaSynth.hpp"
 
 #define SDL_MAIN_HANDLED
 #include <SDL2/SDL.h>
@@ -19,13 +20,21 @@ int main(int argc, char *argv[]) {
   av_log_set_level(AV_LOG_QUIET);
 
   MediaList list;
-#if defined(__WIN__)
-  list.add(MediaSource{"E:/Data/video/bad_apple.mp4"});
-  list.add(MediaSource{"E:/Data/video/1080p U149.mp4"});
-#elif defined(__LINUX__)
-  list.add(MediaSource{"/home/youmu/Desktop/bad_apple.mp4"});
-  list.add(MediaSource{"/home/youmu/Desktop/227.mp4"});
-#endif
+  for (int i = 1; i < argc; ++i) list.add(MediaSource{argv[i]});
+  if (list.isEmpty()) {
+    // nothing given, play a clip of the synthetic corpus
+    for (auto &entry : bench::corpus()) {
+      if (entry.name != "h264_720p" && entry.name != "mpeg4_720p") continue;
+      std::string error;
+      auto filename =
+        bench::synthesize_cached(entry.spec, "bench_media", error);
+      if (!filename.empty()) {
+        list.add(MediaSource{filename});
+        break;
+      }
+    }
+    if (list.isEmpty()) return 1;
+  }
 
   PlayerConfig config;
   FFmpegPlayer::is_native_mode = true;
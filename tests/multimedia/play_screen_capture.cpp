@@ -1,6 +1,7 @@
 #include <csignal>
 
 #include "multimedia/player/FFmpegPlayer.hpp"
+#include "../bench/MediaSynth.hpp"
 
 #define SDL_MAIN_HANDLED
 #include <SDL2/SDL.h>
@@ -18,10 +19,15 @@ int main(int argc, char *argv[]) {
 
   av_log_set_level(AV_LOG_QUIET);
 
+#if defined(__WIN__)
   DeviceConfig dconfig;
   dconfig.grabber.draw_mouse = 0;
   MediaSource desktopGarb = {"desktop", "gdigrab", dconfig};
   // MediaSource chromeGarb = {"video=chrome.exe", "gdigrab", dconfig};
+#else
+  // no gdigrab here, a lavfi test pattern stands in for the desktop
+  MediaSource desktopGarb = bench::lavfi_screen();
+#endif
 
   PlayerConfig config;
   FFmpegPlayer::is_native_mode = true;
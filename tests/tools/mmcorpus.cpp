@@ -0,0 +1,125 @@
+/**
+ * Generates the synthetic test corpus of bench::corpus().
+ *
+ *   mmcorpus [-d seconds] <dir> [filter]
+ *   mmcorpus -l [filter]
+ *
+ * Files already in dir are kept, so running it again only fills in what is
+ * missing; the `corpus` build target runs it once. dir/manifest.json lists
+ * every entry with its file, size and parameters. -l lists the entries
+ * and generates nothing. Only entries whose name contains filter
+ * are handled.
+ */
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include "../bench/BenchUtil.hpp"
+#include "../bench/MediaSynth.hpp"
+#include "multimedia/common/OSUtil.hpp"
+
+namespace
+{
+void writeSpec(bench::JsonWriter &json, const SynthSpec &spec) {
+  if (spec.hasVideo()) {
+    json.field("video_codec", avcodec_get_name(spec.video_codec))
+      .field("width", spec.width)
+      .field("height", spec.height)
+      .field("frame_rate", spec.frame_rate)
+      .field("gop_size", spec.gop_size > 0 ? spec.gop_size
+                                           : 2 * spec.frame_rate)
+      .field("vfr", spec.vfr);
+  }
+  if (spec.hasAudio()) {
+    json.field("audio_codec", avcodec_get_name(spec.audio_codec))
+      .field("audio_source",
+        spec.audio_source == SynthSpec::NOISE ? "noise" : "sine")
+      .field("audio_tracks", spec.audio_tracks)
+      .field("sample_rate", spec.sample_rate)
+      .field("channels", spec.channels);
+  }
+  json.field("duration_s", spec.duration);
+}
+
+int64_t fileSize(const std::string &filename) {
+  std::ifstream file(filename, std::ios::binary | std::ios::ate);
+  return file ? (int64_t) file.tellg() : -1;
+}
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  std::string dir;
+  std::string filter;
+  double duration = 10.0;
+  bool listOnly = false;
+  bool badArgs = false;
+  for (int i = 1; i < argc; ++i) {
+    if (!std::strcmp(argv[i], "-d") && i + 1 < argc)
+      duration = std::atof(argv[++i]);
+    else if (!std::strcmp(argv[i], "-l"))
+      listOnly = true;
+    else if (argv[i][0] != '-' && dir.empty())
+      dir = argv[i];
+    else if (argv[i][0] != '-')
+      filter = argv[i];
+    else
+      badArgs = true;
+  }
+  if (badArgs || (dir.empty() && !listOnly)) {
+    std::cerr << "usage: " << argv[0] << " [-d seconds] <dir> [filter]\n"
+              << "       " << argv[0] << " -l [filter]\n";
+    return 2;
+  }
+  if (duration <= 0.0) duration = 10.0;
+  // nothing is written with -l, a lone argument is the filter
+  if (listOnly && filter.empty()) filter.swap(dir);
+
+  av_log_set_level(AV_LOG_ERROR);
+
+  bench::JsonWriter json;
+  json.beginObject()
+    .field("ffmpeg", av_version_info())
+    .key("entries")
+    .beginArray();
+  bool failed = false;
+  for (auto &entry : bench::corpus(duration)) {
+    if (!filter.empty() && entry.name.find(filter) == std::string::npos)
+      continue;
+    if (listOnly) {
+      std::cout << entry.name << "\t" << entry.spec.name() << "\n";
+      continue;
+    }
+
+    json.beginObject().field("name", entry.name);
+    std::string error;
+    if (!bench::can_synthesize(entry.spec, error)) {
+      std::cerr << "Skipping " << entry.name << ": " << error << "\n";
+      json.field("status", "skipped").field("reason", error).endObject();
+      continue;
+    }
+    std::cerr << "Generating " << entry.name << "\n";
+    const std::string filename =
+      bench::synthesize_cached(entry.spec, dir, error);
+    if (filename.empty()) {
+      std::cerr << "Failed " << entry.name << ": " << error << "\n";
+      json.field("status", "failed").field("reason", error).endObject();
+      failed = true;
+      continue;
+    }
+    json.field("status", "ok")
+      .field("file", os_api::basename(filename))
+      .field("bytes", fileSize(filename));
+    writeSpec(json, entry.spec);
+    json.endObject();
+  }
+  json.endArray().endObject();
+  if (listOnly) return 0;
+
+  const std::string manifest = dir + "/manifest.json";
+  if (!bench::write_report(json.str(), manifest)) {
+    std::cerr << "Couldn't write " << manifest << "\n";
+    return 1;
+  }
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,184 @@
+/**
+ * Expands a BinaryLog file into text.
+ *
+ *   mmlogdecode <file.mmblog> [pattern]
+ *
+ * pattern is a LogFormatter pattern, kDefaultFormatPattern by default. Events
+ * are printed in timestamp order across threads.
+ */
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <map>
+
+#include "multimedia/common/BinaryLog.hpp"
+
+namespace
+{
+struct SiteInfo
+{
+  LogLevel::Level level;
+  uint32_t line;
+  // LogEvent keeps raw pointers, the deque keeps them stable
+  const char *file;
+  const char *function;
+  const char *fmt;
+};
+
+struct EventInfo
+{
+  BinaryLog::EventHeader header;
+  size_t payload;  // offset into the file data
+};
+
+class Reader
+{
+public:
+  explicit Reader(const std::string &data) : data_(data) {}
+
+  bool done() const { return pos_ >= data_.size(); }
+  size_t pos() const { return pos_; }
+
+  template <typename T>
+  bool take(T &value) {
+    if (data_.size() - pos_ < sizeof(T)) return false;
+    std::memcpy(&value, data_.data() + pos_, sizeof(T));
+    pos_ += sizeof(T);
+    return true;
+  }
+  bool takeString(std::string &str) {
+    uint32_t size;
+    if (!take(size) || data_.size() - pos_ < size) return false;
+    str.assign(data_.data() + pos_, size);
+    pos_ += size;
+    return true;
+  }
+  bool skip(size_t size) {
+    if (data_.size() - pos_ < size) return false;
+    pos_ += size;
+    return true;
+  }
+
+private:
+  const std::string &data_;
+  size_t pos_{0};
+};
+}  // namespace
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    std::cerr << "usage: " << argv[0] << " <file> [pattern]" << std::endl;
+    return 1;
+  }
+
+  std::ifstream in(argv[1], std::ios::binary);
+  if (!in) {
+    std::cerr << argv[1] << " cannot be opened" << std::endl;
+    return 1;
+  }
+  const std::string data(
+    (std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+  if (data.size() < sizeof(BinaryLog::kMagic)
+      || std::memcmp(data.data(), BinaryLog::kMagic, sizeof(BinaryLog::kMagic))
+           != 0) {
+    std::cerr << argv[1] << " is not a binary log" << std::endl;
+    return 1;
+  }
+
+  std::deque<std::string> strings;
+  std::map<uint32_t, SiteInfo> sites;
+  std::map<uint32_t, Logger::ptr> loggers;
+  std::map<uint32_t, std::pair<std::string, std::string>> threads;
+  std::vector<EventInfo> events;
+
+  Reader reader(data);
+  reader.skip(sizeof(BinaryLog::kMagic));
+  bool ok = true;
+  while (ok && !reader.done()) {
+    uint8_t type = 0;
+    uint32_t id = 0;
+    reader.take(type);
+    switch (type) {
+    case BinaryLog::SITE: {
+      uint8_t level;
+      SiteInfo site;
+      std::string file, function, fmt;
+      ok = reader.take(id) && reader.take(level) && reader.take(site.line)
+           && reader.takeString(file) && reader.takeString(function)
+           && reader.takeString(fmt);
+      if (!ok) break;
+      site.level = static_cast<LogLevel::Level>(level);
+      site.file = strings.emplace_back(std::move(file)).c_str();
+      site.function = strings.emplace_back(std::move(function)).c_str();
+      site.fmt = strings.emplace_back(std::move(fmt)).c_str();
+      sites[id] = site;
+      break;
+    }
+    case BinaryLog::LOGGER: {
+      std::string name;
+      ok = reader.take(id) && reader.takeString(name);
+      if (ok) loggers[id] = std::make_shared<Logger>(name);
+      break;
+    }
+    case BinaryLog::THREAD: {
+      std::string name, tid;
+      ok = reader.take(id) && reader.takeString(name) && reader.takeString(tid);
+      if (ok) threads[id] = {std::move(name), std::move(tid)};
+      break;
+    }
+    case BinaryLog::EVENT: {
+      EventInfo event;
+      ok = reader.take(event.header);
+      if (!ok) break;
+      event.payload = reader.pos();
+      ok = reader.skip(event.header.size);
+      if (ok) events.push_back(event);
+      break;
+    }
+    default: ok = false; break;
+    }
+  }
+  if (!ok) {
+    // a crashed writer leaves a torn tail, keep what came before it
+    std::cerr << argv[1] << " is truncated or corrupt near byte "
+              << reader.pos() << std::endl;
+  }
+
+  // thread chunks reach the file in flush order, not in time order
+  std::stable_sort(events.begin(), events.end(),
+    [](const EventInfo &lhs, const EventInfo &rhs) {
+      return lhs.header.timestamp < rhs.header.timestamp;
+    });
+
+  LogFormatter formatter(argc > 2 ? argv[2] : kDefaultFormatPattern);
+  auto pUnknown = std::make_shared<Logger>("unknown");
+  fmt::memory_buffer out;
+  for (const auto &event : events) {
+    auto site = sites.find(event.header.site);
+    if (site == sites.end()) continue;
+    const SiteInfo &info = site->second;
+
+    LogEvent logEvent(info.level, std::thread::id(), info.file,
+      static_cast<int32_t>(info.line), info.function, event.header.timestamp);
+    auto thread = threads.find(event.header.thread);
+    if (thread != threads.end()) {
+      logEvent.setThread(thread->second.first, thread->second.second);
+    }
+    else {
+      logEvent.setThread("unknown", std::to_string(event.header.thread));
+    }
+    logEvent.format("{}", BinaryLog::formatPayload(info.fmt,
+                            data.data() + event.payload, event.header.size));
+
+    auto logger = loggers.find(event.header.logger);
+    out.clear();
+    formatter.format(out, logEvent,
+      logger != loggers.end() ? *logger->second : *pUnknown);
+    std::fwrite(out.data(), 1, out.size(), stdout);
+  }
+  return ok ? 0 : 2;
+}